@@ -5,6 +5,9 @@
 #include <unordered_map>
 #include <climits>
 #include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include "../../result_file.h"
 
 using namespace std;
 
@@ -40,6 +43,109 @@ static inline void splitLine(string &line, vector<string> &parts) {
 //}
 
 
+// accounts 1 packet of the sender result, lineCount is its 1-based position in the file
+static inline void handleSenderRecord(
+        const result_sender_record_t &record,
+        size_t lineCount,
+        unsigned long long &senderStartTime,
+        unsigned long long &senderEndTime,
+        unsigned long long &forwarderStartTime,
+        unsigned long long &forwarderEndTime,
+        unordered_map<unsigned long, NodeStat> &nodes,
+        unordered_map<unsigned long, ControlStat> &controls) {
+    unsigned long nodeId = record.dst_id;
+    unsigned long long sentTime = record.time_send;
+    auto &node = nodes[nodeId];
+
+    senderStartTime = min(sentTime, senderStartTime);
+    senderEndTime = max(sentTime, senderEndTime);
+
+    if (record.is_control) { // control
+        node.expectedControl = sentTime;
+        controls[lineCount - 1].nodeId = nodeId;
+#ifdef MONITOR_NODE_ID
+        if (nodeId == MONITOR_NODE_ID)
+            printf("%zd: C %llu\n", lineCount, sentTime);
+#endif
+        return;
+    }
+
+    // data
+    unsigned long long t8 = record.time_receive;
+    unsigned long long t1 = record.time_control;
+    unsigned long long t2 = record.time_control_arrive_f;
+    unsigned long long t4 = record.time_arrive_f;
+    unsigned long long t7 = record.time_exit_f;
+
+    if (t8 == 0) { // dropped
+        node.dropped++;
+#ifdef MONITOR_NODE_ID
+        if (nodeId == MONITOR_NODE_ID)
+            printf("%zd: D Dropped\n", nodeId);
+#endif
+    } else {
+        senderEndTime = max(t8, senderEndTime);
+        if (t2 != 0) forwarderStartTime = min(t2, forwarderStartTime);
+        forwarderStartTime = min(t4, forwarderStartTime);
+        forwarderStartTime = min(t7, forwarderStartTime);
+        forwarderEndTime = max(t2, forwarderEndTime);
+        forwarderEndTime = max(t4, forwarderEndTime);
+        forwarderEndTime = max(t7, forwarderEndTime);
+
+        if (t1 < node.expectedControl) { // mis-destinated
+#ifdef MONITOR_NODE_ID
+            if (nodeId == MONITOR_NODE_ID)
+                printf("%zd: D expect %llu now %llu\n", lineCount, node.expectedControl, t1);
+#endif
+            node.misDestinated++;
+        } else {
+            node.correctReceived++;
+            node.lastT8 = max(t8, node.lastT8);
+            if (node.firstT3 == 0) { // first packet
+                node.firstT3 = node.oldT3 = sentTime;
+                node.firstT8 = t8;
+            } else {
+                auto v1 = t8 - node.oldT3;
+                auto v2 = t8 - sentTime;
+                node.totalAge += (v1 * v1 - v2 * v2) / 2;
+                node.oldT3 = sentTime;
+            }
+        }
+    }
+}
+
+// parses 1 line of the text format of the sender result, returns false if the line is skipped
+static inline bool parseSenderLine(string &line, const char *filename, size_t lineCount, result_sender_record_t &record) {
+    vector<string> parts;
+    splitLine(line, parts);
+    if (parts.size() < 3) {
+        fprintf(stderr, "%s:%zd doesn't have at least 3 parts, skip!\n", filename, lineCount);
+        return false;
+    }
+    record = result_sender_record_t();
+    record.dst_id = stoul(parts[1]);
+    record.time_send = stoull(parts[2]);
+    if (parts[0] == "1") { // control
+        record.is_control = 1;
+        return true;
+    }
+    if (parts[0] != "0") {
+        fprintf(stderr, "%s:%zd doesn't start with 0 (data) or 1 (control), skip!\n", filename, lineCount);
+        return false;
+    }
+    if (parts.size() < 9) {
+        fprintf(stderr, "%s:%zd [data] doesn't have 9 parts [0] [node_id] [t3] [t8] [t1] [t2] [t4] [t5] [t7], skip!\n", filename, lineCount);
+        return false;
+    }
+    record.time_receive = stoull(parts[3]);
+    record.time_control = stoull(parts[4]);
+    record.time_control_arrive_f = stoull(parts[5]);
+    record.time_arrive_f = stoull(parts[6]);
+    record.time_after_lookup_f = stoull(parts[7]);
+    record.time_exit_f = stoull(parts[8]);
+    return true;
+}
+
 static inline void parseSenderFile(
         char **argv,
         unsigned long long &senderStartTime,
@@ -48,11 +154,6 @@ static inline void parseSenderFile(
         unsigned long long &forwarderEndTime,
         unordered_map<unsigned long, NodeStat> &nodes,
         unordered_map<unsigned long, ControlStat> &controls) {
-    ifstream input(argv[1]);
-    if (input.fail()) {
-        printf("Failed to open file \"%s\"\n", argv[1]);
-        exit(EXIT_FAILURE);
-    }
     FILE *output;
     output = fopen(argv[2], "w");
     if (!output) {
@@ -64,78 +165,33 @@ static inline void parseSenderFile(
     string line;
     size_t lineCount = 0;
 
-    while (getline(input, line)) {
-        lineCount++;
-        vector<string> parts;
-        splitLine(line, parts);
-        if (parts.size() < 3) {
-            fprintf(stderr, "%s:%zd doesn't have at least 3 parts, skip!\n", argv[1], lineCount);
-            continue;
+    const result_file_header_t *header;
+    result_file_map_t map;
+    result_sender_record_t record;
+
+    header = result_file_open(argv[1], RESULT_RECORD_SENDER_PACKET, sizeof(result_sender_record_t), &map);
+    if (header) { // binary, read in place
+        auto records = (const result_sender_record_t *)(header + 1);
+        for (lineCount = 1; lineCount <= header->record_count; lineCount++)
+            handleSenderRecord(records[lineCount - 1], lineCount, senderStartTime, senderEndTime,
+                               forwarderStartTime, forwarderEndTime, nodes, controls);
+        result_file_close(&map);
+    } else if (errno) {
+        printf("Failed to read result file \"%s\": %s\n", argv[1], strerror(errno));
+        exit(EXIT_FAILURE);
+    } else { // text
+        ifstream input(argv[1]);
+        if (input.fail()) {
+            printf("Failed to open file \"%s\"\n", argv[1]);
+            exit(EXIT_FAILURE);
         }
-        auto nodeId = stoul(parts[1]);
-        auto sentTime = stoull(parts[2]);
-        auto &node = nodes[nodeId];
-
-        senderStartTime = min(sentTime, senderStartTime);
-        senderEndTime = max(sentTime, senderEndTime);
-
-        if (parts[0] == "1") { // control
-            node.expectedControl = sentTime;
-            controls[lineCount - 1].nodeId = nodeId;
-#ifdef MONITOR_NODE_ID
-            if (nodeId == MONITOR_NODE_ID)
-                printf("%zd: C %llu\n", lineCount, sentTime);
-#endif
-        } else if (parts[0] == "0") { // data
-            if (parts.size() < 9) {
-                fprintf(stderr, "%s:%zd [data] doesn't have 9 parts [0] [node_id] [t3] [t8] [t1] [t2] [t4] [t5] [t7], skip!\n", argv[1], lineCount);
-                continue;
-            }
-            auto t8 = stoull(parts[3]);
-            auto t1 = stoull(parts[4]);
-            auto t2 = stoull(parts[5]);
-            auto t4 = stoull(parts[6]);
-            auto t7 = stoull(parts[8]);
-
-
-            if (t8 == 0) { // dropped
-                node.dropped++;
-#ifdef MONITOR_NODE_ID
-                if (nodeId == MONITOR_NODE_ID)
-                    printf("%zd: D Dropped\n", nodeId);
-#endif
-            } else {
-                senderEndTime = max(t8, senderEndTime);
-                if (t2 != 0) forwarderStartTime = min(t2, forwarderStartTime);
-                forwarderStartTime = min(t4, forwarderStartTime);
-                forwarderStartTime = min(t7, forwarderStartTime);
-                forwarderEndTime = max(t2, forwarderEndTime);
-                forwarderEndTime = max(t4, forwarderEndTime);
-                forwarderEndTime = max(t7, forwarderEndTime);
-
-                if (t1 < node.expectedControl) { // mis-destinated
-#ifdef MONITOR_NODE_ID
-                    if (nodeId == MONITOR_NODE_ID)
-                        printf("%zd: D expect %llu now %llu\n", lineCount, node.expectedControl, t1);
-#endif
-                    node.misDestinated++;
-                } else {
-                    node.correctReceived++;
-                    node.lastT8 = max(t8, node.lastT8);
-                    if (node.firstT3 == 0) { // first packet
-                        node.firstT3 = node.oldT3 = sentTime;
-                        node.firstT8 = t8;
-                    } else {
-                        auto v1 = t8 - node.oldT3;
-                        auto v2 = t8 - sentTime;
-                        node.totalAge += (v1 * v1 - v2 * v2) / 2;
-                        node.oldT3 = sentTime;
-                    }
-                }
-            }
-        } else {
-            fprintf(stderr, "%s:%zd doesn't start with 0 (data) or 1 (control), skip!\n", argv[1], lineCount);
+        while (getline(input, line)) {
+            lineCount++;
+            if (parseSenderLine(line, argv[1], lineCount, record))
+                handleSenderRecord(record, lineCount, senderStartTime, senderEndTime,
+                                   forwarderStartTime, forwarderEndTime, nodes, controls);
         }
+        input.close();
     }
     printf("senderStartTime %llu\n"
            "senderEndTime %llu\n"
@@ -195,10 +251,85 @@ static inline void parseSenderFile(
     }
     fflush(output);
     fclose(output);
-    input.close();
 }
 
 
+class MemState {
+public:
+    // sequence numbers
+    vector<unsigned long> pendingFrees;
+    // sequence number
+    unsigned long pendingAdd = 0;
+    unsigned long entryCount = 0, maxEntryCount = 0;
+    unsigned long long time = 0, totalCount = 0;
+};
+
+// replays 1 memory event, lineCount is its 1-based position in the file
+static inline void handleMemEvent(
+        char type,
+        unsigned long long value,
+        const char *filename,
+        size_t lineCount,
+        unsigned long long forwarderStartTime,
+        MemState &state,
+        unordered_map<unsigned long, ControlStat> &controls,
+        FILE *outputMem) {
+    if (type == 'A') { // allocate
+        if (state.pendingAdd != 0) {
+            fprintf(stderr, "%s:%zd multiple allocations for a control packet!\n", filename, lineCount);
+            exit(EXIT_FAILURE);
+        }
+        state.pendingAdd = value;
+    } else if (type == 'F') { // free
+        state.pendingFrees.push_back(value);
+    } else if (type == 'T') { // timestamp
+        if (state.pendingAdd == 0) {
+            fprintf(stderr, "%s:%zd no allocation for a control packet!\n", filename, lineCount);
+            exit(EXIT_FAILURE);
+        }
+        auto newTime = value;
+        {
+            auto it = controls.find(state.pendingAdd);
+            if (it == controls.end()) {
+                fprintf(stderr, "%s:%zd cannot find control with sequence %lu\n", filename, lineCount, state.pendingAdd);
+                exit(EXIT_FAILURE);
+            }
+            if (it->second.allocateTime != 0) {
+                fprintf(stderr, "%s:%zd duplicate allocating control with sequence %lu\n", filename, lineCount, state.pendingAdd);
+                exit(EXIT_FAILURE);
+            } else {
+                it->second.allocateTime = newTime;
+            }
+        }
+        for (auto pendingFree: state.pendingFrees) {
+            if (pendingFree == 0) continue;
+            auto it = controls.find(pendingFree);
+            if (it == controls.end()) {
+                fprintf(stderr, "%s:%zd cannot find control with sequence %lu\n", filename, lineCount, pendingFree);
+                exit(EXIT_FAILURE);
+            }
+            if (it->second.allocateTime == 0) {
+                fprintf(stderr, "%s:%zd freeing control before allocating with sequence %lu\n", filename, lineCount, pendingFree);
+                exit(EXIT_FAILURE);
+            } else if (it->second.freeTime != 0) {
+                fprintf(stderr, "%s:%zd duplicate freeing control with sequence %lu\n", filename, lineCount, pendingFree);
+                exit(EXIT_FAILURE);
+            } else {
+                it->second.freeTime = newTime;
+            }
+        }
+        state.totalCount += state.entryCount * (newTime - state.time);
+
+        state.time = newTime;
+        state.entryCount += 1 - state.pendingFrees.size(); // 1 allocate, n frees
+        fprintf(outputMem, "%llu %lu\n", state.time - forwarderStartTime, state.entryCount);
+        state.maxEntryCount = max(state.entryCount, state.maxEntryCount);
+
+        state.pendingAdd = 0;
+        state.pendingFrees.clear();
+    }
+}
+
 static inline void parseMemory(
         char **argv,
         unsigned long long forwarderStartTime,
@@ -211,9 +342,12 @@ static inline void parseMemory(
            "nodes %zd\n",
            controls.size(), nodes.size());
 
-    ifstream inputMem(argv[3]);
-    if (inputMem.fail()) {
-        fprintf(stderr, "Failed to open file \"%s\"\n", argv[3]);
+    const result_file_header_t *header;
+    result_file_map_t map;
+
+    header = result_file_open(argv[3], RESULT_RECORD_MEM_EVENT, sizeof(result_mem_event_record_t), &map);
+    if (!header && errno) {
+        fprintf(stderr, "Failed to read result file \"%s\": %s\n", argv[3], strerror(errno));
         exit(EXIT_FAILURE);
     }
 
@@ -225,80 +359,40 @@ static inline void parseMemory(
     }
 
     size_t lineCount = 0;
-    string line;
-    // sequence numbers
-    vector<unsigned long> pendingFrees;
-    // sequence number
-    unsigned long pendingAdd = 0;
-    unsigned long entryCount = nodes.size();
-    unsigned long long time = forwarderStartTime;
-    unsigned long long totalCount = 0;
-    unsigned long maxEntryCount = entryCount;
+    MemState state;
+    state.maxEntryCount = state.entryCount = nodes.size();
+    state.time = forwarderStartTime;
     fprintf(outputMem, "timeR FIBEntries\n"
-                       "%llu %lu\n", time - forwarderStartTime, entryCount);
-    while (getline(inputMem, line)) {
-        lineCount++;
-        vector<string> parts;
-        splitLine(line, parts);
-        if (parts.size() < 2) {
-            fprintf(stderr, "%s:%zd doesn't have at least 2 parts, skip!\n", argv[3], lineCount);
-            continue;
+                       "%llu %lu\n", state.time - forwarderStartTime, state.entryCount);
+    if (header) { // binary, read in place
+        auto records = (const result_mem_event_record_t *)(header + 1);
+        for (lineCount = 1; lineCount <= header->record_count; lineCount++)
+            handleMemEvent(records[lineCount - 1].type, records[lineCount - 1].value, argv[3], lineCount,
+                           forwarderStartTime, state, controls, outputMem);
+        result_file_close(&map);
+    } else { // text
+        ifstream inputMem(argv[3]);
+        if (inputMem.fail()) {
+            fprintf(stderr, "Failed to open file \"%s\"\n", argv[3]);
+            exit(EXIT_FAILURE);
         }
-        if (parts[0] == "A") { // allocate
-            if (pendingAdd != 0) {
-                fprintf(stderr, "%s:%zd multiple allocations for a control packet!\n", argv[3], lineCount);
-                exit(EXIT_FAILURE);
-            }
-            pendingAdd = stoul(parts[1]);
-        } else if (parts[0] == "F") { // free
-            pendingFrees.push_back(stoul(parts[1]));
-        } else if (parts[0] == "T") { // timestamp
-            if (pendingAdd == 0) {
-                fprintf(stderr, "%s:%zd no allocation for a control packet!\n", argv[3], lineCount);
-                exit(EXIT_FAILURE);
-            }
-            auto newTime = stoull(parts[1]);
-            {
-                auto it = controls.find(pendingAdd);
-                if (it == controls.end()) {
-                    fprintf(stderr, "%s:%zd cannot find control with sequence %lu\n", argv[3], lineCount, pendingAdd);
-                    exit(EXIT_FAILURE);
-                }
-                if (it->second.allocateTime != 0) {
-                    fprintf(stderr, "%s:%zd duplicate allocating control with sequence %lu\n", argv[3], lineCount, pendingAdd);
-                    exit(EXIT_FAILURE);
-                } else {
-                    it->second.allocateTime = newTime;
-                }
-            }
-            for (auto pendingFree: pendingFrees) {
-                if (pendingFree == 0) continue;
-                auto it = controls.find(pendingFree);
-                if (it == controls.end()) {
-                    fprintf(stderr, "%s:%zd cannot find control with sequence %lu\n", argv[3], lineCount, pendingFree);
-                    exit(EXIT_FAILURE);
-                }
-                if (it->second.allocateTime == 0) {
-                    fprintf(stderr, "%s:%zd freeing control before allocating with sequence %lu\n", argv[3], lineCount, pendingFree);
-                    exit(EXIT_FAILURE);
-                } else if (it->second.freeTime != 0) {
-                    fprintf(stderr, "%s:%zd duplicate freeing control with sequence %lu\n", argv[3], lineCount, pendingFree);
-                    exit(EXIT_FAILURE);
-                } else {
-                    it->second.freeTime = newTime;
-                }
+        string line;
+        while (getline(inputMem, line)) {
+            lineCount++;
+            vector<string> parts;
+            splitLine(line, parts);
+            if (parts.size() < 2) {
+                fprintf(stderr, "%s:%zd doesn't have at least 2 parts, skip!\n", argv[3], lineCount);
+                continue;
             }
-            totalCount += entryCount * (newTime - time);
-
-            time = newTime;
-            entryCount += 1 - pendingFrees.size(); // 1 allocate, n frees
-            fprintf(outputMem, "%llu %lu\n", time - forwarderStartTime, entryCount);
-            maxEntryCount = max(entryCount, maxEntryCount);
-
-            pendingAdd = 0;
-            pendingFrees.clear();
+            if (parts[0].size() != 1) continue;
+            handleMemEvent(parts[0][0], stoull(parts[1]), argv[3], lineCount, forwarderStartTime, state, controls, outputMem);
         }
     }
+    auto &entryCount = state.entryCount;
+    auto &maxEntryCount = state.maxEntryCount;
+    auto &totalCount = state.totalCount;
+    auto &time = state.time;
     fprintf(outputMem, "%llu %lu\n", forwarderEndTime, entryCount);
     fflush(outputMem);
     fclose(outputMem);
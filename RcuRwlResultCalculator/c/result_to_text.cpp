@@ -0,0 +1,94 @@
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../../result_file.h"
+
+using namespace std;
+
+/*
+ * Converts a binary result file (see result_file.h) of the sender or the forwarder
+ * into the text format they used to write, one line per record.
+ */
+
+static inline void writeSenderRecord(FILE *output, const result_sender_record_t &record) {
+    if (record.is_control) {
+        fprintf(output, "1 %" PRIu16 " %" PRIu64 "\n", record.dst_id, record.time_send);
+        return;
+    }
+    fprintf(output, "0 %" PRIu16 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+            record.dst_id,
+            record.time_send, record.time_receive,
+            record.time_control, record.time_control_arrive_f,
+            record.time_arrive_f, record.time_after_lookup_f,
+            record.time_exit_f);
+}
+
+static inline void writeForwarderControlRecord(FILE *output, const result_forwarder_control_record_t &record) {
+    fprintf(output, "%" PRIu32 " %" PRIu16 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+            record.seq,
+            record.node_id,
+            record.control_time,
+            record.control_arrive_time_f,
+            record.publish_time_f);
+}
+
+static inline void writeMemEventRecord(FILE *output, const result_mem_event_record_t &record) {
+    fprintf(output, "%c %" PRIu64 "\n", record.type, record.value);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s %s %s\n", argv[0], "%binary_result_file%", "%text_output_file%");
+        exit(EXIT_FAILURE);
+    }
+
+    const result_file_header_t *header;
+    result_file_map_t map;
+
+    header = result_file_open(argv[1], 0, 0, &map);
+    if (!header) {
+        fprintf(stderr, "Failed to read result file \"%s\": %s\n", argv[1],
+                errno ? strerror(errno) : "not a binary result file");
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *output;
+    output = fopen(argv[2], "w");
+    if (!output) {
+        fprintf(stderr, "Failed to open file \"%s\"\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    const void *records = header + 1;
+    uint64_t recordCount = header->record_count;
+    for (uint64_t i = 0; i < recordCount; i++) {
+        switch (header->record_type) {
+            case RESULT_RECORD_SENDER_PACKET:
+                if (header->record_size != sizeof(result_sender_record_t)) goto bad_size;
+                writeSenderRecord(output, ((const result_sender_record_t *)records)[i]);
+                break;
+            case RESULT_RECORD_FORWARDER_CONTROL:
+                if (header->record_size != sizeof(result_forwarder_control_record_t)) goto bad_size;
+                writeForwarderControlRecord(output, ((const result_forwarder_control_record_t *)records)[i]);
+                break;
+            case RESULT_RECORD_MEM_EVENT:
+                if (header->record_size != sizeof(result_mem_event_record_t)) goto bad_size;
+                writeMemEventRecord(output, ((const result_mem_event_record_t *)records)[i]);
+                break;
+            default:
+                fprintf(stderr, "%s: unknown record type %" PRIu32 "\n", argv[1], header->record_type);
+                exit(EXIT_FAILURE);
+        }
+    }
+    fflush(output);
+    fclose(output);
+    result_file_close(&map);
+    printf("%s: %" PRIu64 " records converted\n", argv[2], recordCount);
+    return EXIT_SUCCESS;
+
+bad_size:
+    fprintf(stderr, "%s: unexpected record size %" PRIu32 "\n", argv[1], header->record_size);
+    exit(EXIT_FAILURE);
+}
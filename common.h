@@ -28,7 +28,8 @@ static const struct rte_eth_conf port_conf_default = {
 
 
 static inline int
-port_init(uint16_t port, struct rte_mempool *mbuf_pool, int data_tx_ring_size, int data_rx_ring_size, struct rte_ether_addr* my_data_mac);
+port_init(uint16_t port, struct rte_mempool *mbuf_pool, int data_tx_ring_size, int data_rx_ring_size,
+          uint16_t nb_rx_queues, uint16_t nb_tx_queues, struct rte_ether_addr* my_data_mac, bool rx_interrupts);
 
 
 typedef struct {
@@ -56,12 +57,16 @@ typedef struct {
 /*
  * Initializes a given port using global settings and with the RX buffers
  * coming from the mbuf_pool passed as a parameter.
+ * At least 2 RX and 2 TX queues are created, with nb_rx_queues > 1 RSS is
+ * enabled to spread the incoming packets over the RX queues.
+ * With rx_interrupts, the RX queues can wake up their poller (rte_eth_dev_rx_intr_enable).
  */
 static inline int
-port_init(uint16_t port, struct rte_mempool *mbuf_pool, int data_tx_ring_size, int data_rx_ring_size, struct rte_ether_addr* my_data_mac)
+port_init(uint16_t port, struct rte_mempool *mbuf_pool, int data_tx_ring_size, int data_rx_ring_size,
+          uint16_t nb_rx_queues, uint16_t nb_tx_queues, struct rte_ether_addr* my_data_mac, bool rx_interrupts)
 {
         struct rte_eth_conf port_conf = port_conf_default;
-        const uint16_t rx_rings = 2, tx_rings = 2; //number of rx_rings and tx_rings changed from 1 to 2. 
+        const uint16_t rx_rings = RTE_MAX(nb_rx_queues, 2), tx_rings = RTE_MAX(nb_tx_queues, 2); //at least 2 rx_rings and tx_rings, as before
         uint16_t nb_rxd = data_rx_ring_size;
         uint16_t nb_txd = data_tx_ring_size;
         int retval;
@@ -79,10 +84,28 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool, int data_tx_ring_size, i
                 return retval;
         }
 
+        port_conf.intr_conf.rxq = rx_interrupts;
+
         if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
                 port_conf.txmode.offloads |=
                         DEV_TX_OFFLOAD_MBUF_FAST_FREE;
 
+        if (rx_rings > dev_info.max_rx_queues || tx_rings > dev_info.max_tx_queues) {
+                printf("Port %u supports at most %u rx and %u tx queues, %u requested\n",
+                                port, dev_info.max_rx_queues, dev_info.max_tx_queues, RTE_MAX(rx_rings, tx_rings));
+                return -EINVAL;
+        }
+
+        /* Only spread over the queues if somebody polls them, otherwise everything stays on queue 0 */
+        if (nb_rx_queues > 1) {
+                port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+                port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+                port_conf.rx_adv_conf.rss_conf.rss_hf =
+                        (ETH_RSS_IP | ETH_RSS_L2_PAYLOAD) & dev_info.flow_type_rss_offloads;
+                if (!port_conf.rx_adv_conf.rss_conf.rss_hf)
+                        printf("Port %u cannot do RSS on our packets, all of them will arrive on queue 0\n", port);
+        }
+
         /* Configure the Ethernet device. */
         retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
         if (retval != 0)
@@ -92,7 +115,7 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool, int data_tx_ring_size, i
         if (retval != 0)
                 return retval;
 
-        /* Allocate and set up 1 RX queue per Ethernet port. */
+        /* Allocate and set up rx_rings RX queues per Ethernet port. */
         for (q = 0; q < rx_rings; q++) {
                 retval = rte_eth_rx_queue_setup(port, q, nb_rxd,
                                 rte_eth_dev_socket_id(port), NULL, mbuf_pool);
@@ -102,7 +125,7 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool, int data_tx_ring_size, i
 
         txconf = dev_info.default_txconf;
         txconf.offloads = port_conf.txmode.offloads;
-        /* Allocate and set up 1 TX queue per Ethernet port. */
+        /* Allocate and set up tx_rings TX queues per Ethernet port. */
         for (q = 0; q < tx_rings; q++) {
                 retval = rte_eth_tx_queue_setup(port, q, nb_txd,
                                 rte_eth_dev_socket_id(port), &txconf);
@@ -1,40 +1,146 @@
 #ifndef __FORWARDER_COMMON_H
 #define __FORWARDER_COMMON_H
 
-#define TEST_RCU
-//#define TEST_RCU_CONSTRAINED
-//#define TEST_RCU_PER_PACKET_QUIESCENT
-//#define WRITE_TIME_AFTER_LOOKUP_F
-#define RESULT_PACKETS_FILENAME "result_forwarder_packets.txt" // comment if do not wish to write results
+#define RESULT_PACKETS_FILENAME "result_forwarder_packets.bin" // comment if do not wish to write results, see ../result_file.h
+#define RESULT_RCU_U_FILENAME "result_forwarder_rcu_u.bin" // memory events, only written in the RCU modes
 
 #define RX_POOL_SIZE 16383
 #define DATA_RECEIVE_RING_SIZE ((data_receive_burst_size) * 4)
-#define CONTROL_RECEIVE_RING_SIZE ((data_receive_burst_size) * 4)
+#define CONTROL_RECEIVE_RING_SIZE (control_ring_size)
+#define CONTROL_BACKLOG_SIZE 1024 // CONTROL_ADMISSION_PRIORITY: control packets each receiver holds while control_receive_ring is full
 #define DATA_SEND_RING_SIZE ((data_send_burst_size) * 16)
 #define REPORT_WAIT_MS 500
 #define TX_BURST_PERIOD_US 1
-
-
-//#if defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED) // only calculate for rcu_u
-#ifdef TEST_RCU // only calculate for rcu_u
-#define RESULT_RCU_U_FILENAME "result_forwarder_rcu_u.txt"
-#endif // defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED)
+#define TX_FLUSH_EWMA_WEIGHT 8 // adaptive tx flush: the inter-arrival time estimate moves by 1/8 of every new sample
+#define MAX_DATA_QUEUES 16
+#define FIB_ARRAY_SIZE (UINT16_MAX + 1) // 1 slot per node ID
+#define FIB_DQ_RECLAIM_THRSH 32 // same as the defaults used by rte_hash for its defer queue
+#define FIB_DQ_RECLAIM_MAX 16
+#define FIB_RECLAIM_PENDING_BATCHES 64 // batched updates in RCU unconstrained mode: # of batches waiting for a grace period
+#define FIB_RECLAIM_IDLE_SLEEP_US 10 // reclaimer lcore: sleep when nothing can be freed, so it does not compete for the core
+#define FORWARD_PREFETCH_OFFSET 4 // forward loop: mbufs, packet headers and fib entries are prefetched this many packets ahead
+#define BENCH_FORWARD_PKTS 8192 // --bench_forward: synthetic packets cycled through, ~18MB of mbufs so they do not stay in cache
+#define LATENCY_HIST_SUB_BITS 4 // latency histograms: 16 linear sub-buckets per power of 2, values are within 1/16
+#define LATENCY_HIST_MAX_BITS 40 // latency histograms: larger values (in cycles) are counted in the last bucket
+#define LATENCY_HIST_BUCKETS ((LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS + 1) << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_REPORT_MS 5000
+#define FIB_LOAD_CHUNK_MIN (1 << 20) // startup fib load: bytes of the forward list parsed per lcore, at least
+#define RESULT_STREAM_RING_SIZE 65536 // --result_stream: records waiting for the writer lcore, per result file
+#define RESULT_STREAM_CHUNK_SIZE (1 << 20) // --result_stream: bytes of records written to disk at once
+#define RESULT_STREAM_IDLE_SLEEP_US 100 // --result_stream: writer lcore sleep when the rings are empty
+#define IDLE_SPIN_POLLS 256 // --idle_policy: empty polls of a worker before it backs off, a short gap costs nothing
+#define IDLE_PAUSE_POLLS 1024 // --idle_policy: empty polls with rte_pause before sleeping (monitor, interrupt)
+#define IDLE_PAUSE_MAX 64 // --idle_policy: rte_pause per empty poll at most, 1 more every empty poll up to it
 
 #include "../common.h"
+#include "../result_file.h"
+#include <rte_cpuflags.h>
 #include <rte_ether.h>
 #include <rte_hash.h>
 #include <rte_hash_crc.h>
 #include <rte_malloc.h>
+#include <rte_pause.h>
+#include <rte_prefetch.h>
+#include <rte_rcu_qsbr.h>
+#include <rte_ring.h>
 #include <rte_rwlock.h>
+#include <rte_version.h>
+
+/*
+ * --idle_policy monitor/interrupt: rte_power_monitor with a val/mask condition, rte_power_pause,
+ * rte_eth_get_monitor_addr and rte_cpu_get_intrinsics_support are in DPDK 21.02 to 21.08 (21.11 replaced
+ * the condition with a callback). With other versions the idle workers only back off with rte_pause,
+ * or wait for the RX interrupt of their queue.
+ */
+#if RTE_VERSION >= RTE_VERSION_NUM(21, 2, 0, 0) && RTE_VERSION < RTE_VERSION_NUM(21, 11, 0, 0)
+#define IDLE_POWER_MONITOR
+#include <rte_power_intrinsics.h>
+#endif
+
+
+typedef enum {
+    FORWARD_MODE_PIPELINE,          // receive -> ring -> forward -> ring -> send, on separate lcores
+    FORWARD_MODE_RUN_TO_COMPLETION, // receive, forward and send on the same lcore
+} forward_mode_t;
+
+typedef enum {
+    TX_FLUSH_FIXED,    // send a partial burst after TX_BURST_PERIOD_US without a full one
+    TX_FLUSH_ADAPTIVE, // send a partial burst when the oldest packet cannot wait for a full one within the latency budget
+} tx_flush_t;
+
+typedef enum {
+    FIB_BACKEND_HASH,  // rte_hash (cuckoo hash) keyed by node ID
+    FIB_BACKEND_ARRAY, // flat array of entry pointers, directly indexed by node ID
+} fib_backend_t;
+
+typedef enum {
+    CONTROL_UPDATE_SINGLE, // update (and wait for / defer the reclamation of) the fib entry of each control packet
+    CONTROL_UPDATE_BATCH,  // update all control packets of a dequeued burst, 1 grace period per burst
+} control_update_t;
 
+typedef enum {
+    FIB_RECLAIM_INLINE, // old entries are freed by the control thread while updating (rte_hash / defer queue triggers)
+    FIB_RECLAIM_IDLE,   // old entries are freed by the control thread only when there is no control packet
+    FIB_RECLAIM_THREAD, // old entries are freed by a dedicated reclaimer lcore
+} fib_reclaim_t;
 
+typedef enum {
+    SYNC_MODE_RWL,             // entries are updated in place under rw_lock
+    SYNC_MODE_RCU,             // RCU unconstrained, old entries are freed in the background after a grace period
+    SYNC_MODE_RCU_CONSTRAINED, // RCU constrained, the control thread waits for a grace period to free the old entry
+    SYNC_MODE_SEQLOCK,         // entries are updated in place under a per-entry sequence counter
+    SYNC_MODE_MAX,
+} sync_mode_t;
+
+typedef enum {
+    QUIESCENT_PER_BURST,  // RCU readers report a quiescent state once per dequeued burst
+    QUIESCENT_PER_PACKET, // RCU readers report a quiescent state after every packet
+    QUIESCENT_MAX,
+} quiescent_mode_t;
+
+typedef enum {
+    LOOKUP_BULK,   // look up the fib once per burst (handle_data_burst)
+    LOOKUP_SINGLE, // look up the fib once per packet (handle_data_packet)
+    LOOKUP_MAX,
+} lookup_mode_t;
+
+typedef enum {
+    CONTROL_ADMISSION_DROP,     // control packets that do not fit in control_receive_ring are dropped
+    CONTROL_ADMISSION_PRIORITY, // the receivers hold them back and retry them before any newer one
+    CONTROL_ADMISSION_COALESCE, // 1 pending control packet per node, a newer one replaces it (latest update wins)
+} control_admission_t;
+
+typedef enum {
+    IDLE_POLICY_SPIN,      // busy poll on empty bursts
+    IDLE_POLICY_PAUSE,     // rte_pause backoff on empty bursts
+    IDLE_POLICY_MONITOR,   // backoff, then rte_power_monitor on the next RX descriptor or the ring tail
+    IDLE_POLICY_INTERRUPT, // backoff, then wait for the RX queue interrupt, the ring consumers monitor
+} idle_policy_t;
+
+// --lcores_rx, --lcores_fwd, --lcores_tx, --lcore_ctrl: lcores given to a role, the one of data queue q is ids[q],
+// the role is placed automatically if count is 0
+typedef struct {
+    unsigned count;
+    unsigned ids[MAX_DATA_QUEUES];
+} lcore_list_t;
+
+/*
+ * The layout is used by rewrite_data_header: the first 16 bytes hold receiver_mac (loaded with
+ * the same 16-byte load as the rest of the header), control_time and control_arrive_time_f are
+ * adjacent, like time_control and time_control_arrive_f of data_pkt_t.
+ */
 typedef struct {
+    struct rte_ether_addr receiver_mac;
+    uint16_t reserved;
+    uint32_t sc; // sequence counter of SYNC_MODE_SEQLOCK, odd while the control thread is writing the entry
     uint32_t seq;
     uint64_t control_time;
     uint64_t control_arrive_time_f;
-    struct rte_ether_addr receiver_mac;
 } fib_entry_t;
 
+// 16 bytes moved by a single vector load/store (SSE on x86, NEON on arm)
+typedef uint8_t vec16_t __attribute__((vector_size(16)));
+
 
 typedef struct {
     uint16_t node_id;
@@ -44,8 +150,91 @@ typedef struct {
     uint64_t publish_time_f;
 } control_packet_stat_t;
 
-//#if defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED) // only calculate for rcu_u
-#ifdef TEST_RCU
+/*
+ * Counters of the forwarder. Every lcore has its own block (main.c), the status reporter sums them up.
+ * All fields are uint64_t, so the blocks can be summed as arrays.
+ */
+typedef struct {
+    uint64_t received_data_count, rx_dropped_data_count, tx_dropped_data_count, tx_out_dropped_data_count,
+            other_packet_count, lookup_failed_count, rx_dropped_control_count, received_control_count;
+    // TX_FLUSH_ADAPTIVE: bursts sent full, early (could not fill within the budget) and after the budget
+    uint64_t tx_flush_full_count, tx_flush_early_count, tx_flush_timeout_count, tx_flushed_packet_count;
+    // control packets held back while control_receive_ring was full, replaced by a newer one of their node
+    uint64_t control_held_count, control_coalesced_count;
+    // --idle_policy: sleeps of the lcore and the cycles spent in them
+    uint64_t idle_sleep_count, idle_sleep_cycles;
+} forwarder_counters_t;
+
+#define STATS_EXPORT_MAGIC 0x54535746 // "FWST" in little endian
+#define STATS_EXPORT_VERSION 3
+
+/*
+ * Layout of --stats_file, rewritten by the status reporter every REPORT_WAIT_MS.
+ * seq is odd while a snapshot is being written: readers copy the file and retry if seq was odd or changed.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    uint32_t nb_queues;
+    uint64_t hz; // of the cycle counts below
+    uint64_t time_cycles; // since the start of the forwarder
+    uint64_t interval_cycles; // covered by rate
+    forwarder_counters_t total;
+    forwarder_counters_t rate; // per second over the last interval
+    forwarder_counters_t queues[MAX_DATA_QUEUES]; // totals per data queue, the control thread is only in total
+} stats_export_t;
+
+// stages timed by the latency histograms (--latency_hist), from the TSC stamps of the packets
+typedef enum {
+    LATENCY_STAGE_RX_FORWARD, // rx timestamp -> forward lcore dequeue
+    LATENCY_STAGE_LOOKUP, // 1 fib lookup, of a burst with LOOKUP_BULK
+    LATENCY_STAGE_FORWARD_TX, // end of forward -> tx burst (send ring and flush)
+    LATENCY_STAGE_RX_EXIT, // rx timestamp -> time_exit_f
+    LATENCY_STAGE_CONTROL_PUBLISH, // control_arrive_time_f -> publish_time_f
+    LATENCY_STAGE_IDLE_WAKEUP, // rx timestamp -> ring dequeue, of the 1st packet after an idle sleep (--idle_policy)
+    LATENCY_STAGE_MAX,
+} latency_stage_t;
+
+// log-linear histogram of cycles, only written by 1 lcore
+typedef struct {
+    uint64_t count[LATENCY_HIST_BUCKETS];
+} latency_hist_t;
+
+// element of fib_dq
+typedef struct {
+    fib_entry_t *entry;
+    uint64_t defer_time; // when the entry was replaced
+} fib_dq_entry_t;
+
+// counters of fib_dq, every field has a single writer (the one deferring or the one reclaiming)
+typedef struct {
+    volatile uint64_t deferred_count, stall_count; // stall: fib_dq full, the control thread had to wait for a free
+    volatile uint64_t freed_count, total_reclaim_cycles, max_reclaim_cycles; // from being replaced to being freed
+} fib_reclaim_stats_t;
+
+/*
+ * A fib and the pool of its entries. --fib_reload builds a new one from the forward list and publishes it
+ * by swapping fib (or fib_array), see reload_fib in main.c.
+ */
+typedef struct {
+    struct rte_hash *hash;      // FIB_BACKEND_HASH
+    fib_entry_t **array;        // FIB_BACKEND_ARRAY
+    struct rte_mempool *entry_pool;
+    size_t size;                // # of node IDs
+} fib_table_t;
+
+/*
+ * Hash key of a node, fib_key_len bytes: the big endian 16-bit ID as in the packets by default,
+ * otherwise the ID in host order, so the forward list may hold wider node IDs than the packets can address.
+ */
+typedef union {
+    uint16_t be16;
+    uint32_t u32;
+    uint64_t u64;
+} fib_key_t;
+
+// only recorded in the RCU modes
 typedef struct {
     char type;
     uint64_t value;
@@ -55,35 +244,71 @@ typedef struct {
 #define MEM_EVENT_TYPE_FREE 'F'
 #define MEM_EVENT_TYPE_CONTROL_TIMESTAMP 'T'
 
-#endif // defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED)
-
 
 extern struct rte_ether_addr receiver_data_mac;
 extern struct rte_mempool *fib_entry_pool;
 extern struct rte_hash *fib;
-#ifdef TEST_RCU
+extern fib_backend_t fib_backend;
+extern fib_entry_t **fib_array;
+extern int fib_key_len;
+extern int data_socket_id; // NUMA socket of the data port, the pools, rings and fib read by the data plane are there
+extern control_update_t control_update;
+extern sync_mode_t sync_mode;
+extern fib_reclaim_t fib_reclaim;
+extern int control_receive_burst_size;
 extern struct rte_rcu_qsbr *qs_variable;
-//#ifndef TEST_RCU_CONSTRAINED
+extern struct rte_rcu_qsbr_dq *fib_dq;
+extern uint32_t fib_dq_size;
+extern fib_reclaim_stats_t fib_reclaim_stats;
 extern mem_event_t *mem_events;
 extern size_t mem_event_pos, mem_event_capacity;
-//#endif // TEST_RCU_CONSTRAINED
-#else // TEST_RCU
+extern struct rte_ring *mem_event_ring;
+extern volatile uint64_t result_stream_stall_count;
 extern rte_rwlock_t rw_lock;
-#endif // TEST_RCU
+
+/*
+ * State of the control thread for CONTROL_UPDATE_BATCH.
+ */
+typedef struct {
+    uint64_t token;       // rte_rcu_qsbr_start() of the batch
+    uint16_t nb_entries;
+    fib_entry_t **entries; // old entries replaced by the batch, control_receive_burst_size slots
+} fib_reclaim_batch_t;
+
+typedef struct {
+    uint32_t generation;   // incremented per batch
+    uint32_t *last_seen;   // per node ID, generation of the last batch that updated it
+    uint16_t *latest;      // per node ID, index of the latest update in the current batch
+    // SYNC_MODE_RCU only
+    fib_reclaim_batch_t pending[FIB_RECLAIM_PENDING_BATCHES]; // FIFO of batches waiting for a grace period
+    unsigned pending_head, pending_count;
+} fib_batch_ctx_t;
+
+static inline bool
+sync_mode_is_rcu(sync_mode_t mode) {
+    return mode == SYNC_MODE_RCU || mode == SYNC_MODE_RCU_CONSTRAINED;
+}
 
 static inline size_t fib_entry_pool_size(size_t fib_size) {
-#ifdef TEST_RCU
-    #ifdef TEST_RCU_CONSTRAINED
-    printf("RCU constrained mode, fib_size=%zd, fib_entry_pool_size=%zd\n", fib_size, fib_size + 1);
-    return fib_size + 1;
-#else // TEST_RCU_CONSTRAINED
-    printf("RCU unconstrained mode, fib_size=%zd, fib_entry_pool_size=%zd\n", fib_size, fib_size * 4);
-    return fib_size * 4;
-#endif // TEST_RCU_CONSTRAINED
-#else // TEST_RCU
-    printf("RWL mode, fib_size=%zd, fib_entry_pool_size=%zd\n", fib_size, fib_size);
-    return fib_size;
-#endif // TEST_RCU
+    switch (sync_mode) {
+        case SYNC_MODE_RCU_CONSTRAINED:
+            if (control_update == CONTROL_UPDATE_BATCH) { // a whole batch is allocated before the grace period
+                printf("RCU constrained mode, batched, fib_size=%zd, fib_entry_pool_size=%zd\n",
+                       fib_size, fib_size + control_receive_burst_size);
+                return fib_size + control_receive_burst_size;
+            }
+            printf("RCU constrained mode, fib_size=%zd, fib_entry_pool_size=%zd\n", fib_size, fib_size + 1);
+            return fib_size + 1;
+        case SYNC_MODE_RCU:
+            printf("RCU unconstrained mode, fib_size=%zd, fib_entry_pool_size=%zd\n", fib_size, fib_size * 4);
+            return fib_size * 4;
+        case SYNC_MODE_SEQLOCK:
+            printf("SEQLOCK mode, fib_size=%zd, fib_entry_pool_size=%zd\n", fib_size, fib_size);
+            return fib_size;
+        default:
+            printf("RWL mode, fib_size=%zd, fib_entry_pool_size=%zd\n", fib_size, fib_size);
+            return fib_size;
+    }
 }
 
 static inline fib_entry_t *
@@ -98,163 +323,825 @@ get_new_fib_entry(void) {
     return fib_entry;
 }
 
-#ifdef TEST_RCU
-//#ifndef TEST_RCU_CONSTRAINED
-
+// with FIB_RECLAIM_THREAD, frees are recorded by the reclaimer lcore concurrently with the control thread
 static inline void
 add_mem_event(char type, uint64_t value) {
     mem_event_t *event;
-    if (unlikely(mem_event_pos >= mem_event_capacity))
-        rte_exit(EXIT_FAILURE, "memory events %zd >= capacity %zd\n", mem_event_pos, mem_event_capacity);
-    event = mem_events + (mem_event_pos++);
+    result_mem_event_record_t record;
+    size_t pos;
+
+    if (mem_event_ring) { // --result_stream: wait for the writer lcore rather than lose the event
+        record = (result_mem_event_record_t) {.type = type, .value = value};
+        if (unlikely(!rte_ring_enqueue_burst_elem(mem_event_ring, &record, sizeof(record), 1, NULL))) {
+            __atomic_fetch_add(&result_stream_stall_count, 1, __ATOMIC_RELAXED);
+            while (!rte_ring_enqueue_burst_elem(mem_event_ring, &record, sizeof(record), 1, NULL))
+                rte_pause();
+        }
+        return;
+    }
+    pos = __atomic_fetch_add(&mem_event_pos, 1, __ATOMIC_RELAXED);
+    if (unlikely(pos >= mem_event_capacity))
+        rte_exit(EXIT_FAILURE, "memory events %zd >= capacity %zd\n", pos, mem_event_capacity);
+    event = mem_events + pos;
     event->type = type;
     event->value = value;
 }
-//#endif // TEST_RCU_CONSTRAINED
 
 static void
 free_fib_entry(void *p, void *key_data) {
     RTE_SET_USED(p);
-//#ifndef TEST_RCU_CONSTRAINED // only calculate for rcu_u
     fib_entry_t *entry = (fib_entry_t *)key_data;
     add_mem_event(MEM_EVENT_TYPE_FREE, entry->seq);
-//#endif // defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED)
-    rte_mempool_put(fib_entry_pool, key_data);
+    rte_mempool_put(rte_mempool_from_obj(key_data), key_data); // may belong to a fib replaced by a reload
 }
 
-#endif // TEST_RCU
+// free function of fib_dq, e is an array of n fib_dq_entry_t
+static void
+free_fib_dq_entries(void *p, void *e, unsigned int n) {
+    fib_dq_entry_t *entries = (fib_dq_entry_t *)e;
+    uint64_t now = rte_rdtsc(), cycles;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        cycles = now - entries[i].defer_time;
+        fib_reclaim_stats.total_reclaim_cycles += cycles;
+        if (unlikely(cycles > fib_reclaim_stats.max_reclaim_cycles))
+            fib_reclaim_stats.max_reclaim_cycles = cycles;
+        free_fib_entry(p, entries[i].entry);
+    }
+    fib_reclaim_stats.freed_count += n;
+}
 
-// init hash using RCU
+/*
+ * Creates fib_dq, where the control thread defers the entries it replaces in SYNC_MODE_RCU.
+ * Inline, it is drained by the enqueues themselves, the same way rte_hash does in RTE_HASH_QSBR_MODE_DQ.
+ * Otherwise only the control thread when idle or the reclaimer lcore drain it.
+ */
 static inline void
-init_hash(size_t capacity) {
-    int ret;
-    size_t sz;
-    struct rte_hash_parameters fib_parameters = {
-            .name = "FIB",
-            .key_len = sizeof(uint16_t),
-            .entries = capacity,
-            .hash_func = rte_hash_crc,
-            .hash_func_init_val = 0,
-            .socket_id = rte_socket_id(),
-            .reserved = 0,
-#ifdef TEST_RCU
-            .extra_flag = RTE_HASH_EXTRA_FLAGS_RW_CONCURRENCY_LF, // use LF for RCU
-#else // TEST_RCU
-            .extra_flag = 0, // no need for RTE_HASH_EXTRA_FLAGS_RW_CONCURRENCY, since we will add lock ourselves
-#endif  // TEST_RCU
-    };
+init_fib_dq(size_t capacity) {
+    struct rte_rcu_qsbr_dq_parameters dq_params = {0};
 
-#ifdef TEST_RCU
-    struct rte_hash_rcu_config rcu_config = {0};
-#endif  // TEST_RCU
+    dq_params.name = "FIB_DQ";
+    dq_params.flags = RTE_RCU_QSBR_DQ_MT_UNSAFE; // 1 enqueuer (control) and 1 reclaimer (control or reclaimer lcore)
+    // the other entries of fib_entry_pool are in the fib
+    dq_params.size = fib_dq_size = fib_entry_pool_size(capacity) - capacity;
+    dq_params.esize = sizeof(fib_dq_entry_t);
+    if (fib_reclaim == FIB_RECLAIM_INLINE) {
+        dq_params.trigger_reclaim_limit = FIB_DQ_RECLAIM_THRSH;
+        dq_params.max_reclaim_size = FIB_DQ_RECLAIM_MAX;
+    } else {
+        dq_params.trigger_reclaim_limit = dq_params.size + 1; // never reclaim on enqueue
+        dq_params.max_reclaim_size = 0;
+    }
+    dq_params.free_fn = free_fib_dq_entries;
+    dq_params.p = NULL;
+    dq_params.v = qs_variable;
+    fib_dq = rte_rcu_qsbr_dq_create(&dq_params);
+    if (unlikely(!fib_dq))
+        rte_exit(EXIT_FAILURE, "Cannot create defer queue for fib\n");
+}
+
+// frees up to n entries of fib_dq whose grace period is over, returns the # freed
+static inline unsigned
+reclaim_fib_dq(unsigned n) {
+    unsigned freed = 0;
+
+    rte_rcu_qsbr_dq_reclaim(fib_dq, n, &freed, NULL, NULL);
+    return freed;
+}
 
-    fib = rte_hash_create(&fib_parameters);
-    if (unlikely(!fib))
-        rte_exit(EXIT_FAILURE, "Cannot create hashtable for fib\n");
+// defers the free of a replaced entry after a grace period
+static inline void
+defer_fib_entry(fib_entry_t *old_entry) {
+    fib_dq_entry_t e = {old_entry, 0};
+
+    // at most fib_dq_size entries wait for a grace period, so fib_entry_pool never runs out
+    if (unlikely(fib_reclaim_stats.deferred_count - fib_reclaim_stats.freed_count >= fib_dq_size)) {
+        fib_reclaim_stats.stall_count++;
+        do {
+            if (fib_reclaim == FIB_RECLAIM_THREAD)
+                rte_pause(); // only the reclaimer lcore puts back into fib_entry_pool
+            else
+                reclaim_fib_dq(FIB_DQ_RECLAIM_MAX);
+        } while (fib_reclaim_stats.deferred_count - fib_reclaim_stats.freed_count >= fib_dq_size);
+    }
+
+    e.defer_time = rte_rdtsc();
+    if (unlikely(rte_rcu_qsbr_dq_enqueue(fib_dq, &e)))
+        rte_exit(EXIT_FAILURE, "Cannot enqueue fib entry into the defer queue\n");
+    fib_reclaim_stats.deferred_count++;
+}
+
+static inline void
+init_rcu(void) {
+    size_t sz;
+    int ret;
 
-#ifdef TEST_RCU
     sz = rte_rcu_qsbr_get_memsize(RTE_MAX_LCORE);
     if (unlikely(sz == 1))
         rte_exit(EXIT_FAILURE, "Cannot get size of rcu qsbr\n");
 
-    qs_variable = rte_zmalloc("rcu_qs", sz, RTE_CACHE_LINE_SIZE);
+    qs_variable = rte_zmalloc_socket("rcu_qs", sz, RTE_CACHE_LINE_SIZE, data_socket_id);
     if (unlikely(!qs_variable))
         rte_exit(EXIT_FAILURE, "Cannot malloc qs_variable\n");
 
     ret = rte_rcu_qsbr_init(qs_variable, RTE_MAX_LCORE);
     if (unlikely(ret))
         rte_exit(EXIT_FAILURE, "Cannot init qs_variable\n");
+}
+
+static __rte_always_inline vec16_t
+load_vec16(const void *p) {
+    vec16_t v;
+
+    memcpy(&v, p, sizeof(v)); // unaligned load
+    return v;
+}
+
+static __rte_always_inline void
+store_vec16(void *p, vec16_t v) {
+    memcpy(p, &v, sizeof(v)); // unaligned store
+}
+
+// s_addr of the rewritten ethernet headers, at its place in the first 16 bytes of the header
+static inline vec16_t
+ether_s_addr_vec(const struct rte_ether_addr *s_addr) {
+    vec16_t v = {0};
+
+    memcpy((uint8_t *)&v + offsetof(struct rte_ether_hdr, s_addr), s_addr, sizeof(*s_addr));
+    return v;
+}
+
+/*
+ * Writes d_addr (from the entry) and s_addr of the ethernet header with one 16-byte store, bytes 12-15
+ * (ether_type and padding) are kept, then time_control and time_control_arrive_f with another one.
+ */
+static __rte_always_inline void
+rewrite_data_header(const fib_entry_t *entry, data_pkt_t *pkt, vec16_t s_addr) {
+    static const vec16_t d_addr_mask = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    static const vec16_t keep_mask = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff};
+    vec16_t header;
+
+    RTE_BUILD_BUG_ON(offsetof(fib_entry_t, receiver_mac) != 0);
+    RTE_BUILD_BUG_ON(offsetof(data_pkt_t, common_header.ether.d_addr) != 0);
+    RTE_BUILD_BUG_ON(offsetof(data_pkt_t, common_header.seq) < sizeof(vec16_t));
+    RTE_BUILD_BUG_ON(offsetof(fib_entry_t, control_arrive_time_f) != offsetof(fib_entry_t, control_time) + 8);
+    RTE_BUILD_BUG_ON(offsetof(data_pkt_t, time_control_arrive_f) != offsetof(data_pkt_t, time_control) + 8);
+
+    header = load_vec16(pkt);
+    header = (header & keep_mask) | (load_vec16(entry) & d_addr_mask) | s_addr;
+    store_vec16(pkt, header);
+    store_vec16(&pkt->time_control, load_vec16(&entry->control_time));
+}
+
+/*
+ * Copies the entry into the packet, retries while the control thread is writing the entry.
+ * Only the control thread writes, so readers never block it.
+ */
+static inline void
+read_fib_entry(const fib_entry_t *entry, data_pkt_t *pkt, vec16_t s_addr) {
+    uint32_t sc;
+
+    for (;;) {
+        sc = __atomic_load_n(&entry->sc, __ATOMIC_ACQUIRE);
+        if (unlikely(sc & 1)) {
+            rte_pause();
+            continue;
+        }
+        rewrite_data_header(entry, pkt, s_addr);
+        // the copies must complete before sc is read again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (likely(__atomic_load_n(&entry->sc, __ATOMIC_RELAXED) == sc))
+            return;
+    }
+}
+
+// updates the entry in place, the only writer is the control thread
+static inline void
+write_fib_entry(fib_entry_t *entry, const control_packet_stat_t *pkt_info) {
+    uint32_t sc = entry->sc;
+
+    __atomic_store_n(&entry->sc, sc + 1, __ATOMIC_RELAXED);
+    // readers must see the odd counter before any of the new fields
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rte_ether_addr_copy(&receiver_data_mac, &entry->receiver_mac);
+    entry->seq = pkt_info->seq;
+    entry->control_time = pkt_info->control_time;
+    entry->control_arrive_time_f = pkt_info->control_arrive_time_f;
+    __atomic_store_n(&entry->sc, sc + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Read-side helpers of the data plane. mode is a constant in every worker instance (see main.c),
+ * so the switches are resolved at compile time.
+ */
+static __rte_always_inline void
+fib_read_lock(const sync_mode_t mode, unsigned lcore_id) {
+    if (sync_mode_is_rcu(mode))
+        rte_rcu_qsbr_lock(qs_variable, lcore_id);
+    else if (mode == SYNC_MODE_RWL)
+        rte_rwlock_read_lock(&rw_lock);
+}
+
+static __rte_always_inline void
+fib_read_unlock(const sync_mode_t mode, unsigned lcore_id) {
+    if (sync_mode_is_rcu(mode))
+        rte_rcu_qsbr_unlock(qs_variable, lcore_id);
+    else if (mode == SYNC_MODE_RWL)
+        rte_rwlock_read_unlock(&rw_lock);
+}
+
+static __rte_always_inline void
+copy_fib_entry(const sync_mode_t mode, const fib_entry_t *entry, data_pkt_t *pkt, vec16_t s_addr) {
+    if (mode == SYNC_MODE_SEQLOCK) {
+        read_fib_entry(entry, pkt, s_addr);
+        return;
+    }
+    rewrite_data_header(entry, pkt, s_addr);
+}
+
+// creates the hash of a fib, attached to RCU when rte_hash reclaims the replaced entries itself
+static inline struct rte_hash *
+create_fib_hash(const char *name, size_t capacity) {
+    struct rte_hash *hash;
+    int ret;
+    struct rte_hash_parameters fib_parameters = {
+            .name = name,
+            .key_len = fib_key_len,
+            .entries = capacity,
+            .hash_func = rte_hash_crc,
+            .hash_func_init_val = 0,
+            .socket_id = data_socket_id,
+            .reserved = 0,
+            // RWL needs no RTE_HASH_EXTRA_FLAGS_RW_CONCURRENCY, since we will add lock ourselves,
+            // SEQLOCK never changes the hash after loading
+            .extra_flag = sync_mode_is_rcu(sync_mode) ? RTE_HASH_EXTRA_FLAGS_RW_CONCURRENCY_LF : 0, // use LF for RCU
+    };
+
+    struct rte_hash_rcu_config rcu_config = {0};
 
+    hash = rte_hash_create(&fib_parameters);
+    if (unlikely(!hash)) {
+        printf("Cannot create hashtable %s for fib\n", name);
+        return NULL;
+    }
+
+    // in batch mode the control thread reclaims the old entries itself, the hash only swaps the pointers,
+    // the defer queue of rte_hash is only drained by its own updates, fib_dq is used to reclaim elsewhere
+    if (!sync_mode_is_rcu(sync_mode) || control_update == CONTROL_UPDATE_BATCH || fib_reclaim != FIB_RECLAIM_INLINE)
+        return hash;
 
     rcu_config.v = qs_variable;
     rcu_config.free_key_data_func = free_fib_entry;
     rcu_config.dq_size = fib_entry_pool_size(capacity);
     // use default value for other configurations
-#ifdef TEST_RCU_CONSTRAINED
-    rcu_config.mode = RTE_HASH_QSBR_MODE_SYNC;
-#else // TEST_RCU_CONSTRAINED
-    rcu_config.mode = RTE_HASH_QSBR_MODE_DQ;
-#endif // TEST_RCU_CONSTRAINED
-    ret = rte_hash_rcu_qsbr_add(fib, &rcu_config);
-    if (unlikely(ret))
-        rte_exit(EXIT_FAILURE, "Cannot add rcu_qsbr for fib\n");
-#else // TEST_RCU
-    rte_rwlock_init(&rw_lock);
-#endif // TEST_RCU
+    rcu_config.mode = sync_mode == SYNC_MODE_RCU_CONSTRAINED ? RTE_HASH_QSBR_MODE_SYNC : RTE_HASH_QSBR_MODE_DQ;
+    ret = rte_hash_rcu_qsbr_add(hash, &rcu_config);
+    if (unlikely(ret)) {
+        printf("Cannot add rcu_qsbr for hashtable %s\n", name);
+        rte_hash_free(hash);
+        return NULL;
+    }
+    return hash;
 }
 
+// init the synchronization of the hash, with RCU in the RCU modes
+static inline void
+init_hash(size_t capacity) {
+    if (!sync_mode_is_rcu(sync_mode)) {
+        if (sync_mode == SYNC_MODE_RWL)
+            rte_rwlock_init(&rw_lock);
+        return;
+    }
+
+    init_rcu();
+
+    if (control_update == CONTROL_UPDATE_SINGLE && fib_reclaim != FIB_RECLAIM_INLINE)
+        init_fib_dq(capacity);
+}
+
+// creates the directly indexed fib, all slots empty
+static inline fib_entry_t **
+create_fib_array(const char *name) {
+    fib_entry_t **array;
+
+    array = rte_zmalloc_socket(name, sizeof(fib_entry_t *) * FIB_ARRAY_SIZE, RTE_CACHE_LINE_SIZE, data_socket_id);
+    if (unlikely(!array))
+        printf("Cannot create array %s for fib\n", name);
+    return array;
+}
+
+// init the synchronization of the directly indexed fib, the pointers are protected by RCU (or the rwlock)
+static inline void
+init_fib_array(size_t capacity) {
+    if (!sync_mode_is_rcu(sync_mode)) {
+        if (sync_mode == SYNC_MODE_RWL)
+            rte_rwlock_init(&rw_lock);
+        return;
+    }
+
+    init_rcu();
+
+    if (sync_mode == SYNC_MODE_RCU_CONSTRAINED || control_update == CONTROL_UPDATE_BATCH)
+        return; // reclaimed by the control thread itself
+    init_fib_dq(capacity);
+}
+
+/*
+ * Inits what protects the fib (RCU, fib_dq or the rwlock), the fib itself is created by create_fib_hash or
+ * create_fib_array.
+ */
+static inline void
+init_fib(size_t capacity) {
+    if (fib_backend == FIB_BACKEND_ARRAY)
+        init_fib_array(capacity);
+    else
+        init_hash(capacity);
+}
+
+// fib and fib_array are swapped by a reload, the readers load them inside their read-side critical section
+static __rte_always_inline struct rte_hash *
+fib_hash_current(void) {
+    return __atomic_load_n(&fib, __ATOMIC_ACQUIRE);
+}
+
+static inline fib_entry_t *
+fib_array_lookup(uint16_t node_id_be) {
+    return __atomic_load_n(&__atomic_load_n(&fib_array, __ATOMIC_ACQUIRE)[node_id_be], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Publishes a new entry in the fib array, the old one (if any) is freed after a grace period.
+ */
+static inline void
+fib_array_publish(uint16_t node_id_be, fib_entry_t *fib_entry) {
+    fib_entry_t *old_entry;
+
+    old_entry = __atomic_exchange_n(&fib_array[node_id_be], fib_entry, __ATOMIC_RELEASE);
+    if (unlikely(!old_entry))
+        return;
+    if (sync_mode == SYNC_MODE_RCU_CONSTRAINED) {
+        rte_rcu_qsbr_synchronize(qs_variable, RTE_QSBR_THRID_INVALID);
+        free_fib_entry(NULL, old_entry);
+    } else if (sync_mode == SYNC_MODE_RCU)
+        defer_fib_entry(old_entry);
+}
+
+// key of a node ID of the forward list
+static inline const void *
+fib_key_from_id(fib_key_t *key, uint64_t node_id) {
+    switch (fib_key_len) {
+        case sizeof(uint64_t):
+            key->u64 = node_id;
+            break;
+        case sizeof(uint32_t):
+            key->u32 = (uint32_t)node_id;
+            break;
+        default:
+            key->be16 = rte_cpu_to_be_16((uint16_t)node_id);
+            break;
+    }
+    return key;
+}
+
+// node ID of a key, as stored in the hash by fib_key_from_id
+static inline uint64_t
+fib_key_to_id(const void *key) {
+    const fib_key_t *k = key;
+
+    switch (fib_key_len) {
+        case sizeof(uint64_t):
+            return k->u64;
+        case sizeof(uint32_t):
+            return k->u32;
+        default:
+            return rte_be_to_cpu_16(k->be16);
+    }
+}
+
+// key of a node ID in big endian (from a packet), the ID itself with 16-bit keys
+static __rte_always_inline const void *
+fib_key_from_be16(fib_key_t *key, const uint16_t *node_id_be) {
+    if (likely(fib_key_len == sizeof(uint16_t)))
+        return node_id_be;
+    return fib_key_from_id(key, rte_be_to_cpu_16(*node_id_be));
+}
+
+/*
+ * Adds the initial entry of a node to a fib not published yet, sig is the hash of its key (unused by the array).
+ * Returns 0 on success.
+ */
 static inline int
-handle_data_packet(data_pkt_t *pkt, unsigned lcore_id) {
-#ifndef TEST_RCU
-    RTE_SET_USED(lcore_id);
-#endif // TEST_RCU
+add_fib_entry(fib_table_t *table, uint64_t node_id, hash_sig_t sig, fib_entry_t *fib_entry) {
+    fib_key_t key;
+    uint16_t node_id_be = rte_cpu_to_be_16((uint16_t)node_id); // IDs are < FIB_ARRAY_SIZE with the array
+
+    if (fib_backend == FIB_BACKEND_HASH)
+        return rte_hash_add_key_with_hash_data(table->hash, fib_key_from_id(&key, node_id), sig, fib_entry);
+
+    if (unlikely(table->array[node_id_be]))
+        return -EEXIST;
+    table->array[node_id_be] = fib_entry;
+    return 0;
+}
+
+// looks up the entry of a node in a fib only written by the calling thread, NULL if none
+static inline fib_entry_t *
+lookup_fib_table(const fib_table_t *table, uint64_t node_id) {
+    fib_entry_t *fib_entry;
+    fib_key_t key;
+
+    if (fib_backend == FIB_BACKEND_ARRAY)
+        return table->array[rte_cpu_to_be_16((uint16_t)node_id)];
+    if (rte_hash_lookup_data(table->hash, fib_key_from_id(&key, node_id), (void **)&fib_entry) < 0)
+        return NULL;
+    return fib_entry;
+}
+
+// # of entries in a fib only written by the calling thread, updates may add nodes outside the forward list
+static inline size_t
+count_fib_table(const fib_table_t *table) {
+    size_t count = 0;
+    unsigned i;
+
+    if (fib_backend == FIB_BACKEND_HASH)
+        return rte_hash_count(table->hash);
+    for (i = 0; i < FIB_ARRAY_SIZE; i++)
+        count += table->array[i] != NULL;
+    return count;
+}
 
+// looks up the entry of a node on the control thread, which is the only writer
+static inline fib_entry_t *
+find_fib_entry(uint16_t node_id_be) {
+    fib_entry_t *fib_entry;
+    fib_key_t key;
+    int ret;
+
+    if (fib_backend == FIB_BACKEND_ARRAY) {
+        fib_entry = fib_array_lookup(node_id_be);
+        ret = fib_entry ? 0 : -ENOENT;
+    } else
+        ret = rte_hash_lookup_data(fib, fib_key_from_be16(&key, &node_id_be), (void **)&fib_entry);
+    if (unlikely(ret < 0))
+        rte_exit(EXIT_FAILURE, "Cannot find entry: %"PRIu16" in fib\n", rte_be_to_cpu_16(node_id_be));
+    return fib_entry;
+}
+
+static __rte_always_inline int
+handle_data_packet(data_pkt_t *pkt, unsigned lcore_id, const sync_mode_t mode, vec16_t s_addr) {
     fib_entry_t *entry;
+    fib_key_t key;
     int ret;
 
-#ifdef TEST_RCU
-    rte_rcu_qsbr_lock(qs_variable, lcore_id);
-#else // TEST_RCU
-    rte_rwlock_read_lock(&rw_lock);
-#endif // TEST_RCU
-    
-    ret = rte_hash_lookup_data(fib, &pkt->common_header.dst_addr, (void **)&entry);
+    fib_read_lock(mode, lcore_id);
+
+    if (fib_backend == FIB_BACKEND_ARRAY) {
+        entry = fib_array_lookup(pkt->common_header.dst_addr);
+        ret = entry ? 0 : -ENOENT;
+    } else
+        ret = rte_hash_lookup_data(fib_hash_current(), fib_key_from_be16(&key, &pkt->common_header.dst_addr),
+                                   (void **)&entry);
     if (unlikely(ret < 0)) {
         printf("Cannot find fib for node: %"PRIu16"\n", rte_be_to_cpu_16(pkt->common_header.dst_addr));
         ret = -1;
         goto end;
     }
 
-    rte_ether_addr_copy(&entry->receiver_mac, &pkt->common_header.ether.d_addr);
-    pkt->time_control = entry->control_time;
-    pkt->time_control_arrive_f = entry->control_arrive_time_f;
+    copy_fib_entry(mode, entry, pkt, s_addr);
     ret = 0;
 
 end:
-#ifdef TEST_RCU
-    rte_rcu_qsbr_unlock(qs_variable, lcore_id);
-#else // TEST_RCU
-    rte_rwlock_read_unlock(&rw_lock);
-#endif // TEST_RCU
+    fib_read_unlock(mode, lcore_id);
     return ret;
 }
 
+/*
+ * Looks up the fib for nb_pkts (<= RTE_HASH_LOOKUP_BULK_MAX) packets with a single bulk lookup
+ * inside a single read-side critical section, then fills in the found entries.
+ * With prefetch, the found entries are prefetched FORWARD_PREFETCH_OFFSET packets ahead of the copies.
+ * Returns the hit mask, bit i is set if pkts[i] is found.
+ */
+static __rte_always_inline uint64_t
+handle_data_burst(data_pkt_t **pkts, uint16_t nb_pkts, unsigned lcore_id, const sync_mode_t mode,
+                  vec16_t s_addr, const bool prefetch) {
+    const void *keys[RTE_HASH_LOOKUP_BULK_MAX];
+    fib_key_t wide_keys[RTE_HASH_LOOKUP_BULK_MAX]; // only filled with keys wider than the packet field
+    fib_entry_t *entries[RTE_HASH_LOOKUP_BULK_MAX];
+    uint64_t hit_mask = 0, mask;
+    uint16_t i;
+
+    if (fib_backend == FIB_BACKEND_HASH)
+        for (i = 0; i < nb_pkts; i++)
+            keys[i] = fib_key_from_be16(&wide_keys[i], &pkts[i]->common_header.dst_addr);
+
+    fib_read_lock(mode, lcore_id);
+
+    if (fib_backend == FIB_BACKEND_ARRAY) {
+        for (i = 0; i < nb_pkts; i++) {
+            entries[i] = fib_array_lookup(pkts[i]->common_header.dst_addr);
+            hit_mask |= (uint64_t)(entries[i] != NULL) << i;
+        }
+    } else
+        rte_hash_lookup_bulk_data(fib_hash_current(), keys, nb_pkts, &hit_mask, (void **)entries);
+
+    // entries are only safe to use inside the critical section
+    if (prefetch)
+        for (i = 0; i < RTE_MIN(nb_pkts, FORWARD_PREFETCH_OFFSET); i++)
+            if (likely(hit_mask & (1ULL << i)))
+                rte_prefetch0(entries[i]);
+    for (i = 0, mask = hit_mask; mask; i++, mask >>= 1) {
+        if (prefetch && i + FORWARD_PREFETCH_OFFSET < nb_pkts && likely(mask & (1ULL << FORWARD_PREFETCH_OFFSET)))
+            rte_prefetch0(entries[i + FORWARD_PREFETCH_OFFSET]);
+        if (unlikely(!(mask & 1))) continue;
+        copy_fib_entry(mode, entries[i], pkts[i], s_addr);
+    }
+
+    fib_read_unlock(mode, lcore_id);
+
+    if (unlikely(hit_mask != (nb_pkts == 64 ? UINT64_MAX : (1ULL << nb_pkts) - 1))) {
+        for (i = 0; i < nb_pkts; i++)
+            if (!(hit_mask & (1ULL << i)))
+                printf("Cannot find fib for node: %"PRIu16"\n", rte_be_to_cpu_16(pkts[i]->common_header.dst_addr));
+    }
+    return hit_mask;
+}
+
+/*
+ * Swaps in the new entry of a node without reclaiming the old one, returns the old entry.
+ * Only the control thread writes, so the lookup of the old entry cannot race with another update.
+ */
+static inline fib_entry_t *
+fib_swap_entry(uint16_t node_id_be, fib_entry_t *fib_entry) {
+    fib_entry_t *old_entry = NULL;
+    const void *key;
+    fib_key_t wide_key;
+
+    if (fib_backend == FIB_BACKEND_ARRAY)
+        return __atomic_exchange_n(&fib_array[node_id_be], fib_entry, __ATOMIC_RELEASE);
+
+    key = fib_key_from_be16(&wide_key, &node_id_be);
+    if (unlikely(rte_hash_lookup_data(fib, key, (void **)&old_entry) < 0))
+        old_entry = NULL;
+    rte_hash_add_key_data(fib, key, fib_entry);
+    return old_entry;
+}
+
 static inline void
 update_fib_entry(control_packet_stat_t *pkt_info) {
     fib_entry_t *fib_entry;
-#ifdef TEST_RCU
-    fib_entry = get_new_fib_entry();
-//#ifndef TEST_RCU_CONSTRAINED
-    add_mem_event(MEM_EVENT_TYPE_ALLOCATE, pkt_info->seq);
-//#endif //TEST_RCU_CONSTRAINED
-#else // TEST_RCU
-    int ret;
-    rte_rwlock_write_lock(&rw_lock);
+    fib_key_t key;
 
-    ret = rte_hash_lookup_data(fib, &pkt_info->node_id, (void **)&fib_entry);
-    if (unlikely(ret < 0))
-        rte_exit(EXIT_FAILURE, "Cannot find entry: %"PRIu16" in fib\n", rte_be_to_cpu_16(pkt_info->node_id));
-#endif // TEST_RCU
-
-    rte_ether_addr_copy(&receiver_data_mac, &fib_entry->receiver_mac);
-    fib_entry->seq = pkt_info->seq;
-    fib_entry->control_time = pkt_info->control_time;
-    fib_entry->control_arrive_time_f = pkt_info->control_arrive_time_f;
-
-#ifdef TEST_RCU
-//    printf("before add_key_data\n");
-    rte_hash_add_key_data(fib, &pkt_info->node_id, fib_entry);
-//    printf("after add_key_data\n");
-#else // TEST_RCU
-    rte_rwlock_write_unlock(&rw_lock);
-#endif // TEST_RCU
+    switch (sync_mode) {
+        case SYNC_MODE_RCU:
+        case SYNC_MODE_RCU_CONSTRAINED:
+            fib_entry = get_new_fib_entry();
+            add_mem_event(MEM_EVENT_TYPE_ALLOCATE, pkt_info->seq);
+            rte_ether_addr_copy(&receiver_data_mac, &fib_entry->receiver_mac);
+            fib_entry->seq = pkt_info->seq;
+            fib_entry->control_time = pkt_info->control_time;
+            fib_entry->control_arrive_time_f = pkt_info->control_arrive_time_f;
+
+            if (fib_backend == FIB_BACKEND_ARRAY)
+                fib_array_publish(pkt_info->node_id, fib_entry);
+            else if (fib_dq) { // the old entry is reclaimed through fib_dq, not by rte_hash
+                fib_entry = fib_swap_entry(pkt_info->node_id, fib_entry);
+                if (likely(fib_entry))
+                    defer_fib_entry(fib_entry);
+            } else
+                rte_hash_add_key_data(fib, fib_key_from_be16(&key, &pkt_info->node_id), fib_entry);
+            break;
+        case SYNC_MODE_SEQLOCK:
+            write_fib_entry(find_fib_entry(pkt_info->node_id), pkt_info);
+            break;
+        default:
+            rte_rwlock_write_lock(&rw_lock);
+            fib_entry = find_fib_entry(pkt_info->node_id);
+            rte_ether_addr_copy(&receiver_data_mac, &fib_entry->receiver_mac);
+            fib_entry->seq = pkt_info->seq;
+            fib_entry->control_time = pkt_info->control_time;
+            fib_entry->control_arrive_time_f = pkt_info->control_arrive_time_f;
+            rte_rwlock_write_unlock(&rw_lock);
+            break;
+    }
 
     pkt_info->publish_time_f = rte_rdtsc_precise();
-//#if defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED) // only calculate for rcu_u
-#ifdef TEST_RCU
-    add_mem_event(MEM_EVENT_TYPE_CONTROL_TIMESTAMP, pkt_info->publish_time_f);
-#endif // defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED)
+    if (sync_mode_is_rcu(sync_mode))
+        add_mem_event(MEM_EVENT_TYPE_CONTROL_TIMESTAMP, pkt_info->publish_time_f);
+}
+
+static inline void
+init_fib_batch_ctx(fib_batch_ctx_t *ctx) {
+    unsigned i;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->last_seen = rte_zmalloc("FIB_BATCH_LAST_SEEN", sizeof(uint32_t) * FIB_ARRAY_SIZE, RTE_CACHE_LINE_SIZE);
+    ctx->latest = rte_zmalloc("FIB_BATCH_LATEST", sizeof(uint16_t) * FIB_ARRAY_SIZE, RTE_CACHE_LINE_SIZE);
+    if (unlikely(!ctx->last_seen || !ctx->latest))
+        rte_exit(EXIT_FAILURE, "Cannot malloc fib batch context\n");
+    if (sync_mode != SYNC_MODE_RCU)
+        return;
+    for (i = 0; i < FIB_RECLAIM_PENDING_BATCHES; i++) {
+        ctx->pending[i].entries = rte_malloc("FIB_BATCH_PENDING", sizeof(fib_entry_t *) * control_receive_burst_size, 0);
+        if (unlikely(!ctx->pending[i].entries))
+            rte_exit(EXIT_FAILURE, "Cannot malloc fib batch pending entries\n");
+    }
+}
+
+/*
+ * SYNC_MODE_RCU: frees the pending batches whose grace period is over, oldest first.
+ * With wait, blocks until at least the oldest pending batch is freed.
+ */
+static inline void
+reclaim_fib_batches(fib_batch_ctx_t *ctx, bool wait) {
+    fib_reclaim_batch_t *batch;
+    uint16_t i;
+
+    while (ctx->pending_count) {
+        batch = &ctx->pending[ctx->pending_head];
+        if (!rte_rcu_qsbr_check(qs_variable, batch->token, wait))
+            return;
+        for (i = 0; i < batch->nb_entries; i++)
+            free_fib_entry(NULL, batch->entries[i]);
+        ctx->pending_head = (ctx->pending_head + 1) % FIB_RECLAIM_PENDING_BATCHES;
+        ctx->pending_count--;
+        wait = false;
+    }
+}
+
+/*
+ * RCU part of update_fib_batch: the new entries are published one by one,
+ * the replaced ones are reclaimed with a single grace period.
+ */
+static inline void
+publish_fib_batch_rcu(fib_batch_ctx_t *ctx, control_packet_stat_t *pkt_infos,
+                      const uint16_t *unique, uint16_t nb_unique) {
+    fib_entry_t *old_entries[nb_unique];
+    uint16_t nb_old = 0, i, j;
+    control_packet_stat_t *pkt_info;
+    fib_entry_t *fib_entry;
+    fib_reclaim_batch_t *batch;
+    uint64_t token;
+
+    if (sync_mode == SYNC_MODE_RCU) {
+        reclaim_fib_batches(ctx, false);
+        // make sure the new entries can be allocated and there is room to defer the old ones
+        while (ctx->pending_count &&
+               (ctx->pending_count == FIB_RECLAIM_PENDING_BATCHES || rte_mempool_avail_count(fib_entry_pool) < nb_unique))
+            reclaim_fib_batches(ctx, true);
+    }
+
+    for (j = nb_unique; j-- > 0;) { // in arrival order
+        pkt_info = &pkt_infos[unique[j]];
+        fib_entry = get_new_fib_entry();
+        add_mem_event(MEM_EVENT_TYPE_ALLOCATE, pkt_info->seq);
+        rte_ether_addr_copy(&receiver_data_mac, &fib_entry->receiver_mac);
+        fib_entry->seq = pkt_info->seq;
+        fib_entry->control_time = pkt_info->control_time;
+        fib_entry->control_arrive_time_f = pkt_info->control_arrive_time_f;
 
+        fib_entry = fib_swap_entry(pkt_info->node_id, fib_entry);
+        if (likely(fib_entry))
+            old_entries[nb_old++] = fib_entry;
+
+        pkt_info->publish_time_f = rte_rdtsc_precise();
+        add_mem_event(MEM_EVENT_TYPE_CONTROL_TIMESTAMP, pkt_info->publish_time_f);
+    }
+
+    if (unlikely(!nb_old))
+        return;
+    if (sync_mode == SYNC_MODE_RCU_CONSTRAINED) {
+        token = rte_rcu_qsbr_start(qs_variable);
+        rte_rcu_qsbr_check(qs_variable, token, true);
+        for (i = 0; i < nb_old; i++)
+            free_fib_entry(NULL, old_entries[i]);
+    } else {
+        batch = &ctx->pending[(ctx->pending_head + ctx->pending_count) % FIB_RECLAIM_PENDING_BATCHES];
+        memcpy(batch->entries, old_entries, sizeof(fib_entry_t *) * nb_old);
+        batch->nb_entries = nb_old;
+        batch->token = rte_rcu_qsbr_start(qs_variable);
+        ctx->pending_count++;
+    }
+}
+
+/*
+ * Applies the updates of a burst of control packets. Updates of the same node are coalesced,
+ * only the latest one is applied and the others get its publish time. The replaced entries are
+ * reclaimed with a single grace period for the whole burst.
+ */
+static inline void
+update_fib_batch(fib_batch_ctx_t *ctx, control_packet_stat_t *pkt_infos, uint16_t nb_pkts) {
+    uint16_t unique[nb_pkts]; // index of the latest update of every node, in reverse arrival order
+    uint16_t nb_unique = 0, i, j;
+    uint32_t generation;
+    control_packet_stat_t *pkt_info;
+    fib_entry_t *fib_entry;
+    uint64_t now;
+
+    generation = ++ctx->generation;
+    if (unlikely(!generation)) { // wrapped around, forget all
+        memset(ctx->last_seen, 0, sizeof(uint32_t) * FIB_ARRAY_SIZE);
+        generation = ctx->generation = 1;
+    }
+    for (i = nb_pkts; i-- > 0;) {
+        if (ctx->last_seen[pkt_infos[i].node_id] == generation)
+            continue; // overridden by a later packet in this batch
+        ctx->last_seen[pkt_infos[i].node_id] = generation;
+        ctx->latest[pkt_infos[i].node_id] = i;
+        unique[nb_unique++] = i;
+    }
+
+    switch (sync_mode) {
+        case SYNC_MODE_RCU:
+        case SYNC_MODE_RCU_CONSTRAINED:
+            publish_fib_batch_rcu(ctx, pkt_infos, unique, nb_unique);
+            break;
+        case SYNC_MODE_SEQLOCK:
+            for (j = nb_unique; j-- > 0;) {
+                pkt_info = &pkt_infos[unique[j]];
+                write_fib_entry(find_fib_entry(pkt_info->node_id), pkt_info);
+                pkt_info->publish_time_f = rte_rdtsc_precise(); // every entry is visible as soon as it is written
+            }
+            break;
+        default:
+            rte_rwlock_write_lock(&rw_lock);
+            for (j = nb_unique; j-- > 0;) {
+                pkt_info = &pkt_infos[unique[j]];
+                fib_entry = find_fib_entry(pkt_info->node_id);
+                rte_ether_addr_copy(&receiver_data_mac, &fib_entry->receiver_mac);
+                fib_entry->seq = pkt_info->seq;
+                fib_entry->control_time = pkt_info->control_time;
+                fib_entry->control_arrive_time_f = pkt_info->control_arrive_time_f;
+            }
+            rte_rwlock_write_unlock(&rw_lock);
+
+            now = rte_rdtsc_precise(); // all updates become visible at once
+            for (j = 0; j < nb_unique; j++)
+                pkt_infos[unique[j]].publish_time_f = now;
+            break;
+    }
+
+    // coalesced updates are published together with the one overriding them
+    if (nb_unique != nb_pkts)
+        for (i = 0; i < nb_pkts; i++)
+            pkt_infos[i].publish_time_f = pkt_infos[ctx->latest[pkt_infos[i].node_id]].publish_time_f;
+}
+
+static inline unsigned
+latency_hist_bucket(uint64_t cycles) {
+    unsigned e;
+
+    if (unlikely(cycles >> LATENCY_HIST_MAX_BITS))
+        return LATENCY_HIST_BUCKETS - 1;
+    if (cycles < (1u << LATENCY_HIST_SUB_BITS))
+        return cycles;
+    e = 63 - __builtin_clzll(cycles); // >= LATENCY_HIST_SUB_BITS
+    return ((e - LATENCY_HIST_SUB_BITS + 1) << LATENCY_HIST_SUB_BITS) +
+           ((cycles >> (e - LATENCY_HIST_SUB_BITS)) & ((1u << LATENCY_HIST_SUB_BITS) - 1));
+}
+
+// highest value counted in the bucket
+static inline uint64_t
+latency_hist_bucket_max(unsigned bucket) {
+    unsigned shift;
+
+    if (bucket < (1u << LATENCY_HIST_SUB_BITS))
+        return bucket;
+    shift = (bucket >> LATENCY_HIST_SUB_BITS) - 1;
+    return ((((uint64_t)1 << LATENCY_HIST_SUB_BITS) + (bucket & ((1u << LATENCY_HIST_SUB_BITS) - 1)) + 1) << shift) - 1;
+}
+
+static __rte_always_inline void
+latency_hist_record(latency_hist_t *hist, uint64_t cycles) {
+    hist->count[latency_hist_bucket(cycles)]++;
+}
+
+static inline uint64_t
+latency_hist_total(const latency_hist_t *hist) {
+    uint64_t total = 0;
+    unsigned i;
+
+    for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+        total += hist->count[i];
+    return total;
+}
+
+// value (in cycles) below which the fraction p of the samples falls, 0 without samples
+static inline uint64_t
+latency_hist_percentile(const latency_hist_t *hist, uint64_t total, double p) {
+    uint64_t rank = (uint64_t)(p * total), seen = 0;
+    unsigned i;
+
+    if (!total)
+        return 0;
+    if (rank >= total)
+        rank = total - 1;
+    for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        seen += hist->count[i];
+        if (seen > rank)
+            return latency_hist_bucket_max(i);
+    }
+    return latency_hist_bucket_max(LATENCY_HIST_BUCKETS - 1);
 }
 
 #endif //__FORWARDER_COMMON_H
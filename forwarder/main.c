@@ -1,33 +1,116 @@
 #include "common.h"
+#include <fcntl.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 int data_send_burst_size, data_receive_burst_size, data_tx_ring_size, data_rx_ring_size;
 int control_receive_burst_size;//, control_tx_ring_size, control_rx_ring_size;
+int nb_data_queues;
+forward_mode_t forward_mode;
+tx_flush_t tx_flush;
+int tx_latency_budget_us;
 struct rte_ether_addr receiver_data_mac;
 char *forward_list_filename;
 long long control_packet_count;
 struct rte_mempool *fib_entry_pool;
 struct rte_hash *fib;
-struct rte_ring *data_receive_ring, *data_send_ring, *control_receive_ring;
+fib_backend_t fib_backend;
+int fib_key_len;
+int data_socket_id;
+lcore_list_t lcores_rx, lcores_fwd, lcores_tx, lcore_ctrl;
+fib_entry_t **fib_array;
+control_update_t control_update;
+sync_mode_t sync_mode;
+fib_reclaim_t fib_reclaim;
+quiescent_mode_t quiescent_mode;
+lookup_mode_t lookup_mode;
+bool write_time_after_lookup;
+int bench_forward_bursts;
+char *stats_filename;
+bool latency_hist;
+bool result_stream;
+bool fib_reload;
+bool flow_steering; // cleared at startup if the port cannot install the rules
+int control_ring_size;
+control_admission_t control_admission;
+idle_policy_t idle_policy;
+int idle_sleep_us;
+struct rte_ring *control_receive_ring;
+
+// One data plane pipeline (receive -> forward -> send) per RX/TX queue pair.
+typedef struct {
+    uint16_t queue_id;
+    struct rte_ring *data_receive_ring, *data_send_ring;
+} __rte_cache_aligned data_queue_t;
+
+// CONTROL_ADMISSION_PRIORITY: control packets of a receiver waiting for room in control_receive_ring, oldest first
+typedef struct {
+    struct rte_mbuf *pkts[CONTROL_BACKLOG_SIZE];
+    uint16_t count;
+} control_backlog_t;
+
+// --idle_policy: what a worker polls and for how long it has found it empty
+typedef struct {
+    uint32_t nb_empty; // consecutive empty polls
+    bool slept; // since the last packet, the wake-up of the next one is timed with --latency_hist
+    bool rcu_reader; // offline while asleep, so the writer does not wait for it
+    bool interrupt; // rx_queue wakes this thread, see init_idle
+    int rx_queue; // polled RX queue, -1 if ring is polled
+    struct rte_ring *ring;
+} idle_state_t;
+
+/*
+ * Counters of one lcore, only written by that lcore and read by the status reporter,
+ * so the lcores of a pipeline do not bounce a shared cache line.
+ */
+typedef struct {
+    volatile forwarder_counters_t c;
+    int queue_id; // data queue served by the lcore, -1 if none
+    latency_hist_t *hist; // LATENCY_STAGE_MAX histograms with --latency_hist, NULL otherwise
+} __rte_cache_aligned lcore_stats_t;
+
+/*
+ * --result_stream: records of one result file, enqueued by the producers into ring,
+ * gathered by the writer lcore in chunk and appended to file once chunk is full.
+ */
+typedef struct {
+    struct rte_ring *ring;
+    result_file_stream_t file;
+    const char *filename;
+    void *chunk; // RESULT_STREAM_CHUNK_SIZE bytes
+    unsigned chunk_capacity, chunk_count; // in records
+} result_stream_t;
 
-#ifdef TEST_RCU
 struct rte_rcu_qsbr *qs_variable;
-//#ifndef TEST_RCU_CONSTRAINED
+struct rte_rcu_qsbr_dq *fib_dq;
+uint32_t fib_dq_size;
+fib_reclaim_stats_t fib_reclaim_stats;
 mem_event_t *mem_events;
 size_t mem_event_pos, mem_event_capacity;
-//#endif // TEST_RCU_CONSTRAINED
-#else // TEST_RCU
+struct rte_ring *mem_event_ring;
+volatile uint64_t result_stream_stall_count;
 rte_rwlock_t rw_lock;
-#endif // TEST_RCU
 
 static int rx_timestamp_dynfield_offset;
+static int forward_timestamp_dynfield_offset; // only registered with --latency_hist
 static uint16_t port_id_data; //, port_id_control;
 static struct rte_ether_addr my_data_mac; //, my_control_mac;
 static control_packet_stat_t *results;
-static volatile uint64_t received_control_count = 0, received_data_count = 0,
-        rx_dropped_data_count = 0, tx_dropped_data_count = 0, tx_out_dropped_data_count = 0,
-        rx_dropped_control_count =0, other_packet_count = 0;
+static data_queue_t data_queues[MAX_DATA_QUEUES];
+static lcore_stats_t lcore_stats[RTE_MAX_LCORE];
+static struct rte_mbuf **control_slots; // CONTROL_ADMISSION_COALESCE: latest pending control packet per node, NULL if none
+static stats_export_t *stats_export;
+static result_stream_t control_result_stream, mem_event_result_stream;
+static uint64_t total_publish_delay; // --result_stream only, written by the control thread
+static volatile unsigned result_stream_producers; // --result_stream: control (and reclaim) lcores still running
+static const char *lcore_roles[RTE_MAX_LCORE]; // role launched on each worker lcore, NULL if none
 static volatile bool running = true;
+static volatile bool fib_reload_requested; // --fib_reload: set by SIGHUP, served by the control thread
+static fib_table_t retired_fib; // replaced by the last reload, until freed by free_retired_fib
+static uint64_t retired_fib_token;
+static uint64_t idle_sleep_cycles; // --idle_sleep_us
+static bool idle_can_sleep; // the CPU (and IDLE_POWER_MONITOR) has rte_power_monitor and rte_power_pause
 
 int
 parse_args(int argc, char **argv);
@@ -35,18 +118,32 @@ parse_args(int argc, char **argv);
 int
 parse_fib(void);
 
+int
+reload_fib_table(fib_table_t *table, const fib_table_t *from, unsigned generation);
+
 
 static inline uint64_t *
 rx_timestamp_field(struct rte_mbuf *mbuf) {
     return RTE_MBUF_DYNFIELD(mbuf, rx_timestamp_dynfield_offset, uint64_t * );
 }
 
+static inline uint64_t *
+forward_timestamp_field(struct rte_mbuf *mbuf) {
+    return RTE_MBUF_DYNFIELD(mbuf, forward_timestamp_dynfield_offset, uint64_t * );
+}
+
 static void sigintHandler(int sig)
 {
     RTE_SET_USED(sig);
     running = false;
 }
 
+static void sighupHandler(int sig)
+{
+    RTE_SET_USED(sig);
+    fib_reload_requested = true;
+}
+
 
 static uint16_t
 rx_callback(uint16_t port_id,
@@ -83,57 +180,262 @@ data_tx_callback(uint16_t port_id,
     uint16_t i;
     uint64_t now;
     data_pkt_t * header;
+    latency_hist_t *hist = lcore_stats[rte_lcore_id()].hist;
 
     now = rte_rdtsc_precise();
     for (i = 0; i < nb_pkts; i++) {
         // we will only send data packets, safe to cast directly
         header = rte_pktmbuf_mtod(pkts[i], data_pkt_t * );
         header->time_exit_f = now;
+        if (hist) {
+            latency_hist_record(&hist[LATENCY_STAGE_FORWARD_TX], now - *forward_timestamp_field(pkts[i]));
+            latency_hist_record(&hist[LATENCY_STAGE_RX_EXIT], now - *rx_timestamp_field(pkts[i]));
+        }
     }
     return nb_pkts;
 }
 
 
+/*
+ * Software RSS on dst_addr: all packets of one destination are forwarded by the same pipeline,
+ * regardless of the RX queue the NIC put them in.
+ */
+static inline data_queue_t *
+data_queue_of(const common_t *header) {
+    return &data_queues[header->dst_addr % nb_data_queues];
+}
+
+// counters of the calling lcore, which serves the data queue queue_id (-1 if none)
+static inline lcore_stats_t *
+init_lcore_stats(int queue_id) {
+    lcore_stats_t *stats = &lcore_stats[rte_lcore_id()];
+
+    stats->queue_id = queue_id;
+    return stats;
+}
+
+/*
+ * --flow_steering: the RX queues also get the packets no rule matched, keeps the packets of ether_type
+ * at the front of bufs and returns their count, the others are freed.
+ */
+static __rte_always_inline uint16_t
+keep_packets_of_type(lcore_stats_t *stats, struct rte_mbuf **bufs, uint16_t nb_rx, uint16_t ether_type) {
+    uint16_t nb_kept = 0, i;
+
+    for (i = 0; i < nb_rx; i++) {
+        if (likely(rte_pktmbuf_mtod(bufs[i], common_t *)->ether.ether_type == ether_type))
+            bufs[nb_kept++] = bufs[i];
+        else {
+            rte_pktmbuf_free(bufs[i]);
+            stats->c.other_packet_count++;
+        }
+    }
+    return nb_kept;
+}
+
+/*
+ * Hands the control packets of a burst over to the control thread following control_admission,
+ * nb_pkts may be 0 to only retry the backlog.
+ */
+static __rte_always_inline void
+admit_control_packets(lcore_stats_t *stats, control_backlog_t *backlog, struct rte_mbuf **pkts, uint16_t nb_pkts) {
+    struct rte_mbuf *old;
+    uint32_t node_id;
+    uint16_t nb_sent, nb_held, i;
+
+    switch (control_admission) {
+        case CONTROL_ADMISSION_COALESCE:
+            // the ring holds the nodes with a pending packet, each once, FIB_ARRAY_SIZE of them at most: it never fills
+            for (i = 0; i < nb_pkts; i++) {
+                node_id = rte_pktmbuf_mtod(pkts[i], common_t *)->dst_addr;
+                old = __atomic_exchange_n(&control_slots[node_id], pkts[i], __ATOMIC_ACQ_REL);
+                if (old) { // not taken by the control thread yet, it will get the newer one
+                    rte_pktmbuf_free(old);
+                    stats->c.control_coalesced_count++;
+                } else
+                    rte_ring_enqueue_elem(control_receive_ring, &node_id, sizeof(node_id));
+            }
+            return;
+        case CONTROL_ADMISSION_PRIORITY:
+            // the held packets go first, so the control thread still gets the packets of a node in order
+            if (backlog->count) {
+                nb_sent = rte_ring_enqueue_burst(control_receive_ring, (void **)backlog->pkts, backlog->count, NULL);
+                backlog->count -= nb_sent;
+                memmove(backlog->pkts, backlog->pkts + nb_sent, sizeof(backlog->pkts[0]) * backlog->count);
+            }
+            nb_sent = backlog->count ? 0 : rte_ring_enqueue_burst(control_receive_ring, (void **)pkts, nb_pkts, NULL);
+            nb_held = RTE_MIN(nb_pkts - nb_sent, CONTROL_BACKLOG_SIZE - backlog->count);
+            memcpy(backlog->pkts + backlog->count, pkts + nb_sent, sizeof(pkts[0]) * nb_held);
+            backlog->count += nb_held;
+            stats->c.control_held_count += nb_held;
+            nb_sent += nb_held;
+            break;
+        default:
+            nb_sent = rte_ring_enqueue_burst(control_receive_ring, (void **)pkts, nb_pkts, NULL);
+            break;
+    }
+    if (unlikely(nb_sent < nb_pkts)) {
+        stats->c.rx_dropped_control_count += nb_pkts - nb_sent;
+        rte_pktmbuf_free_bulk(pkts + nb_sent, nb_pkts - nb_sent);
+    }
+}
+
+static void
+init_idle(idle_state_t *idle, int rx_queue, struct rte_ring *ring, bool rcu_reader) {
+    int ret;
+
+    memset(idle, 0, sizeof(*idle));
+    idle->rx_queue = rx_queue;
+    idle->ring = ring;
+    idle->rcu_reader = rcu_reader;
+    if (idle_policy == IDLE_POLICY_INTERRUPT && rx_queue >= 0) {
+        // the interrupts of the queue go to the epoll instance of the calling thread
+        ret = rte_eth_dev_rx_intr_ctl_q(port_id_data, rx_queue, RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL);
+        if (ret)
+            printf("Core %u: RX queue %d has no interrupt (%s), monitoring it instead\n",
+                   rte_lcore_id(), rx_queue, strerror(-ret));
+        else
+            idle->interrupt = true;
+    }
+}
+
+/*
+ * --idle_policy: called on every empty poll of a worker. It keeps spinning for IDLE_SPIN_POLLS polls, then
+ * backs off with rte_pause, then (monitor, interrupt) sleeps until the next RX descriptor or the ring tail
+ * is written, the RX interrupt fires or idle_sleep_us elapses.
+ */
+static __rte_noinline void
+idle_wait(lcore_stats_t *stats, idle_state_t *idle) {
+#ifdef IDLE_POWER_MONITOR
+    struct rte_power_monitor_cond pmc;
+    int ret = 0;
+#endif
+    struct rte_epoll_event event;
+    unsigned lcore_id, i;
+    uint64_t start;
+
+    if (idle_policy == IDLE_POLICY_SPIN || ++idle->nb_empty <= IDLE_SPIN_POLLS)
+        return;
+    if (idle_policy == IDLE_POLICY_PAUSE || idle->nb_empty <= IDLE_SPIN_POLLS + IDLE_PAUSE_POLLS ||
+        (!idle->interrupt && !idle_can_sleep)) {
+        for (i = RTE_MIN(idle->nb_empty - IDLE_SPIN_POLLS, IDLE_PAUSE_MAX); i; i--)
+            rte_pause();
+        idle->nb_empty = RTE_MIN(idle->nb_empty, IDLE_SPIN_POLLS + IDLE_PAUSE_POLLS);
+        return;
+    }
+
+#ifdef IDLE_POWER_MONITOR
+    if (idle->rx_queue >= 0) {
+        if (!idle->interrupt)
+            ret = rte_eth_get_monitor_addr(port_id_data, idle->rx_queue, &pmc);
+    } else {
+        /*
+         * With mask 0 any write to the line of the tail wakes. The condition cannot say "the tail moved",
+         * so an enqueue between this count and rte_power_monitor arming the monitor is missed: the worker
+         * then sleeps idle_sleep_us with packets in the ring.
+         */
+        if (rte_ring_count(idle->ring))
+            return;
+        pmc.addr = &idle->ring->prod.tail;
+        pmc.val = 0;
+        pmc.mask = 0;
+        pmc.size = sizeof(idle->ring->prod.tail);
+    }
+#endif
+
+    lcore_id = rte_lcore_id();
+    if (idle->rcu_reader)
+        rte_rcu_qsbr_thread_offline(qs_variable, lcore_id);
+    start = rte_rdtsc();
+    if (idle->interrupt) {
+        rte_eth_dev_rx_intr_enable(port_id_data, idle->rx_queue);
+        rte_epoll_wait(RTE_EPOLL_PER_THREAD, &event, 1, RTE_MAX(idle_sleep_us / 1000, 1));
+        rte_eth_dev_rx_intr_disable(port_id_data, idle->rx_queue);
+    }
+#ifdef IDLE_POWER_MONITOR
+    else if (likely(!ret))
+        rte_power_monitor(&pmc, start + idle_sleep_cycles);
+    else // the PMD cannot tell which descriptor to monitor
+        rte_power_pause(start + idle_sleep_cycles);
+#endif
+    stats->c.idle_sleep_cycles += rte_rdtsc() - start;
+    stats->c.idle_sleep_count++;
+    if (idle->rcu_reader)
+        rte_rcu_qsbr_thread_online(qs_variable, lcore_id);
+    idle->slept = true;
+    idle->nb_empty--; // past the backoff, the next empty poll sleeps again
+}
+
+/*
+ * --idle_policy: called when a poll returned packets, first is the first of them.
+ * After a sleep on a ring, the wake-up is timed from the rx timestamp of first. The rx timestamp of
+ * a packet polled from the RX queue is taken after the wake-up, there it only shows on the sender side.
+ */
+static __rte_always_inline void
+idle_wake(lcore_stats_t *stats, idle_state_t *idle, struct rte_mbuf *first) {
+    idle->nb_empty = 0;
+    if (likely(!idle->slept))
+        return;
+    idle->slept = false;
+    if (stats->hist && idle->rx_queue < 0)
+        latency_hist_record(&stats->hist[LATENCY_STAGE_IDLE_WAKEUP], rte_rdtsc() - *rx_timestamp_field(first));
+}
+
 static int receive_data_thread(void *param) {
-    RTE_SET_USED(param);
+    data_queue_t *queue = (data_queue_t *)param;
+    lcore_stats_t *stats = init_lcore_stats(queue->queue_id);
 
     struct rte_mbuf *buf_rx[data_receive_burst_size];
-    struct rte_mbuf *to_data[data_receive_burst_size];
+    struct rte_mbuf *to_data[MAX_DATA_QUEUES][data_receive_burst_size];
     struct rte_mbuf *to_control[data_receive_burst_size];
     struct rte_mbuf *to_free[data_receive_burst_size];
-    uint16_t nb_rx, nb_to_data, nb_to_control, nb_free, i;
-    uint16_t nb_control_sent, nb_data_sent, diff;
+    uint16_t nb_to_data[MAX_DATA_QUEUES];
+    uint16_t nb_rx, nb_to_control, nb_free, i, q;
+    uint16_t nb_data_sent, diff;
     common_t *header;
+    data_queue_t *target;
     uint16_t ether_type_control = ETHER_TYPE_CONTROL, ether_type_data = ETHER_TYPE_DATA;
+    control_backlog_t backlog;
+    idle_state_t idle;
 
-    printf("\nCore %u receiving data packets.\n", rte_lcore_id());
+    printf("\nCore %u receiving data packets from queue %"PRIu16".\n", rte_lcore_id(), queue->queue_id);
+    memset(nb_to_data, 0, sizeof(nb_to_data));
+    backlog.count = 0;
+    init_idle(&idle, queue->queue_id, NULL, false);
 
     while(running) {
-        nb_rx = rte_eth_rx_burst(port_id_data, 0, buf_rx, data_receive_burst_size);
-        if (unlikely(!nb_rx)) continue;
-        nb_to_data = nb_to_control = nb_free = 0;
+        nb_rx = rte_eth_rx_burst(port_id_data, queue->queue_id, buf_rx, data_receive_burst_size);
+        if (unlikely(!nb_rx)) {
+            if (unlikely(backlog.count))
+                admit_control_packets(stats, &backlog, NULL, 0);
+            else
+                idle_wait(stats, &idle);
+            continue;
+        }
+        idle_wake(stats, &idle, buf_rx[0]);
+        nb_to_control = nb_free = 0;
         for (i = 0; i < nb_rx; i++) {
             header = rte_pktmbuf_mtod(buf_rx[i], common_t * );
-            if (likely(header->ether.ether_type == ether_type_data))
-                to_data[nb_to_data++] = buf_rx[i];
-            else if (likely(header->ether.ether_type == ether_type_control))
+            if (likely(header->ether.ether_type == ether_type_data)) {
+                q = data_queue_of(header)->queue_id;
+                to_data[q][nb_to_data[q]++] = buf_rx[i];
+            } else if (likely(header->ether.ether_type == ether_type_control))
                 to_control[nb_to_control++] = buf_rx[i];
             else {
                 to_free[nb_free++] = buf_rx[i];
-                other_packet_count++;
+                stats->c.other_packet_count++;
             }
         }
-        if (likely(nb_to_control)) {
-            nb_control_sent = rte_ring_enqueue_burst(control_receive_ring, (void **)to_control, nb_to_control, NULL);
-            diff = nb_to_control - nb_control_sent;
-            rx_dropped_control_count += diff;
-            if (unlikely(diff)) rte_pktmbuf_free_bulk(to_control + nb_control_sent, diff);
-        }
-        if (likely(nb_to_data)) {
-            nb_data_sent = rte_ring_enqueue_burst(data_receive_ring, (void **)to_data, nb_to_data, NULL);
-            diff = nb_to_data - nb_data_sent;
-            rx_dropped_data_count += diff;
-            if (unlikely(diff)) rte_pktmbuf_free_bulk(to_data + nb_data_sent, diff);
+        if (likely(nb_to_control || backlog.count))
+            admit_control_packets(stats, &backlog, to_control, nb_to_control);
+        for (q = 0; q < nb_data_queues; q++) {
+            if (!nb_to_data[q]) continue;
+            target = &data_queues[q];
+            nb_data_sent = rte_ring_enqueue_burst(target->data_receive_ring, (void **)to_data[q], nb_to_data[q], NULL);
+            diff = nb_to_data[q] - nb_data_sent;
+            stats->c.rx_dropped_data_count += diff;
+            if (unlikely(diff)) rte_pktmbuf_free_bulk(to_data[q] + nb_data_sent, diff);
+            nb_to_data[q] = 0;
         }
         if (unlikely(nb_free)) rte_pktmbuf_free_bulk(to_free, nb_free);
     }
@@ -141,19 +443,82 @@ static int receive_data_thread(void *param) {
     return 0;
 }
 
+/*
+ * Holds the packets of a queue until a full burst, unless the oldest one (by its rx timestamp) would
+ * exceed tx_latency_budget_us before the burst fills at the recent arrival rate. Under load bursts are
+ * sent full, at a low rate packets are sent right away.
+ */
+static int send_data_adaptive(data_queue_t *queue, lcore_stats_t *stats) {
+    struct rte_mbuf *bufs[data_send_burst_size];
+    uint16_t nb_held = 0, nb_rx, nb_tx, diff;
+    uint64_t budget_cycles, gap_cycles, now, last_arrival = 0, age;
+    idle_state_t idle;
+
+    init_idle(&idle, -1, queue->data_send_ring, false);
+    budget_cycles = rte_get_timer_hz() * tx_latency_budget_us / 1000000;
+    gap_cycles = budget_cycles; // no estimate yet, assume a low rate
+    printf("\nCore %u sending data packets to queue %"PRIu16", adaptive flush, budget_cycles=%"PRIu64".\n",
+           rte_lcore_id(), queue->queue_id, budget_cycles);
+
+    while(running) {
+        nb_rx = rte_ring_dequeue_burst(queue->data_send_ring, (void **)(bufs + nb_held), data_send_burst_size - nb_held, NULL);
+        if (!nb_rx && !nb_held) { // idle, no need to read the time
+            idle_wait(stats, &idle);
+            continue;
+        }
+        now = rte_rdtsc();
+        if (nb_rx) {
+            idle_wake(stats, &idle, bufs[nb_held]);
+            if (likely(last_arrival))
+                gap_cycles = (gap_cycles * (TX_FLUSH_EWMA_WEIGHT - 1) + (now - last_arrival) / nb_rx) / TX_FLUSH_EWMA_WEIGHT;
+            last_arrival = now;
+            nb_held += nb_rx;
+        }
+
+        if (nb_held == data_send_burst_size)
+            stats->c.tx_flush_full_count++;
+        else {
+            age = now - *rx_timestamp_field(bufs[0]);
+            if (age >= budget_cycles)
+                stats->c.tx_flush_timeout_count++;
+            // nothing arrived for longer than the estimate, the rate is dropping
+            else if (age + (data_send_burst_size - nb_held) * RTE_MAX(gap_cycles, now - last_arrival) > budget_cycles)
+                stats->c.tx_flush_early_count++;
+            else continue; // the burst can still fill in time
+        }
+
+        nb_tx = rte_eth_tx_burst(port_id_data, queue->queue_id, bufs, nb_held);
+        diff = nb_held - nb_tx;
+        stats->c.tx_out_dropped_data_count += diff;
+        stats->c.tx_flushed_packet_count += nb_held;
+        if (unlikely(diff)) rte_pktmbuf_free_bulk(bufs + nb_tx, diff);
+        nb_held = 0;
+    }
+    printf("Core %u (data sender) finished!\n", rte_lcore_id());
+
+    return 0;
+}
+
 static int send_data_thread(void *param) {
-    RTE_SET_USED(param);
+    data_queue_t *queue = (data_queue_t *)param;
+    lcore_stats_t *stats = init_lcore_stats(queue->queue_id);
+
+    if (tx_flush == TX_FLUSH_ADAPTIVE)
+        return send_data_adaptive(queue, stats);
 
     uint16_t nb_rx, nb_tx, diff;
     struct rte_mbuf *bufs[data_send_burst_size];
     uint64_t first_failed_try = 0, now;
     uint64_t tx_burst_period_cycles;
+    idle_state_t idle;
 
+    init_idle(&idle, -1, queue->data_send_ring, false);
     tx_burst_period_cycles = rte_get_timer_hz() * TX_BURST_PERIOD_US / 1000000;
-    printf("\nCore %u sending data packets, tx_burst_period_cycles=%"PRIu64".\n", rte_lcore_id(), tx_burst_period_cycles);
+    printf("\nCore %u sending data packets to queue %"PRIu16", tx_burst_period_cycles=%"PRIu64".\n",
+           rte_lcore_id(), queue->queue_id, tx_burst_period_cycles);
 
     while(running) {
-        nb_rx = rte_ring_dequeue_bulk(data_send_ring, (void **) bufs, data_send_burst_size, NULL);
+        nb_rx = rte_ring_dequeue_bulk(queue->data_send_ring, (void **) bufs, data_send_burst_size, NULL);
         if (unlikely(!nb_rx)) { // not enought packets to send
             now = rte_rdtsc_precise();
             if (first_failed_try == 0) { // this is the first failed try
@@ -161,15 +526,19 @@ static int send_data_thread(void *param) {
                 continue;
             } else if (now - first_failed_try >=
                        tx_burst_period_cycles) { // waited long enough, try to send whatever is there
-                nb_rx = rte_ring_dequeue_burst(data_send_ring, (void **) bufs, data_send_burst_size, NULL);
+                nb_rx = rte_ring_dequeue_burst(queue->data_send_ring, (void **) bufs, data_send_burst_size, NULL);
                 first_failed_try = 0;
-                if (unlikely(!nb_rx)) continue; // still no packets to send, do nothing
+                if (unlikely(!nb_rx)) { // still no packets to send, do nothing
+                    idle_wait(stats, &idle);
+                    continue;
+                }
                 // else, let through and send
             } else { continue; } // wait a bit longer
         } else { first_failed_try = 0; } // has enough packets to send
-        nb_tx = rte_eth_tx_burst(port_id_data, 0, bufs, nb_rx);
+        idle_wake(stats, &idle, bufs[0]);
+        nb_tx = rte_eth_tx_burst(port_id_data, queue->queue_id, bufs, nb_rx);
         diff = nb_rx - nb_tx;
-        tx_out_dropped_data_count += diff;
+        stats->c.tx_out_dropped_data_count += diff;
         if (unlikely(diff)) rte_pktmbuf_free_bulk(bufs + nb_tx, diff);
     }
     printf("Core %u (data sender) finished!\n", rte_lcore_id());
@@ -177,87 +546,580 @@ static int send_data_thread(void *param) {
     return 0;
 }
 
-static int forward_data_thread(void *params) {
-    RTE_SET_USED(params);
+/*
+ * The data plane workers are instantiated once per combination of the runtime options below
+ * (DATA_PLANE_WORKERS), the options are constants inside every instance, so the checks on them
+ * are resolved at compile time and cost nothing per packet.
+ */
+typedef struct {
+    sync_mode_t mode;
+    quiescent_mode_t qs;
+    lookup_mode_t lookup;
+    bool time_after_lookup;
+    bool prefetch; // always set in the workers, cleared by --bench_forward to measure the difference
+} data_plane_opts_t;
+
+static __rte_always_inline void
+report_quiescent(const data_plane_opts_t o, quiescent_mode_t when, unsigned lcore_id) {
+    if (sync_mode_is_rcu(o.mode) && o.qs == when)
+        rte_rcu_qsbr_quiescent(qs_variable, lcore_id);
+}
 
-    uint16_t nb_rx, nb_tx, nb_send, nb_free, i, diff;
-    struct rte_mbuf *bufs[data_receive_burst_size], *to_free[data_receive_burst_size];
+/*
+ * Prefetches the mbuf FORWARD_PREFETCH_OFFSET packets ahead of i, and the packet header and
+ * rx timestamp of the one after it, whose mbuf was prefetched in an earlier iteration.
+ */
+static __rte_always_inline void
+prefetch_ahead(struct rte_mbuf **bufs, uint16_t i, uint16_t nb_rx) {
+    if (i + 2 * FORWARD_PREFETCH_OFFSET < nb_rx)
+        rte_prefetch0(bufs[i + 2 * FORWARD_PREFETCH_OFFSET]);
+    if (i + FORWARD_PREFETCH_OFFSET < nb_rx) {
+        rte_prefetch0(rte_pktmbuf_mtod(bufs[i + FORWARD_PREFETCH_OFFSET], void *));
+        rte_prefetch0(rx_timestamp_field(bufs[i + FORWARD_PREFETCH_OFFSET]));
+    }
+}
+
+// starts prefetch_ahead: the first 2 * FORWARD_PREFETCH_OFFSET mbufs and the first headers
+static __rte_always_inline void
+prefetch_start(struct rte_mbuf **bufs, uint16_t nb_rx) {
+    uint16_t i;
+
+    for (i = 0; i < RTE_MIN(nb_rx, 2 * FORWARD_PREFETCH_OFFSET); i++)
+        rte_prefetch0(bufs[i]);
+    for (i = 0; i < RTE_MIN(nb_rx, FORWARD_PREFETCH_OFFSET); i++) {
+        rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void *));
+        rte_prefetch0(rx_timestamp_field(bufs[i]));
+    }
+}
+
+/*
+ * Looks up the fib and rewrites the headers of a burst of data packets in place.
+ * The packets to send are compacted at the front of bufs and their count is returned,
+ * the ones that cannot be forwarded are appended to to_free.
+ * With --latency_hist, the sent packets are stamped with the end of the forward in forward_timestamp_field.
+ */
+static __rte_always_inline uint16_t
+forward_burst(lcore_stats_t *stats, struct rte_mbuf **bufs, uint16_t nb_rx,
+              struct rte_mbuf **to_free, uint16_t *nb_free, unsigned lcore_id, const data_plane_opts_t o) {
+    uint16_t nb_send, i;
     data_pkt_t * header;
-    unsigned  lcore_id = rte_lcore_id();
+    data_pkt_t *headers[RTE_HASH_LOOKUP_BULK_MAX];
+    uint16_t start, nb_chunk;
+    uint64_t hit_mask, start_tsc = 0, lookup_tsc = 0, end_tsc;
+    vec16_t s_addr;
+    latency_hist_t *hist = stats->hist;
     int ret;
 
-    printf("\nCore %u forwarding data packets.\n", lcore_id);
-#ifdef TEST_RCU
-    rte_rcu_qsbr_thread_register(qs_variable, lcore_id);
-    rte_rcu_qsbr_thread_online(qs_variable, lcore_id);
-#endif
+    nb_send = 0;
+    s_addr = ether_s_addr_vec(&my_data_mac);
+    if (hist)
+        start_tsc = rte_rdtsc();
+    if (o.prefetch)
+        prefetch_start(bufs, nb_rx);
+    if (o.lookup == LOOKUP_SINGLE)
+        goto single;
+
+    for (start = 0; start < nb_rx; start += nb_chunk) {
+        nb_chunk = RTE_MIN(nb_rx - start, RTE_HASH_LOOKUP_BULK_MAX);
+        for (i = 0; i < nb_chunk; i++) {
+            if (o.prefetch)
+                prefetch_ahead(bufs, start + i, nb_rx);
+            headers[i] = rte_pktmbuf_mtod(bufs[start + i], data_pkt_t * );
+        }
+
+        if (hist)
+            lookup_tsc = rte_rdtsc();
+        hit_mask = handle_data_burst(headers, nb_chunk, lcore_id, o.mode, s_addr, o.prefetch);
+        if (hist)
+            latency_hist_record(&hist[LATENCY_STAGE_LOOKUP], rte_rdtsc() - lookup_tsc);
+
+        for (i = 0; i < nb_chunk; i++) {
+            header = headers[i];
+            if (likely(hit_mask & (1ULL << i))) {
+                header->common_header.time_send = *rx_timestamp_field(bufs[start + i]); // reuse time_send for time_arrive_f
+                if (hist)
+                    latency_hist_record(&hist[LATENCY_STAGE_RX_FORWARD], start_tsc - header->common_header.time_send);
+                if (o.time_after_lookup)
+                    header->time_after_lookup_f = rte_rdtsc_precise();
+                bufs[nb_send++] = bufs[start + i];
+            } else {
+                // failed to process the data packet
+                to_free[(*nb_free)++] = bufs[start + i];
+                stats->c.lookup_failed_count++;
+            }
+        }
+    }
+    goto end;
+
+single:
+    for (i = 0; i < nb_rx; i++) {
+        report_quiescent(o, QUIESCENT_PER_PACKET, lcore_id);
+        if (o.prefetch)
+            prefetch_ahead(bufs, i, nb_rx);
+        header = rte_pktmbuf_mtod(bufs[i], data_pkt_t * );
+        if (hist)
+            lookup_tsc = rte_rdtsc();
+        ret = handle_data_packet(header, lcore_id, o.mode, s_addr);
+        if (hist)
+            latency_hist_record(&hist[LATENCY_STAGE_LOOKUP], rte_rdtsc() - lookup_tsc);
+        if (likely(!ret)) {
+            header->common_header.time_send = *rx_timestamp_field(bufs[i]); // reuse time_send for time_arrive_f
+            if (hist)
+                latency_hist_record(&hist[LATENCY_STAGE_RX_FORWARD], start_tsc - header->common_header.time_send);
+            if (o.time_after_lookup)
+                header->time_after_lookup_f = rte_rdtsc_precise();
+            bufs[nb_send++] = bufs[i];
+        } else {
+            // failed to process the data packet
+            to_free[(*nb_free)++] = bufs[i];
+            stats->c.lookup_failed_count++;
+        }
+    }
+
+end:
+    if (hist) {
+        end_tsc = rte_rdtsc();
+        for (i = 0; i < nb_send; i++)
+            *forward_timestamp_field(bufs[i]) = end_tsc;
+    }
+    stats->c.received_data_count += nb_send;
+    return nb_send;
+}
+
+static __rte_always_inline int
+forward_data_loop(data_queue_t *queue, const data_plane_opts_t o) {
+
+    uint16_t nb_rx, nb_tx, nb_send, nb_free, diff;
+    struct rte_mbuf *bufs[data_receive_burst_size], *to_free[data_receive_burst_size];
+    unsigned  lcore_id = rte_lcore_id();
+    lcore_stats_t *stats = init_lcore_stats(queue->queue_id);
+    idle_state_t idle;
+
+    printf("\nCore %u forwarding data packets of queue %"PRIu16".\n", lcore_id, queue->queue_id);
+    if (sync_mode_is_rcu(o.mode)) {
+        rte_rcu_qsbr_thread_register(qs_variable, lcore_id);
+        rte_rcu_qsbr_thread_online(qs_variable, lcore_id);
+    }
+    if (flow_steering)
+        init_idle(&idle, queue->queue_id, NULL, sync_mode_is_rcu(o.mode));
+    else
+        init_idle(&idle, -1, queue->data_receive_ring, sync_mode_is_rcu(o.mode));
 
     while(running) {
-#if defined(TEST_RCU) && !defined(TEST_RCU_PER_PACKET_QUIESCENT)
-        rte_rcu_qsbr_quiescent(qs_variable, lcore_id);
-#endif
-        nb_rx = rte_ring_dequeue_burst(data_receive_ring, (void **) bufs, data_receive_burst_size, NULL);
+        report_quiescent(o, QUIESCENT_PER_BURST, lcore_id);
+        if (flow_steering) { // no receive core, the rules steer the data packets to the RX queue of this data queue
+            nb_rx = rte_eth_rx_burst(port_id_data, queue->queue_id, bufs, data_receive_burst_size);
+            nb_rx = keep_packets_of_type(stats, bufs, nb_rx, ETHER_TYPE_DATA);
+        } else
+            nb_rx = rte_ring_dequeue_burst(queue->data_receive_ring, (void **) bufs, data_receive_burst_size, NULL);
         if (unlikely(!nb_rx)){
-#if defined(TEST_RCU) && defined(TEST_RCU_PER_PACKET_QUIESCENT)
-            rte_rcu_qsbr_quiescent(qs_variable, lcore_id);
-#endif
+            report_quiescent(o, QUIESCENT_PER_PACKET, lcore_id);
+            idle_wait(stats, &idle);
             continue;
         }
+        idle_wake(stats, &idle, bufs[0]);
 
-        nb_send = nb_free = 0;
-        for (i = 0; i < nb_rx; i++) {
-#if defined(TEST_RCU) && defined(TEST_RCU_PER_PACKET_QUIESCENT)
-            rte_rcu_qsbr_quiescent(qs_variable, lcore_id);
-#endif
-            header = rte_pktmbuf_mtod(bufs[i], data_pkt_t * );
-            ret = handle_data_packet(header, lcore_id);
-            if (likely(!ret)) {
+        nb_free = 0;
+        nb_send = forward_burst(stats, bufs, nb_rx, to_free, &nb_free, lcore_id, o);
+        if (likely(nb_send)) {
+            nb_tx = rte_ring_enqueue_burst(queue->data_send_ring, (void **) bufs, nb_send, NULL);
+            diff = nb_send - nb_tx;
+            stats->c.tx_dropped_data_count += diff;
+            if (unlikely(diff)) rte_pktmbuf_free_bulk(bufs + nb_tx, nb_send - nb_tx);
+        }
+        if (unlikely(nb_free)) rte_pktmbuf_free_bulk(to_free, nb_free);
+    }
+    printf("Core %u (data forwarder) finished!\n", lcore_id);
 
-                rte_ether_addr_copy(&my_data_mac, &header->common_header.ether.s_addr);
-                header->common_header.time_send = *rx_timestamp_field(bufs[i]); // reuse time_send for time_arrive_f
-#ifdef WRITE_TIME_AFTER_LOOKUP_F
-                header->time_after_lookup_f = rte_rdtsc_precise();
-#endif
-                received_data_count++;
-                bufs[nb_send++] = bufs[i];
-            } else {
-                // failed to process the data packet
+    return 0;
+}
+
+/*
+ * Run-to-completion worker: receive, classify, forward and send the packets of one queue
+ * on a single lcore, without going through data_receive_ring and data_send_ring.
+ * Control packets are still handed over to the control thread.
+ */
+static __rte_always_inline int
+run_to_completion_loop(data_queue_t *queue, const data_plane_opts_t o) {
+
+    struct rte_mbuf *bufs[data_receive_burst_size];
+    struct rte_mbuf *to_control[data_receive_burst_size];
+    struct rte_mbuf *to_free[data_receive_burst_size];
+    uint16_t nb_rx, nb_data, nb_to_control, nb_free, nb_send, nb_tx, i, diff;
+    common_t *header;
+    uint16_t ether_type_control = ETHER_TYPE_CONTROL, ether_type_data = ETHER_TYPE_DATA;
+    unsigned lcore_id = rte_lcore_id();
+    lcore_stats_t *stats = init_lcore_stats(queue->queue_id);
+    control_backlog_t backlog;
+    idle_state_t idle;
+
+    printf("\nCore %u receiving, forwarding and sending data packets of queue %"PRIu16".\n",
+           lcore_id, queue->queue_id);
+    backlog.count = 0;
+    if (sync_mode_is_rcu(o.mode)) {
+        rte_rcu_qsbr_thread_register(qs_variable, lcore_id);
+        rte_rcu_qsbr_thread_online(qs_variable, lcore_id);
+    }
+    init_idle(&idle, queue->queue_id, NULL, sync_mode_is_rcu(o.mode));
+
+    while(running) {
+        report_quiescent(o, QUIESCENT_PER_BURST, lcore_id);
+        nb_rx = rte_eth_rx_burst(port_id_data, queue->queue_id, bufs, data_receive_burst_size);
+        if (unlikely(!nb_rx)) {
+            report_quiescent(o, QUIESCENT_PER_PACKET, lcore_id);
+            if (unlikely(backlog.count))
+                admit_control_packets(stats, &backlog, NULL, 0);
+            else
+                idle_wait(stats, &idle);
+            continue;
+        }
+        idle_wake(stats, &idle, bufs[0]);
+
+        // classify, data packets are compacted in place
+        nb_data = nb_to_control = nb_free = 0;
+        for (i = 0; i < nb_rx; i++) {
+            header = rte_pktmbuf_mtod(bufs[i], common_t * );
+            if (likely(header->ether.ether_type == ether_type_data))
+                bufs[nb_data++] = bufs[i];
+            else if (likely(header->ether.ether_type == ether_type_control))
+                to_control[nb_to_control++] = bufs[i];
+            else {
                 to_free[nb_free++] = bufs[i];
-                other_packet_count++;
+                stats->c.other_packet_count++;
             }
         }
+        if (unlikely(nb_to_control || backlog.count))
+            admit_control_packets(stats, &backlog, to_control, nb_to_control);
+
+        nb_send = forward_burst(stats, bufs, nb_data, to_free, &nb_free, lcore_id, o);
         if (likely(nb_send)) {
-            nb_tx = rte_ring_enqueue_burst(data_send_ring, (void **) bufs, nb_send, NULL);
+            nb_tx = rte_eth_tx_burst(port_id_data, queue->queue_id, bufs, nb_send);
             diff = nb_send - nb_tx;
-            tx_dropped_data_count += diff;
-            if (unlikely(diff)) rte_pktmbuf_free_bulk(bufs + nb_tx, nb_send - nb_tx);
+            stats->c.tx_out_dropped_data_count += diff;
+            if (unlikely(diff)) rte_pktmbuf_free_bulk(bufs + nb_tx, diff);
         }
         if (unlikely(nb_free)) rte_pktmbuf_free_bulk(to_free, nb_free);
     }
-    printf("Core %u (data forwarder) finished!\n", lcore_id);
+    printf("Core %u (run-to-completion worker) finished!\n", lcore_id);
 
     return 0;
 }
 
+#define DATA_PLANE_WORKER_NAME(kind, m, q, l, t) kind##_##m##_##q##_##l##_##t
+
+#define DATA_PLANE_WORKER(m, q, l, t) \
+static int DATA_PLANE_WORKER_NAME(forward_data_thread, m, q, l, t)(void *params) { \
+    const data_plane_opts_t o = {SYNC_MODE_##m, QUIESCENT_##q, LOOKUP_##l, t, true}; \
+    return forward_data_loop((data_queue_t *)params, o); \
+} \
+static int DATA_PLANE_WORKER_NAME(run_to_completion_thread, m, q, l, t)(void *params) { \
+    const data_plane_opts_t o = {SYNC_MODE_##m, QUIESCENT_##q, LOOKUP_##l, t, true}; \
+    return run_to_completion_loop((data_queue_t *)params, o); \
+}
+
+#define DATA_PLANE_WORKER_ENTRY(m, q, l, t) \
+    [SYNC_MODE_##m][QUIESCENT_##q][LOOKUP_##l][t] = { \
+        DATA_PLANE_WORKER_NAME(forward_data_thread, m, q, l, t), \
+        DATA_PLANE_WORKER_NAME(run_to_completion_thread, m, q, l, t), \
+    },
+
+// per-packet quiescent states need per-packet lookups, and only apply to RCU
+#define DATA_PLANE_WORKERS(X, m) \
+    X(m, PER_BURST, BULK, 0) X(m, PER_BURST, BULK, 1) \
+    X(m, PER_BURST, SINGLE, 0) X(m, PER_BURST, SINGLE, 1)
+#define DATA_PLANE_WORKERS_RCU(X, m) \
+    DATA_PLANE_WORKERS(X, m) X(m, PER_PACKET, SINGLE, 0) X(m, PER_PACKET, SINGLE, 1)
+
+DATA_PLANE_WORKERS(DATA_PLANE_WORKER, RWL)
+DATA_PLANE_WORKERS_RCU(DATA_PLANE_WORKER, RCU)
+DATA_PLANE_WORKERS_RCU(DATA_PLANE_WORKER, RCU_CONSTRAINED)
+DATA_PLANE_WORKERS(DATA_PLANE_WORKER, SEQLOCK)
+
+typedef struct {
+    lcore_function_t *forward, *run_to_completion;
+} data_plane_workers_t;
+
+static const data_plane_workers_t data_plane_workers[SYNC_MODE_MAX][QUIESCENT_MAX][LOOKUP_MAX][2] = {
+        DATA_PLANE_WORKERS(DATA_PLANE_WORKER_ENTRY, RWL)
+        DATA_PLANE_WORKERS_RCU(DATA_PLANE_WORKER_ENTRY, RCU)
+        DATA_PLANE_WORKERS_RCU(DATA_PLANE_WORKER_ENTRY, RCU_CONSTRAINED)
+        DATA_PLANE_WORKERS(DATA_PLANE_WORKER_ENTRY, SEQLOCK)
+};
+
+/*
+ * --bench_forward: times forward_burst over bench_forward_bursts bursts, the packets are cycled through
+ * in order, like a receive ring would hand them over.
+ */
+static __rte_always_inline uint64_t
+bench_forward_pass(struct rte_mbuf **pkts, unsigned lcore_id, const data_plane_opts_t o) {
+    struct rte_mbuf *bufs[data_receive_burst_size], *to_free[data_receive_burst_size];
+    uint16_t nb_free;
+    uint64_t start;
+    int b, p;
+
+    start = rte_rdtsc_precise();
+    for (b = 0, p = 0; b < bench_forward_bursts; b++, p += data_receive_burst_size) {
+        if (p + data_receive_burst_size > BENCH_FORWARD_PKTS)
+            p = 0;
+        memcpy(bufs, pkts + p, sizeof(bufs[0]) * data_receive_burst_size);
+        nb_free = 0;
+        forward_burst(&lcore_stats[lcore_id], bufs, data_receive_burst_size, to_free, &nb_free, lcore_id, o);
+    }
+    return rte_rdtsc_precise() - start;
+}
+
+#define BENCH_FORWARD_PASS(m) \
+    case SYNC_MODE_##m: \
+        return prefetch ? \
+            bench_forward_pass(pkts, lcore_id, (data_plane_opts_t){SYNC_MODE_##m, QUIESCENT_PER_BURST, lookup_mode, false, true}) : \
+            bench_forward_pass(pkts, lcore_id, (data_plane_opts_t){SYNC_MODE_##m, QUIESCENT_PER_BURST, lookup_mode, false, false});
+
+static uint64_t
+bench_forward_cycles(struct rte_mbuf **pkts, unsigned lcore_id, bool prefetch) {
+    switch (sync_mode) {
+        BENCH_FORWARD_PASS(RWL)
+        BENCH_FORWARD_PASS(RCU)
+        BENCH_FORWARD_PASS(RCU_CONSTRAINED)
+        BENCH_FORWARD_PASS(SEQLOCK)
+        default:
+            rte_exit(EXIT_FAILURE, "Unknown sync mode %d\n", sync_mode);
+    }
+}
+
+/*
+ * Forwards synthetic data packets to the nodes of the fib on the main lcore, first without and then
+ * with prefetching, and prints the cycles per packet of both. No port or other lcore is involved,
+ * so the numbers only cover the lookup and the header rewrite.
+ */
+static void
+bench_forward(struct rte_mempool *mbuf_pool) {
+    struct rte_mbuf **pkts;
+    uint16_t *node_ids;
+    unsigned nb_nodes, i, lcore_id = rte_lcore_id();
+    const void *key;
+    void *data;
+    uint32_t next = 0;
+    uint64_t node_id;
+    data_pkt_t *header;
+    uint64_t cycles, packets = (uint64_t)bench_forward_bursts * data_receive_burst_size;
+    int prefetch;
+
+    pkts = rte_malloc("BENCH_PKTS", sizeof(struct rte_mbuf *) * BENCH_FORWARD_PKTS, 0);
+    node_ids = rte_malloc("BENCH_NODE_IDS", sizeof(uint16_t) * BENCH_FORWARD_PKTS, 0);
+    if (unlikely(!pkts || !node_ids))
+        rte_exit(EXIT_FAILURE, "Cannot malloc bench_forward packets\n");
+    if (unlikely(rte_pktmbuf_alloc_bulk(mbuf_pool, pkts, BENCH_FORWARD_PKTS)))
+        rte_exit(EXIT_FAILURE, "Cannot allocate %d mbufs for bench_forward\n", BENCH_FORWARD_PKTS);
+
+    // node IDs are kept in big endian, as in the fib
+    nb_nodes = 0;
+    if (fib_backend == FIB_BACKEND_ARRAY) {
+        for (i = 0; i < FIB_ARRAY_SIZE && nb_nodes < BENCH_FORWARD_PKTS; i++)
+            if (fib_array[i])
+                node_ids[nb_nodes++] = i;
+    } else {
+        while (nb_nodes < BENCH_FORWARD_PKTS && rte_hash_iterate(fib, &key, &data, &next) >= 0) {
+            node_id = fib_key_to_id(key);
+            if (node_id <= UINT16_MAX) // wider IDs cannot be addressed by the packets
+                node_ids[nb_nodes++] = rte_cpu_to_be_16((uint16_t)node_id);
+        }
+    }
+    if (unlikely(!nb_nodes))
+        rte_exit(EXIT_FAILURE, "No node in the fib for bench_forward\n");
+
+    for (i = 0; i < BENCH_FORWARD_PKTS; i++) {
+        header = rte_pktmbuf_mtod(pkts[i], data_pkt_t *);
+        memset(header, 0, sizeof(*header));
+        header->common_header.ether.ether_type = ETHER_TYPE_DATA;
+        header->common_header.seq = i;
+        header->common_header.dst_addr = node_ids[i % nb_nodes];
+        pkts[i]->data_len = pkts[i]->pkt_len = DATA_PKT_SIZE;
+        *rx_timestamp_field(pkts[i]) = rte_rdtsc();
+    }
+
+    if (sync_mode_is_rcu(sync_mode)) {
+        rte_rcu_qsbr_thread_register(qs_variable, lcore_id);
+        rte_rcu_qsbr_thread_online(qs_variable, lcore_id);
+    }
+    printf("bench_forward: %d bursts of %d packets over %d packets, %u nodes\n",
+           bench_forward_bursts, data_receive_burst_size, BENCH_FORWARD_PKTS, nb_nodes);
+    for (prefetch = 0; prefetch <= 1; prefetch++) {
+        bench_forward_cycles(pkts, lcore_id, prefetch); // warm up
+        cycles = bench_forward_cycles(pkts, lcore_id, prefetch);
+        printf("bench_forward: prefetch=%d, %.2f cycles/packet\n", prefetch, (double)cycles / packets);
+    }
+    if (sync_mode_is_rcu(sync_mode)) {
+        rte_rcu_qsbr_thread_offline(qs_variable, lcore_id);
+        rte_rcu_qsbr_thread_unregister(qs_variable, lcore_id);
+    }
+
+    rte_pktmbuf_free_bulk(pkts, BENCH_FORWARD_PKTS);
+    rte_free(node_ids);
+    rte_free(pkts);
+}
+
+/*
+ * --result_stream: hands the results of a burst to the writer lcore. Waits for room in the ring rather than
+ * dropping them, so the control thread is only slowed down if the disk cannot keep up.
+ */
+static void
+stream_control_results(const control_packet_stat_t *stats, uint16_t n) {
+    result_forwarder_control_record_t records[n];
+    struct rte_ring *ring = control_result_stream.ring;
+    unsigned done, i;
+
+    for (i = 0; i < n; i++) {
+        records[i] = (result_forwarder_control_record_t) {
+                .seq = stats[i].seq,
+                .node_id = rte_be_to_cpu_16(stats[i].node_id),
+                .control_time = stats[i].control_time,
+                .control_arrive_time_f = stats[i].control_arrive_time_f,
+                .publish_time_f = stats[i].publish_time_f,
+        };
+        total_publish_delay += stats[i].publish_time_f - stats[i].control_arrive_time_f;
+    }
+    if (!ring) // RESULT_PACKETS_FILENAME not defined
+        return;
+
+    done = rte_ring_enqueue_burst_elem(ring, records, sizeof(*records), n, NULL);
+    if (unlikely(done < n)) {
+        __atomic_fetch_add(&result_stream_stall_count, 1, __ATOMIC_RELAXED);
+        do {
+            rte_pause();
+            done += rte_ring_enqueue_burst_elem(ring, records + done, sizeof(*records), n - done, NULL);
+        } while (done < n);
+    }
+}
+
+/*
+ * Frees the fib replaced by the last reload, if any, returns true once there is none left.
+ * Its hash (or array) goes after a grace period, its entry pool once the entries replaced before the reload
+ * and still deferred (fib_dq, batches or the defer queue of rte_hash) are back, only the entries that stayed
+ * in the fib are then in use.
+ */
+static bool
+free_retired_fib(void) {
+    if (likely(!retired_fib.entry_pool))
+        return true;
+    if (retired_fib.hash || retired_fib.array) {
+        if (!rte_rcu_qsbr_check(qs_variable, retired_fib_token, false))
+            return false;
+        if (retired_fib.hash)
+            rte_hash_free(retired_fib.hash); // also frees what its defer queue still holds
+        rte_free(retired_fib.array);
+        retired_fib.hash = NULL;
+        retired_fib.array = NULL;
+    }
+    if (rte_mempool_in_use_count(retired_fib.entry_pool) > retired_fib.size)
+        return false;
+    rte_mempool_free(retired_fib.entry_pool);
+    retired_fib.entry_pool = NULL;
+    printf("Retired fib freed\n");
+    return true;
+}
+
+/*
+ * --fib_reload: builds a new fib from forward_list_filename and publishes it with a single pointer swap.
+ * It runs on the control thread, the only writer of the fib, so no update is lost in between: the nodes kept
+ * by the new fib start with their latest update. The data plane forwards with the old fib meanwhile,
+ * which is freed after a grace period by free_retired_fib.
+ */
+static void
+reload_fib(void) {
+    static unsigned generation;
+    fib_table_t table, current = {fib, fib_array, fib_entry_pool, 0};
+    uint64_t start = rte_rdtsc();
+
+    printf("Reloading fib from %s\n", forward_list_filename);
+    if (unlikely(reload_fib_table(&table, &current, ++generation))) {
+        printf("Failed in reloading fib, keeping the current one\n");
+        return;
+    }
+
+    current.size = count_fib_table(&current); // what stays in use in its pool once it is retired
+    fib_entry_pool = table.entry_pool; // only used by the control thread
+    if (fib_backend == FIB_BACKEND_ARRAY)
+        __atomic_store_n(&fib_array, table.array, __ATOMIC_RELEASE);
+    else
+        __atomic_store_n(&fib, table.hash, __ATOMIC_RELEASE);
+    retired_fib = current;
+    retired_fib_token = rte_rcu_qsbr_start(qs_variable);
+    printf("Fib reloaded, %zd nodes, %.3f ms\n", table.size,
+           (double)(rte_rdtsc() - start) * 1000 / rte_get_timer_hz());
+}
+
+// CONTROL_ADMISSION_COALESCE: takes the latest packet of up to nb nodes with one pending, see admit_control_packets
+static inline uint16_t
+dequeue_coalesced_control(struct rte_mbuf **bufs, uint16_t nb) {
+    uint32_t node_ids[nb];
+    uint16_t nb_nodes, nb_rx = 0, i;
+
+    nb_nodes = rte_ring_dequeue_burst_elem(control_receive_ring, node_ids, sizeof(node_ids[0]), nb, NULL);
+    for (i = 0; i < nb_nodes; i++) {
+        // 1 node ID is enqueued per slot set from NULL, so the slot is set
+        bufs[nb_rx] = __atomic_exchange_n(&control_slots[node_ids[i]], NULL, __ATOMIC_ACQ_REL);
+        if (likely(bufs[nb_rx]))
+            nb_rx++;
+    }
+    return nb_rx;
+}
+
 static int control_thread(void *params) {
     RTE_SET_USED(params);
 
     struct rte_mbuf *bufs[control_receive_burst_size];
     uint16_t nb_rx, i;
     control_pkt_t *header;
-    control_packet_stat_t *tmp_result;
+    control_packet_stat_t *tmp_result, *batch_result, *burst_result;
+    control_packet_stat_t stream_results[control_receive_burst_size]; // --result_stream: results of the current burst
+    fib_batch_ctx_t batch_ctx;
+    lcore_stats_t *stats = init_lcore_stats(-1);
+    idle_state_t idle;
 
     printf("\nCore %u receiving data packets.\n", rte_lcore_id());
     tmp_result = results;
+    if (control_update == CONTROL_UPDATE_BATCH)
+        init_fib_batch_ctx(&batch_ctx);
+    if (flow_steering)
+        init_idle(&idle, nb_data_queues, NULL, false);
+    else
+        init_idle(&idle, -1, control_receive_ring, false);
 
 
     while(running) {
-        nb_rx = rte_ring_dequeue_burst(control_receive_ring, (void **) bufs, control_receive_burst_size, NULL);
-        if (unlikely(!nb_rx)) continue;
+        if (fib_reload) {
+            // a new reload waits until the fib replaced by the previous one is freed
+            if (free_retired_fib() && unlikely(fib_reload_requested)) {
+                fib_reload_requested = false;
+                reload_fib();
+            }
+        }
+
+        if (flow_steering) { // the control RX queue comes after the data queues, see install_flow_rules
+            nb_rx = rte_eth_rx_burst(port_id_data, nb_data_queues, bufs, control_receive_burst_size);
+            nb_rx = keep_packets_of_type(stats, bufs, nb_rx, ETHER_TYPE_CONTROL);
+        } else if (control_admission == CONTROL_ADMISSION_COALESCE)
+            nb_rx = dequeue_coalesced_control(bufs, control_receive_burst_size);
+        else
+            nb_rx = rte_ring_dequeue_burst(control_receive_ring, (void **) bufs, control_receive_burst_size, NULL);
+        if (unlikely(!nb_rx)) {
+            // use the idle time to free old entries
+            if (control_update == CONTROL_UPDATE_BATCH && sync_mode == SYNC_MODE_RCU)
+                reclaim_fib_batches(&batch_ctx, false);
+            else if (fib_reclaim == FIB_RECLAIM_IDLE && fib_dq)
+                reclaim_fib_dq(FIB_DQ_RECLAIM_MAX);
+            idle_wait(stats, &idle);
+            continue;
+        }
+        idle_wake(stats, &idle, bufs[0]);
+
+        if (result_stream)
+            tmp_result = stream_results;
+        batch_result = burst_result = tmp_result;
 
         for (i = 0; i < nb_rx; i++) {
             header = rte_pktmbuf_mtod(bufs[i], control_pkt_t * );
-            if (unlikely(received_control_count >= (uint64_t)control_packet_count)) {
+            if (unlikely(!result_stream && tmp_result - results >= control_packet_count)) {
                 running = false;
                 rte_exit(EXIT_FAILURE, "Too many control packets! Consider increasing control_packet_count in the param.\n");
             }
@@ -270,92 +1132,602 @@ static int control_thread(void *params) {
 //                        tmp_result->seq,
 //                        tmp_result->control_time,
 //                        tmp_result->control_arrive_time_f);
-            update_fib_entry(tmp_result);
+            if (control_update == CONTROL_UPDATE_SINGLE) {
+                update_fib_entry(tmp_result);
+                stats->c.received_control_count++;
+                if (stats->hist)
+                    latency_hist_record(&stats->hist[LATENCY_STAGE_CONTROL_PUBLISH],
+                                        tmp_result->publish_time_f - tmp_result->control_arrive_time_f);
+            }
 
             tmp_result++;
-            received_control_count++;
         }
+        if (control_update == CONTROL_UPDATE_BATCH) {
+            update_fib_batch(&batch_ctx, batch_result, nb_rx);
+            stats->c.received_control_count += nb_rx;
+            for (; stats->hist && batch_result < tmp_result; batch_result++)
+                latency_hist_record(&stats->hist[LATENCY_STAGE_CONTROL_PUBLISH],
+                                    batch_result->publish_time_f - batch_result->control_arrive_time_f);
+        }
+        if (result_stream)
+            stream_control_results(burst_result, nb_rx);
         rte_pktmbuf_free_bulk(bufs, nb_rx);
     }
+    if (result_stream)
+        __atomic_fetch_sub(&result_stream_producers, 1, __ATOMIC_RELEASE);
     printf("Core %u (data receiver) finished!\n", rte_lcore_id());
     return 0;
 }
 
+/*
+ * Frees the entries deferred by the control thread, off the update path.
+ */
+static int reclaim_thread(void *params) {
+    RTE_SET_USED(params);
+
+    printf("\nCore %u reclaiming fib entries.\n", rte_lcore_id());
+    while(running) {
+        if (!reclaim_fib_dq(FIB_DQ_RECLAIM_MAX))
+            rte_delay_us_sleep(FIB_RECLAIM_IDLE_SLEEP_US);
+    }
+    if (result_stream)
+        __atomic_fetch_sub(&result_stream_producers, 1, __ATOMIC_RELEASE);
+    printf("Core %u (reclaimer) finished!\n", rte_lcore_id());
+    return 0;
+}
+
+static void
+open_result_stream(result_stream_t *stream, const char *name, const char *filename, uint32_t record_type,
+                   uint32_t record_size, unsigned ring_flags) {
+    stream->ring = rte_ring_create_elem(name, record_size, RESULT_STREAM_RING_SIZE, data_socket_id, ring_flags);
+    if (unlikely(!stream->ring))
+        rte_exit(EXIT_FAILURE, "Failed in creating %s\n", name);
+    stream->chunk_capacity = RESULT_STREAM_CHUNK_SIZE / record_size;
+    stream->chunk_count = 0;
+    stream->chunk = rte_malloc(name, (size_t)record_size * stream->chunk_capacity, RTE_CACHE_LINE_SIZE);
+    if (unlikely(!stream->chunk))
+        rte_exit(EXIT_FAILURE, "Failed in creating the chunk of %s\n", name);
+    stream->filename = filename;
+    if (unlikely(result_file_stream_open(&stream->file, filename, record_type, record_size, rte_get_timer_hz())))
+        rte_exit(EXIT_FAILURE, "Cannot create result file: %s: %s\n", filename, strerror(errno));
+}
+
+/*
+ * Moves the records waiting in the ring of stream into its chunk, appending the chunk to the file
+ * whenever it is full, and with flush, also the last partial chunk. Returns the # of records moved.
+ */
+static unsigned
+drain_result_stream(result_stream_t *stream, bool flush) {
+    const uint32_t record_size = stream->file.record_size;
+    unsigned n, total = 0;
+
+    if (!stream->ring)
+        return 0;
+    do {
+        n = rte_ring_dequeue_burst_elem(stream->ring, (char *)stream->chunk + (size_t)record_size * stream->chunk_count,
+                                        record_size, stream->chunk_capacity - stream->chunk_count, NULL);
+        stream->chunk_count += n;
+        total += n;
+        if (stream->chunk_count == stream->chunk_capacity || (flush && stream->chunk_count)) {
+            if (unlikely(result_file_stream_append(&stream->file, stream->chunk, stream->chunk_count)))
+                rte_exit(EXIT_FAILURE, "Cannot write result file: %s: %s\n", stream->filename, strerror(errno));
+            stream->chunk_count = 0;
+        }
+    } while (n);
+    return total;
+}
+
+static void
+close_result_stream(result_stream_t *stream) {
+    if (!stream->ring)
+        return;
+    drain_result_stream(stream, true);
+    result_file_stream_close(&stream->file);
+    printf("File %s finished! %"PRIu64" records\n", stream->filename, stream->file.record_count);
+    rte_ring_free(stream->ring);
+    rte_free(stream->chunk);
+    stream->ring = NULL;
+}
+
+/*
+ * --result_stream: writes the records of the control thread (and the reclaimer) to disk in chunks, until they
+ * finished producing them. The last partial chunks are written by the main lcore in write_results.
+ */
+static int result_writer_thread(void *params) {
+    RTE_SET_USED(params);
+
+    unsigned n;
+
+    printf("\nCore %u writing results.\n", rte_lcore_id());
+    while (running || __atomic_load_n(&result_stream_producers, __ATOMIC_ACQUIRE)) {
+        n = drain_result_stream(&control_result_stream, false);
+        n += drain_result_stream(&mem_event_result_stream, false);
+        if (!n)
+            rte_delay_us_sleep(RESULT_STREAM_IDLE_SLEEP_US);
+    }
+    printf("Core %u (result writer) finished!\n", rte_lcore_id());
+    return 0;
+}
+
+/*
+ * Sums up the counters of all lcores into total, and if queues is not NULL, the counters of the lcores
+ * serving each data queue into queues.
+ */
+static void
+sum_lcore_stats(forwarder_counters_t *total, forwarder_counters_t *queues) {
+    const size_t nb_counters = sizeof(forwarder_counters_t) / sizeof(uint64_t);
+    const volatile uint64_t *counters;
+    uint64_t value;
+    unsigned lcore_id;
+    size_t i;
+    int q;
+
+    memset(total, 0, sizeof(*total));
+    if (queues)
+        memset(queues, 0, sizeof(*queues) * nb_data_queues);
+    RTE_LCORE_FOREACH(lcore_id) {
+        counters = (const volatile uint64_t *)&lcore_stats[lcore_id].c;
+        q = lcore_stats[lcore_id].queue_id;
+        for (i = 0; i < nb_counters; i++) {
+            value = counters[i];
+            ((uint64_t *)total)[i] += value;
+            if (queues && q >= 0)
+                ((uint64_t *)&queues[q])[i] += value;
+        }
+    }
+}
+
+static stats_export_t *
+open_stats_export(const char *filename) {
+    stats_export_t *export;
+    int fd;
+
+    fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (unlikely(fd < 0))
+        rte_exit(EXIT_FAILURE, "Cannot open stats file: %s\n", filename);
+    if (unlikely(ftruncate(fd, sizeof(*export))))
+        rte_exit(EXIT_FAILURE, "Cannot resize stats file: %s\n", filename);
+    export = mmap(NULL, sizeof(*export), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (unlikely(export == MAP_FAILED))
+        rte_exit(EXIT_FAILURE, "Cannot mmap stats file: %s\n", filename);
+
+    export->magic = STATS_EXPORT_MAGIC;
+    export->version = STATS_EXPORT_VERSION;
+    export->nb_queues = nb_data_queues;
+    export->hz = rte_get_timer_hz();
+    return export;
+}
+
+// writes a snapshot into the stats file, rates are per second since the previous snapshot
+static void
+publish_stats(uint64_t time_cycles, uint64_t interval_cycles, const forwarder_counters_t *total,
+              const forwarder_counters_t *last_total, const forwarder_counters_t *queues) {
+    const size_t nb_counters = sizeof(forwarder_counters_t) / sizeof(uint64_t);
+    const uint64_t *now = (const uint64_t *)total, *last = (const uint64_t *)last_total;
+    uint64_t *rate = (uint64_t *)&stats_export->rate;
+    uint32_t seq = stats_export->seq;
+    size_t i;
+
+    __atomic_store_n(&stats_export->seq, seq + 1, __ATOMIC_RELAXED);
+    // readers must see the odd seq before any of the new values
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    stats_export->time_cycles = time_cycles;
+    stats_export->interval_cycles = interval_cycles;
+    stats_export->total = *total;
+    for (i = 0; i < nb_counters; i++)
+        rate[i] = interval_cycles ? (now[i] - last[i]) * stats_export->hz / interval_cycles : 0;
+    memcpy(stats_export->queues, queues, sizeof(*queues) * nb_data_queues);
+    __atomic_store_n(&stats_export->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static const char *latency_stage_names[LATENCY_STAGE_MAX] = {
+        [LATENCY_STAGE_RX_FORWARD] = "rx_to_forward",
+        [LATENCY_STAGE_LOOKUP] = "lookup",
+        [LATENCY_STAGE_FORWARD_TX] = "forward_to_tx",
+        [LATENCY_STAGE_RX_EXIT] = "rx_to_exit",
+        [LATENCY_STAGE_CONTROL_PUBLISH] = "control_to_publish",
+        [LATENCY_STAGE_IDLE_WAKEUP] = "idle_wakeup",
+};
+
+// sums up the histograms of all lcores, the counts being written meanwhile may be slightly off
+static void
+sum_latency_hists(latency_hist_t *hists) {
+    unsigned lcore_id, stage, i;
+    const latency_hist_t *hist;
+
+    memset(hists, 0, sizeof(*hists) * LATENCY_STAGE_MAX);
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (!lcore_stats[lcore_id].hist) continue;
+        for (stage = 0; stage < LATENCY_STAGE_MAX; stage++) {
+            hist = &lcore_stats[lcore_id].hist[stage];
+            for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+                hists[stage].count[i] += hist->count[i];
+        }
+    }
+}
+
+static void
+print_latency_hists(const char *label, const latency_hist_t *hists) {
+    const double us_per_cycle = 1e6 / rte_get_timer_hz();
+    unsigned stage;
+    uint64_t total;
+
+    for (stage = 0; stage < LATENCY_STAGE_MAX; stage++) {
+        total = latency_hist_total(&hists[stage]);
+        if (!total) continue;
+        printf("    latency %s %-18s n=%zd p50=%.3fus p99=%.3fus p99.9=%.3fus max=%.3fus\n",
+               label, latency_stage_names[stage], total,
+               latency_hist_percentile(&hists[stage], total, 0.5) * us_per_cycle,
+               latency_hist_percentile(&hists[stage], total, 0.99) * us_per_cycle,
+               latency_hist_percentile(&hists[stage], total, 0.999) * us_per_cycle,
+               latency_hist_percentile(&hists[stage], total, 1.0) * us_per_cycle);
+    }
+}
+
+// prints the percentiles of the samples recorded since the previous call
+static void
+report_latency_hists(void) {
+    static latency_hist_t now[LATENCY_STAGE_MAX], interval[LATENCY_STAGE_MAX];
+    unsigned stage, i;
+
+    sum_latency_hists(now);
+    for (stage = 0; stage < LATENCY_STAGE_MAX; stage++)
+        for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+            interval[stage].count[i] = now[stage].count[i] - interval[stage].count[i];
+    print_latency_hists("interval", interval);
+    memcpy(interval, now, sizeof(now)); // the base of the next interval
+}
+
 static inline void report_status() {
-    uint64_t start_time_cycles = rte_rdtsc_precise();
+    uint64_t start_time_cycles = rte_rdtsc_precise(), last_time_cycles = start_time_cycles;
+    uint64_t last_hist_cycles = start_time_cycles, hist_cycles = rte_get_timer_hz() / 1000 * LATENCY_HIST_REPORT_MS;
+    forwarder_counters_t total, last_total, queues[MAX_DATA_QUEUES], *queue;
+    int q;
+
+    memset(&last_total, 0, sizeof(last_total));
     while(running) {
         uint64_t time_cycles = rte_rdtsc_precise();
+        sum_lcore_stats(&total, queues);
         printf("[%14"PRIu64"] rx_ctrl=%zd rx_data=%zd rx_data_drop=%zd rx_ctrl_drop=%zd sum=%zd tx_drop=%zd tx_drop2=%zd other_pkt=%zd\n",
                 time_cycles - start_time_cycles,
-                received_control_count, received_data_count,
-                rx_dropped_data_count, rx_dropped_control_count,
-                received_control_count + received_data_count + rx_dropped_data_count + rx_dropped_control_count,
-                tx_dropped_data_count, tx_out_dropped_data_count,
-                other_packet_count);
+                total.received_control_count, total.received_data_count,
+                total.rx_dropped_data_count, total.rx_dropped_control_count,
+                total.received_control_count + total.received_data_count + total.rx_dropped_data_count + total.rx_dropped_control_count,
+                total.tx_dropped_data_count, total.tx_out_dropped_data_count,
+                total.other_packet_count + total.lookup_failed_count);
+        if (nb_data_queues > 1) {
+            for (q = 0; q < nb_data_queues; q++) {
+                queue = &queues[q];
+                printf("    q%-2d rx_data=%zd rx_data_drop=%zd tx_drop=%zd tx_drop2=%zd other_pkt=%zd lookup_fail=%zd\n",
+                       q, queue->received_data_count, queue->rx_dropped_data_count,
+                       queue->tx_dropped_data_count, queue->tx_out_dropped_data_count,
+                       queue->other_packet_count, queue->lookup_failed_count);
+            }
+        }
+        if (tx_flush == TX_FLUSH_ADAPTIVE && forward_mode == FORWARD_MODE_PIPELINE) {
+            uint64_t full = total.tx_flush_full_count, early = total.tx_flush_early_count,
+                    timeout = total.tx_flush_timeout_count, flushed = total.tx_flushed_packet_count;
+            printf("    tx_flush=adaptive budget_us=%d full=%zd early=%zd timeout=%zd avg_burst=%.1f\n",
+                   tx_latency_budget_us, full, early, timeout,
+                   full + early + timeout ? (double)flushed / (full + early + timeout) : 0.0);
+        }
+        if (control_admission != CONTROL_ADMISSION_DROP && !flow_steering)
+            printf("    control_admission=%s held=%zd coalesced=%zd\n",
+                   control_admission == CONTROL_ADMISSION_PRIORITY ? "priority" : "coalesce",
+                   total.control_held_count, total.control_coalesced_count);
+        if (idle_policy != IDLE_POLICY_SPIN && time_cycles > last_time_cycles)
+            // lcores asleep on average over the interval
+            printf("    idle sleeps=%zd asleep_lcores=%.2f\n", total.idle_sleep_count,
+                   (double)(total.idle_sleep_cycles - last_total.idle_sleep_cycles) / (time_cycles - last_time_cycles));
+        if (fib_dq) {
+            uint64_t freed_count = fib_reclaim_stats.freed_count;
+            printf("    reclaim depth=%zd freed=%zd stall=%zd avg_cycles=%.1f max_cycles=%zd\n",
+                   fib_reclaim_stats.deferred_count - freed_count, freed_count, fib_reclaim_stats.stall_count,
+                   freed_count ? (double)fib_reclaim_stats.total_reclaim_cycles / freed_count : 0.0,
+                   fib_reclaim_stats.max_reclaim_cycles);
+        }
+        if (latency_hist && time_cycles - last_hist_cycles >= hist_cycles) {
+            report_latency_hists();
+            last_hist_cycles = time_cycles;
+        }
+        if (stats_export)
+            publish_stats(time_cycles - start_time_cycles, time_cycles - last_time_cycles, &total, &last_total, queues);
+        last_total = total;
+        last_time_cycles = time_cycles;
         rte_delay_ms(REPORT_WAIT_MS);
     }
+    if (stats_export)
+        munmap(stats_export, sizeof(*stats_export));
     printf("Core %u (status reporter) finished!\n", rte_lcore_id());
 }
 
 static inline void write_results() {
     uint64_t i;
     control_packet_stat_t *stat = results;
-    uint64_t total_publish_delay = 0;
-
+    uint64_t publish_delay_sum = 0; // total_publish_delay is only summed with --result_stream
+    uint64_t received_control_count;
+    forwarder_counters_t total;
 #ifdef RESULT_PACKETS_FILENAME
-    FILE *output;
+    result_forwarder_control_record_t *record;
+    result_file_map_t map;
+#endif
+    result_mem_event_record_t *mem_record;
+    result_file_map_t mem_map;
+
+    sum_lcore_stats(&total, NULL);
+    received_control_count = total.received_control_count;
+
+    if (result_stream) {
+        close_result_stream(&control_result_stream);
+        close_result_stream(&mem_event_result_stream);
+        mem_event_ring = NULL;
+        printf("publish_delay=%.6f\n", ((double)total_publish_delay) / received_control_count);
+        printf("result_stream_stall_count=%"PRIu64"\n", result_stream_stall_count);
+        return;
+    }
 
-    output = fopen(RESULT_PACKETS_FILENAME, "w");
-    if (unlikely(!output))
-        rte_exit(EXIT_FAILURE, "Cannot open result file: " RESULT_PACKETS_FILENAME "\n");
+#ifdef RESULT_PACKETS_FILENAME
+    record = result_file_create(RESULT_PACKETS_FILENAME, RESULT_RECORD_FORWARDER_CONTROL, sizeof(*record),
+                                received_control_count, rte_get_timer_hz(), &map);
+    if (unlikely(!record))
+        rte_exit(EXIT_FAILURE, "Cannot create result file: " RESULT_PACKETS_FILENAME ": %s\n", strerror(errno));
 #endif
 
     for (i = 0; i < received_control_count; i++, stat++) {
 #ifdef RESULT_PACKETS_FILENAME
-        fprintf(output, "%"PRIu32" %"PRIu16" %"PRIu64" %"PRIu64" %"PRIu64"\n",
-                stat->seq,
-                rte_be_to_cpu_16(stat->node_id),
-                stat->control_time,
-                stat->control_arrive_time_f,
-                stat->publish_time_f);
+        record[i] = (result_forwarder_control_record_t) {
+                .seq = stat->seq,
+                .node_id = rte_be_to_cpu_16(stat->node_id),
+                .control_time = stat->control_time,
+                .control_arrive_time_f = stat->control_arrive_time_f,
+                .publish_time_f = stat->publish_time_f,
+        };
 #endif
-        total_publish_delay += stat->publish_time_f - stat->control_arrive_time_f;
+        publish_delay_sum += stat->publish_time_f - stat->control_arrive_time_f;
     }
 #ifdef RESULT_PACKETS_FILENAME
-    fflush(output);
-    fclose(output);
+    result_file_close(&map);
     printf("File %s finished!\n", RESULT_PACKETS_FILENAME);
 #endif
-    printf("publish_delay=%.6f\n", ((double)total_publish_delay) / received_control_count);
+    printf("publish_delay=%.6f\n", ((double)publish_delay_sum) / received_control_count);
 
-//#if defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED)
-#ifdef TEST_RCU
-    FILE *output_mem;
-    output_mem = fopen(RESULT_RCU_U_FILENAME, "w");
-    if (unlikely(!output_mem))
-        rte_exit(EXIT_FAILURE, "Cannot open rcu mem events file: " RESULT_RCU_U_FILENAME "\n");
+    if (!sync_mode_is_rcu(sync_mode))
+        return;
+
+    mem_record = result_file_create(RESULT_RCU_U_FILENAME, RESULT_RECORD_MEM_EVENT, sizeof(*mem_record),
+                                    mem_event_pos, rte_get_timer_hz(), &mem_map);
+    if (unlikely(!mem_record))
+        rte_exit(EXIT_FAILURE, "Cannot create rcu mem events file: " RESULT_RCU_U_FILENAME ": %s\n", strerror(errno));
 
     for (i = 0; i < mem_event_pos; i++)
-        fprintf(output_mem, "%c %zd\n", mem_events[i].type, mem_events[i].value);
-    fflush(output_mem);
-    fclose(output_mem);
+        mem_record[i] = (result_mem_event_record_t) {.type = mem_events[i].type, .value = mem_events[i].value};
+    result_file_close(&mem_map);
+}
 
-#endif
+/*
+ * --flow_steering: steers the control packets to RX queue nb_data_queues, polled by the control thread,
+ * and the data packets to the data queue (parse_args allows 1 only), so no core classifies them.
+ * Returns 0, or -1 with no rule left on the port.
+ */
+static int
+install_flow_rules(uint16_t port_id) {
+    const struct rte_flow_attr attr = {.ingress = 1};
+    struct rte_flow_item_eth eth_spec, eth_mask;
+    const struct rte_flow_item pattern[] = {
+            {.type = RTE_FLOW_ITEM_TYPE_ETH, .spec = &eth_spec, .mask = &eth_mask},
+            {.type = RTE_FLOW_ITEM_TYPE_END},
+    };
+    const struct rte_flow_action_queue control_queue = {.index = nb_data_queues}, data_queue = {.index = 0};
+    struct rte_flow_action actions[] = {
+            {.type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &control_queue},
+            {.type = RTE_FLOW_ACTION_TYPE_END},
+    };
+    struct rte_flow_error error;
+
+    memset(&eth_spec, 0, sizeof(eth_spec));
+    memset(&eth_mask, 0, sizeof(eth_mask));
+    eth_mask.type = UINT16_MAX;
+
+    // the ether types are compared as they are in the headers, see receive_data_thread
+    eth_spec.type = ETHER_TYPE_CONTROL;
+    if (rte_flow_validate(port_id, &attr, pattern, actions, &error) ||
+        !rte_flow_create(port_id, &attr, pattern, actions, &error))
+        goto fail;
+
+    eth_spec.type = ETHER_TYPE_DATA;
+    actions[0] = (struct rte_flow_action) {.type = RTE_FLOW_ACTION_TYPE_QUEUE, .conf = &data_queue};
+    if (rte_flow_validate(port_id, &attr, pattern, actions, &error) ||
+        !rte_flow_create(port_id, &attr, pattern, actions, &error))
+        goto fail;
+    return 0;
+
+fail:
+    printf("Port %"PRIu16" cannot steer the packets: %s\n", port_id, error.message ? error.message : "unknown error");
+    rte_flow_flush(port_id, &error);
+    return -1;
+}
+
+/*
+ * Starts the data port with 1 RX/TX queue pair per data queue, plus with --flow_steering the control RX queue,
+ * filled from mbuf_pool_control_rx so a backlog of data packets cannot take the mbufs of the control packets.
+ * Clears flow_steering and restarts the port without the control queue if the rules cannot be installed.
+ */
+static void
+init_data_port(struct rte_mempool *mbuf_pool_data_rx, struct rte_mempool *mbuf_pool_control_rx) {
+    uint16_t nb_rxd = data_rx_ring_size, nb_txd = data_tx_ring_size, q;
+    int ret;
+
+    ret = port_init(port_id_data, mbuf_pool_data_rx, data_tx_ring_size, data_rx_ring_size,
+                    nb_data_queues + (flow_steering ? 1 : 0), nb_data_queues + (flow_steering ? 1 : 0), &my_data_mac,
+                    idle_policy == IDLE_POLICY_INTERRUPT);
+    if (unlikely(ret))
+        rte_exit(EXIT_FAILURE, "Cannot init data port %"PRIu16"\n", port_id_data);
+
+    if (flow_steering) {
+        // rules are not guaranteed to survive a restart, the control queue is set up before them
+        if (unlikely(rte_eth_dev_stop(port_id_data) ||
+                     rte_eth_dev_adjust_nb_rx_tx_desc(port_id_data, &nb_rxd, &nb_txd) ||
+                     rte_eth_rx_queue_setup(port_id_data, nb_data_queues, nb_rxd, rte_eth_dev_socket_id(port_id_data),
+                                            NULL, mbuf_pool_control_rx) ||
+                     rte_eth_dev_start(port_id_data)))
+            rte_exit(EXIT_FAILURE, "Cannot set up the control RX queue of port %"PRIu16"\n", port_id_data);
+        if (install_flow_rules(port_id_data)) {
+            printf("Falling back to classifying the packets in software\n");
+            flow_steering = false;
+            rte_eth_dev_stop(port_id_data);
+            ret = port_init(port_id_data, mbuf_pool_data_rx, data_tx_ring_size, data_rx_ring_size,
+                            nb_data_queues, nb_data_queues, &my_data_mac, idle_policy == IDLE_POLICY_INTERRUPT);
+            if (unlikely(ret))
+                rte_exit(EXIT_FAILURE, "Cannot init data port %"PRIu16"\n", port_id_data);
+        } else
+            rte_eth_add_rx_callback(port_id_data, nb_data_queues, rx_callback, NULL);
+    }
+
+    for (q = 0; q < nb_data_queues; q++) {
+        rte_eth_add_tx_callback(port_id_data, q, data_tx_callback, NULL);
+        rte_eth_add_rx_callback(port_id_data, q, rx_callback, NULL);
+    }
+}
+
+/*
+ * Reserves the lcores given by --lcores_rx, --lcores_fwd, --lcores_tx and --lcore_ctrl for their role, before any role is placed automatically.
+ * They must be enabled worker lcores, each given once.
+ */
+static void
+reserve_lcore_list(const lcore_list_t *list, const char *role) {
+    unsigned i, lcore_id;
+
+    for (i = 0; i < list->count; i++) {
+        lcore_id = list->ids[i];
+        if (unlikely(!rte_lcore_is_enabled(lcore_id) || lcore_id == rte_get_main_lcore()))
+            rte_exit(EXIT_FAILURE, "%s lcore %u is not a worker lcore of the EAL\n", role, lcore_id);
+        if (unlikely(lcore_roles[lcore_id]))
+            rte_exit(EXIT_FAILURE, "%s lcore %u is already given to %s\n", role, lcore_id, lcore_roles[lcore_id]);
+        lcore_roles[lcore_id] = role;
+    }
+}
+
+/*
+ * Launch the function on lcore map->ids[index] if the role is mapped (map not NULL and not empty),
+ * otherwise on the first free worker lcore of socket_id, or of any socket if there is none left there
+ * (or socket_id is SOCKET_ID_ANY). Returns the lcore used.
+ */
+static unsigned
+launch_role(lcore_function_t *f, void *arg, const lcore_list_t *map, unsigned index, int socket_id, const char *role) {
+    unsigned lcore_id, remote_lcore_id = RTE_MAX_LCORE;
+    int ret;
 
+    if (map && map->count) { // reserved by reserve_lcore_list
+        lcore_id = map->ids[index];
+        goto launch;
+    }
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (lcore_roles[lcore_id]) continue;
+        if (socket_id == SOCKET_ID_ANY || (int)rte_lcore_to_socket_id(lcore_id) == socket_id)
+            break;
+        if (remote_lcore_id == RTE_MAX_LCORE)
+            remote_lcore_id = lcore_id;
+    }
+    if (lcore_id == RTE_MAX_LCORE)
+        lcore_id = remote_lcore_id;
+    if (unlikely(lcore_id == RTE_MAX_LCORE))
+        rte_exit(EXIT_FAILURE, "%s core required!\n", role);
+
+launch:
+    ret = rte_eal_remote_launch(f, arg, lcore_id);
+    if (unlikely(ret))
+        rte_exit(EXIT_FAILURE, "Failed to launch %s thread\n", role);
+    lcore_roles[lcore_id] = role;
+    return lcore_id;
+}
+
+// reads the integer in a sysfs topology file of cpu, -1 if unavailable
+static int
+read_cpu_topology(int cpu, const char *name) {
+    char path[128];
+    FILE *file;
+    int value = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    file = fopen(path, "r");
+    if (!file)
+        return -1;
+    if (fscanf(file, "%d", &value) != 1)
+        value = -1;
+    fclose(file);
+    return value;
+}
+
+// whether 2 lcores are hyperthreads of the same physical core, they share its L1/L2 caches and execution units
+static bool
+lcores_are_siblings(unsigned lcore_a, unsigned lcore_b) {
+    int cpu_a = rte_lcore_to_cpu_id(lcore_a), cpu_b = rte_lcore_to_cpu_id(lcore_b), core_a;
+
+    if (cpu_a < 0 || cpu_b < 0 || cpu_a == cpu_b)
+        return cpu_a >= 0 && cpu_a == cpu_b;
+    core_a = read_cpu_topology(cpu_a, "core_id");
+    return core_a >= 0 && core_a == read_cpu_topology(cpu_b, "core_id") &&
+           read_cpu_topology(cpu_a, "physical_package_id") == read_cpu_topology(cpu_b, "physical_package_id");
+}
+
+/*
+ * Prints the socket of every launched lcore, the pools, rings and fib are all on data_socket_id.
+ * Data plane and control lcores on another socket reach them (and the port) across the interconnect,
+ * lcores sharing a physical core pollute each other's caches, both are warned about.
+ */
+static void
+report_lcore_placement(void) {
+    unsigned lcore_id, other_lcore_id, nb_remote = 0;
+    int socket_id;
+
+    printf("\nNUMA placement: data port %"PRIu16", pools, rings and fib on socket %d\n", port_id_data, data_socket_id);
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (!lcore_roles[lcore_id]) continue;
+        socket_id = rte_lcore_to_socket_id(lcore_id);
+        if (socket_id != data_socket_id)
+            nb_remote++;
+        printf("  lcore %u on socket %d: %s%s\n", lcore_id, socket_id, lcore_roles[lcore_id],
+               socket_id != data_socket_id ? " (cross-socket)" : "");
+    }
+    if (nb_remote)
+        printf("Warning: %u lcores are not on the socket of the data port, give the EAL more cores of socket %d\n",
+               nb_remote, data_socket_id);
+
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (!lcore_roles[lcore_id]) continue;
+        for (other_lcore_id = lcore_id + 1; other_lcore_id < RTE_MAX_LCORE; other_lcore_id++) {
+            if (lcore_roles[other_lcore_id] && lcores_are_siblings(lcore_id, other_lcore_id))
+                printf("Warning: lcores %u (%s) and %u (%s) are hyperthreads of the same physical core\n",
+                       lcore_id, lcore_roles[lcore_id], other_lcore_id, lcore_roles[other_lcore_id]);
+        }
+    }
 }
 
 int
 main(int argc, char *argv[]) {
     int ret;
-    uint16_t nb_ports;
-    unsigned nb_lcores, receive_lcore_id, forward_lcore_id, send_lcore_id, control_lcore_id;
+    uint16_t nb_ports, q;
+    unsigned nb_lcores, nb_extra_lcores, nb_stage_lcores, lcore_id;
+    unsigned data_receive_ring_flags;
+    char ring_name[RTE_RING_NAMESIZE];
+    data_queue_t *queue;
+    const data_plane_workers_t *workers;
     struct rte_mempool *mbuf_pool_data_rx, *mbuf_pool_control_rx;
+#ifdef IDLE_POWER_MONITOR
+    struct rte_cpu_intrinsics intrinsics;
+#endif
 
     static const struct rte_mbuf_dynfield rx_timestamp_dynfield_desc = {
             .name = "rx_timestamp",
             .size = sizeof(uint64_t),
             .align = __alignof__(uint64_t),
     };
+    static const struct rte_mbuf_dynfield forward_timestamp_dynfield_desc = {
+            .name = "forward_timestamp",
+            .size = sizeof(uint64_t),
+            .align = __alignof__(uint64_t),
+    };
 
     /* Initialize the Environment Abstraction Layer (EAL). */
     ret = rte_eal_init(argc, argv);
@@ -376,127 +1748,240 @@ main(int argc, char *argv[]) {
     if (unlikely(nb_ports < 1))
         rte_exit(EXIT_FAILURE, "Must have at least 1 port, for data and control\n");
 
-    /* Make sure that there are at least 5 lcores available */
+    /* Make sure that there are at least 3 (pipeline) or 1 (run-to-completion) lcores per data queue + 2 (+1 reclaimer, +1 result writer) lcores available */
     nb_lcores = rte_lcore_count();
+    nb_extra_lcores = (fib_reclaim == FIB_RECLAIM_THREAD ? 1 : 0) + (result_stream ? 1 : 0);
     printf("Number of lcores available %u\n", nb_lcores);
-    if (unlikely(nb_lcores < 5))
-        rte_exit(EXIT_FAILURE,
-                 "Must have at least 5 cores, 1 for receive, 1 for data plane process, 1 for control plane process, 1 for (data plane) send, and 1 for stat\n");
+    if (forward_mode == FORWARD_MODE_PIPELINE) {
+        // no receive core with --flow_steering, unless the port cannot steer (checked when they are launched)
+        nb_stage_lcores = flow_steering ? 2 : 3;
+        if (unlikely(nb_lcores < nb_stage_lcores * nb_data_queues + 2 + nb_extra_lcores))
+            rte_exit(EXIT_FAILURE,
+                     "Must have at least %d cores, per data queue 1 for receive (none with --flow_steering), "
+                     "1 for data plane process and 1 for (data plane) send, "
+                     "plus 1 for control plane process, 1 for stat and %u for reclaim and result writing\n",
+                     nb_stage_lcores * nb_data_queues + 2 + nb_extra_lcores, nb_extra_lcores);
+    } else {
+        if (unlikely(nb_lcores < 1u * nb_data_queues + 2 + nb_extra_lcores))
+            rte_exit(EXIT_FAILURE,
+                     "Must have at least %d cores, 1 per data queue for run-to-completion, "
+                     "plus 1 for control plane process, 1 for stat and %u for reclaim and result writing\n",
+                     nb_data_queues + 2 + nb_extra_lcores, nb_extra_lcores);
+    }
     printf("\n");
 
+    /* Place everything the data plane touches on the socket of the data port */
+    port_id_data = rte_eth_find_next_owned_by(0, RTE_ETH_DEV_NO_OWNER);
+    if (unlikely(port_id_data >= RTE_MAX_ETHPORTS))
+        rte_exit(EXIT_FAILURE, "Cannot get data port\n");
+    data_socket_id = rte_eth_dev_socket_id(port_id_data);
+    if (data_socket_id < 0) // unknown, e.g. a virtual device
+        data_socket_id = rte_socket_id();
+    printf("Data port %"PRIu16" on socket %d\n", port_id_data, data_socket_id);
+
+    /* Idle workers sleep with UMONITOR/UMWAIT and TPAUSE, without them they only back off with rte_pause */
+    idle_sleep_cycles = rte_get_timer_hz() * idle_sleep_us / 1000000;
+    if (idle_policy == IDLE_POLICY_MONITOR || idle_policy == IDLE_POLICY_INTERRUPT) {
+#ifdef IDLE_POWER_MONITOR
+        rte_cpu_get_intrinsics_support(&intrinsics);
+        idle_can_sleep = intrinsics.power_monitor && intrinsics.power_pause;
+#endif
+        if (!idle_can_sleep)
+            printf("The CPU or this DPDK cannot monitor or pause, the idle workers %s\n",
+                   idle_policy == IDLE_POLICY_INTERRUPT ? "polling a ring only back off" : "only back off");
+    }
+
     // prepare fib and related data structures
     parse_fib();
     printf("\n");
 
     if (unlikely(signal(SIGINT, sigintHandler) == SIG_ERR))
         rte_exit(EXIT_FAILURE, "Cannot register signal SIGINT handler.\n");
+    if (unlikely(fib_reload && signal(SIGHUP, sighupHandler) == SIG_ERR))
+        rte_exit(EXIT_FAILURE, "Cannot register signal SIGHUP handler.\n");
+
+    /* Initialize space for results, --result_stream writes them while running instead */
+    if (!result_stream) {
+        results = rte_malloc_socket("RESULTS", sizeof(control_packet_stat_t) * control_packet_count, sizeof(void *),
+                                    data_socket_id);
+        if (unlikely(!results))
+            rte_exit(EXIT_FAILURE, "Failed in creating results\n");
+    }
 
-    /* Initialize space for results */
-    results = rte_malloc("RESULTS", sizeof(control_packet_stat_t) * control_packet_count, sizeof(void *));
-    if (unlikely(!results))
-        rte_exit(EXIT_FAILURE, "Failed in creating results\n");
-
-//#if defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED) // only calculate for rcu_u
-#ifdef TEST_RCU
-    mem_event_capacity = control_packet_count * 3;
-    mem_event_pos = 0;
-    mem_events = rte_malloc("EVENTS", sizeof(mem_event_t) * mem_event_capacity, sizeof(void *)); // per control has 1 add, 0/1 free (for the previous entry) and 1 time event
-    if (unlikely(!mem_events))
-        rte_exit(EXIT_FAILURE, "Failed in creating mem_events\n");
-#endif
+    if (!result_stream && sync_mode_is_rcu(sync_mode)) {
+        mem_event_capacity = control_packet_count * 3;
+        mem_event_pos = 0;
+        mem_events = rte_malloc_socket("EVENTS", sizeof(mem_event_t) * mem_event_capacity, sizeof(void *),
+                                       data_socket_id); // per control has 1 add, 0/1 free (for the previous entry) and 1 time event
+        if (unlikely(!mem_events))
+            rte_exit(EXIT_FAILURE, "Failed in creating mem_events\n");
+    }
 
     /* Initialize data packet pool for rx */
     mbuf_pool_data_rx = rte_pktmbuf_pool_create("MBUF_POOL_DATA_RX", RX_POOL_SIZE,
-                                                MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+                                                MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, data_socket_id);
     if (unlikely(!mbuf_pool_data_rx))
         rte_exit(EXIT_FAILURE, "Failed in creating mbuf_pool_data_rx\n");
 
     /* Initialize control packet pool for rx */
     mbuf_pool_control_rx = rte_pktmbuf_pool_create("MBUF_POOL_CTRL_RX", RX_POOL_SIZE,
-                                                   MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+                                                   MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, data_socket_id);
     if (unlikely(!mbuf_pool_control_rx))
         rte_exit(EXIT_FAILURE, "Failed in creating mbuf_pool_control_rx\n");
 
-    /* Initialize ring between rx and data process */
-    data_receive_ring = rte_ring_create("RING_DATA_RX", DATA_RECEIVE_RING_SIZE, rte_socket_id(),
-                                        RING_F_SP_ENQ | RING_F_SC_DEQ);
-    if (unlikely(!data_receive_ring))
-        rte_exit(EXIT_FAILURE, "Failed in creating data_receive_ring\n");
+    /* with more than 1 queue, every receiver may enqueue into every data process and the control process */
+    data_receive_ring_flags = nb_data_queues > 1 ? RING_F_SC_DEQ : RING_F_SP_ENQ | RING_F_SC_DEQ;
+
+    for (q = 0; q < nb_data_queues; q++) {
+        queue = &data_queues[q];
+        queue->queue_id = q;
+        if (forward_mode != FORWARD_MODE_PIPELINE) continue; // no rings between the stages in run-to-completion
+
+        /* Initialize ring between rx and data process */
+        snprintf(ring_name, sizeof(ring_name), "RING_DATA_RX_%"PRIu16, q);
+        queue->data_receive_ring = rte_ring_create(ring_name, DATA_RECEIVE_RING_SIZE, data_socket_id,
+                                                   data_receive_ring_flags);
+        if (unlikely(!queue->data_receive_ring))
+            rte_exit(EXIT_FAILURE, "Failed in creating data_receive_ring of queue %"PRIu16"\n", q);
+
+        /* Initialize ring between data process and data tx */
+        snprintf(ring_name, sizeof(ring_name), "RING_DATA_TX_%"PRIu16, q);
+        queue->data_send_ring = rte_ring_create(ring_name, DATA_SEND_RING_SIZE, data_socket_id,
+                                                RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (unlikely(!queue->data_send_ring))
+            rte_exit(EXIT_FAILURE, "Failed in creating data_send_ring of queue %"PRIu16"\n", q);
+    }
 
-    /* Initialize ring between rx and control process */
-    control_receive_ring = rte_ring_create("RING_CONTROL_RX", CONTROL_RECEIVE_RING_SIZE, rte_socket_id(),
-                                        RING_F_SP_ENQ | RING_F_SC_DEQ);
+    /* Initialize ring between rx and control process, of node IDs whose packet waits in control_slots when coalescing */
+    if (control_admission == CONTROL_ADMISSION_COALESCE) {
+        control_slots = rte_zmalloc_socket("CONTROL_SLOTS", sizeof(struct rte_mbuf *) * FIB_ARRAY_SIZE,
+                                           RTE_CACHE_LINE_SIZE, data_socket_id);
+        if (unlikely(!control_slots))
+            rte_exit(EXIT_FAILURE, "Failed in creating control_slots\n");
+        control_receive_ring = rte_ring_create_elem("RING_CONTROL_RX", sizeof(uint32_t), FIB_ARRAY_SIZE, data_socket_id,
+                                                    data_receive_ring_flags | RING_F_EXACT_SZ);
+    } else
+        control_receive_ring = rte_ring_create("RING_CONTROL_RX", CONTROL_RECEIVE_RING_SIZE, data_socket_id,
+                                               data_receive_ring_flags);
     if (unlikely(!control_receive_ring))
         rte_exit(EXIT_FAILURE, "Failed in creating control_receive_ring\n");
 
-    /* Initialize ring between data process and data tx */
-    data_send_ring = rte_ring_create("RING_DATA_TX", DATA_SEND_RING_SIZE, rte_socket_id(),
-                                     RING_F_SP_ENQ | RING_F_SC_DEQ);
-    if (unlikely(!data_send_ring))
-        rte_exit(EXIT_FAILURE, "Failed in creating data_send_ring\n");
-
     /* register dynamic field rx_timestamp */
     rx_timestamp_dynfield_offset = rte_mbuf_dynfield_register(&rx_timestamp_dynfield_desc);
     if (rx_timestamp_dynfield_offset < 0)
         rte_exit(EXIT_FAILURE, "Cannot register mbuf rx_timestamp_dynfield_offset\n");
 
+    /* register dynamic field forward_timestamp */
+    if (latency_hist) {
+        forward_timestamp_dynfield_offset = rte_mbuf_dynfield_register(&forward_timestamp_dynfield_desc);
+        if (forward_timestamp_dynfield_offset < 0)
+            rte_exit(EXIT_FAILURE, "Cannot register mbuf forward_timestamp_dynfield_offset\n");
+    }
+
+    if (bench_forward_bursts) {
+        bench_forward(mbuf_pool_data_rx);
+        return 0;
+    }
 
     /* Initialize data port */
-    port_id_data = rte_eth_find_next_owned_by(0, RTE_ETH_DEV_NO_OWNER);
-    if (unlikely(port_id_data >= RTE_MAX_ETHPORTS))
-        rte_exit(EXIT_FAILURE, "Cannot get data port\n");
-    port_init(port_id_data, mbuf_pool_data_rx, data_tx_ring_size, data_rx_ring_size, &my_data_mac);
-    rte_eth_add_tx_callback(port_id_data, 0, data_tx_callback, NULL);
-    rte_eth_add_rx_callback(port_id_data, 0, rx_callback, NULL);
+    init_data_port(mbuf_pool_data_rx, mbuf_pool_control_rx);
     printf("\n");
 
-    // start data send lcore
-    send_lcore_id = rte_get_next_lcore(-1, 1, 0);
-    if (unlikely(send_lcore_id == RTE_MAX_LCORE))
-        rte_exit(EXIT_FAILURE, "Send core required!\n");
-    ret = rte_eal_remote_launch(send_data_thread, NULL, send_lcore_id);
-    if (unlikely(ret))
-        rte_exit(EXIT_FAILURE, "Failed to launch send_data_thread\n");
+    for (lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++)
+        lcore_stats[lcore_id].queue_id = -1;
+    if (latency_hist) {
+        RTE_LCORE_FOREACH(lcore_id) {
+            lcore_stats[lcore_id].hist = rte_zmalloc_socket("LATENCY_HIST", sizeof(latency_hist_t) * LATENCY_STAGE_MAX,
+                                                            RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+            if (unlikely(!lcore_stats[lcore_id].hist))
+                rte_exit(EXIT_FAILURE, "Cannot malloc latency histograms of lcore %u\n", lcore_id);
+        }
+    }
+    if (stats_filename)
+        stats_export = open_stats_export(stats_filename);
+    if (result_stream) {
+#ifdef RESULT_PACKETS_FILENAME
+        open_result_stream(&control_result_stream, "RESULT_RING_CONTROL", RESULT_PACKETS_FILENAME,
+                           RESULT_RECORD_FORWARDER_CONTROL, sizeof(result_forwarder_control_record_t),
+                           RING_F_SP_ENQ | RING_F_SC_DEQ);
+#endif
+        if (sync_mode_is_rcu(sync_mode)) {
+            // with a reclaimer lcore, frees are recorded concurrently with the control thread
+            open_result_stream(&mem_event_result_stream, "RESULT_RING_MEM", RESULT_RCU_U_FILENAME,
+                               RESULT_RECORD_MEM_EVENT, sizeof(result_mem_event_record_t),
+                               fib_reclaim == FIB_RECLAIM_THREAD ? RING_F_SC_DEQ : RING_F_SP_ENQ | RING_F_SC_DEQ);
+            mem_event_ring = mem_event_result_stream.ring;
+        }
+        result_stream_producers = fib_reclaim == FIB_RECLAIM_THREAD ? 2 : 1;
+    }
 
-    // start data process lcore
-    forward_lcore_id = rte_get_next_lcore(send_lcore_id, 1, 0);
-    if (unlikely(forward_lcore_id == RTE_MAX_LCORE))
-        rte_exit(EXIT_FAILURE, "Forward core required!\n");
-    ret = rte_eal_remote_launch(forward_data_thread, NULL, forward_lcore_id);
-    if (unlikely(ret))
-        rte_exit(EXIT_FAILURE, "Failed to launch forward_data_thread\n");
+    workers = &data_plane_workers[sync_mode][quiescent_mode][lookup_mode][write_time_after_lookup];
+    if (unlikely(!workers->forward))
+        rte_exit(EXIT_FAILURE, "No data plane worker for this combination of sync mode, quiescent mode and lookup\n");
+
+    // mapped lcores first, so the roles placed automatically do not take them
+    reserve_lcore_list(&lcores_rx, "Receive");
+    reserve_lcore_list(&lcores_fwd, forward_mode == FORWARD_MODE_PIPELINE ? "Forward" : "Run-to-completion");
+    reserve_lcore_list(&lcores_tx, "Send");
+    reserve_lcore_list(&lcore_ctrl, "Control");
+
+    if (forward_mode == FORWARD_MODE_PIPELINE) {
+        // start data send and data process lcores of every queue
+        for (q = 0; q < nb_data_queues; q++) {
+            launch_role(send_data_thread, &data_queues[q], &lcores_tx, q, data_socket_id, "Send");
+            launch_role(workers->forward, &data_queues[q], &lcores_fwd, q, data_socket_id, "Forward");
+        }
 
-    // start control process lcore
-    control_lcore_id = rte_get_next_lcore(forward_lcore_id, 1, 0);
-    if (unlikely(control_lcore_id == RTE_MAX_LCORE))
-        rte_exit(EXIT_FAILURE, "Control core required!\n");
-    ret = rte_eal_remote_launch(control_thread, NULL, control_lcore_id);
-    if (unlikely(ret))
-        rte_exit(EXIT_FAILURE, "Failed to launch control_thread\n");
+        // start control process lcore
+        launch_role(control_thread, NULL, &lcore_ctrl, 0, data_socket_id, "Control");
 
-    // start data receive lcore
-    receive_lcore_id = rte_get_next_lcore(control_lcore_id, 1, 0);
-    if (unlikely(receive_lcore_id == RTE_MAX_LCORE))
-        rte_exit(EXIT_FAILURE, "Receive core required!\n");
-    ret = rte_eal_remote_launch(receive_data_thread, NULL, receive_lcore_id);
-    if (unlikely(ret))
-        rte_exit(EXIT_FAILURE, "Failed to launch receive_data_thread\n");
+        // start data receive lcores, the rules of --flow_steering replace them
+        for (q = 0; q < nb_data_queues && !flow_steering; q++)
+            launch_role(receive_data_thread, &data_queues[q], &lcores_rx, q, data_socket_id, "Receive");
+    } else {
+        // start control process lcore
+        launch_role(control_thread, NULL, &lcore_ctrl, 0, data_socket_id, "Control");
 
+        // start run-to-completion lcores of every queue
+        for (q = 0; q < nb_data_queues; q++)
+            launch_role(workers->run_to_completion, &data_queues[q], &lcores_fwd, q, data_socket_id, "Run-to-completion");
+    }
+
+    if (fib_reclaim == FIB_RECLAIM_THREAD)
+        launch_role(reclaim_thread, NULL, NULL, 0, SOCKET_ID_ANY, "Reclaim");
+    if (result_stream)
+        launch_role(result_writer_thread, NULL, NULL, 0, SOCKET_ID_ANY, "Result writer");
+
+    report_lcore_placement();
     report_status();
     rte_eal_mp_wait_lcore();
+    if (latency_hist) {
+        static latency_hist_t hists[LATENCY_STAGE_MAX];
+
+        sum_latency_hists(hists);
+        print_latency_hists("total", hists);
+    }
     write_results();
-    
-#if defined(TEST_RCU) && !defined(TEST_RCU_PER_PACKET_QUIESCENT)
-    printf("TEST_RCU_PER_BATCH_QUIESCENT\n");
-#endif
-#if defined(TEST_RCU) && defined(TEST_RCU_PER_PACKET_QUIESCENT)
-    printf("TEST_RCU_PER_PACKET_QUIESCENT\n");
-#endif
-#if defined(TEST_RCU) && !defined(TEST_RCU_CONSTRAINED)
-    printf("TEST_RCU_UNCONSTRAINED\n");
-#endif
-#if defined(TEST_RCU) && defined(TEST_RCU_CONSTRAINED)
-    printf("TEST_RCU_CONSTRAINED\n");
-#endif
+
+    printf("FORWARD_MODE_%s\n", forward_mode == FORWARD_MODE_PIPELINE ? "PIPELINE" : "RUN_TO_COMPLETION");
+    printf("TX_FLUSH_%s\n", tx_flush == TX_FLUSH_FIXED ? "FIXED" : "ADAPTIVE");
+    printf("FIB_BACKEND_%s\n", fib_backend == FIB_BACKEND_HASH ? "HASH" : "ARRAY");
+    printf("CONTROL_UPDATE_%s\n", control_update == CONTROL_UPDATE_SINGLE ? "SINGLE" : "BATCH");
+    printf("FIB_RECLAIM_%s\n", fib_reclaim == FIB_RECLAIM_INLINE ? "INLINE" : fib_reclaim == FIB_RECLAIM_IDLE ? "IDLE" : "THREAD");
+    // same labels as the former compile-time macros
+    if (sync_mode_is_rcu(sync_mode))
+        printf(quiescent_mode == QUIESCENT_PER_PACKET ? "TEST_RCU_PER_PACKET_QUIESCENT\n" : "TEST_RCU_PER_BATCH_QUIESCENT\n");
+    if (sync_mode == SYNC_MODE_RCU)
+        printf("TEST_RCU_UNCONSTRAINED\n");
+    if (sync_mode == SYNC_MODE_RCU_CONSTRAINED)
+        printf("TEST_RCU_CONSTRAINED\n");
+    if (sync_mode == SYNC_MODE_SEQLOCK)
+        printf("TEST_SEQLOCK\n");
+    if (sync_mode == SYNC_MODE_RWL)
+        printf("TEST_RWL\n");
+    if (lookup_mode == LOOKUP_BULK)
+        printf("FORWARD_BULK_LOOKUP\n");
+    if (write_time_after_lookup)
+        printf("WRITE_TIME_AFTER_LOOKUP_F\n");
 
 }
\ No newline at end of file
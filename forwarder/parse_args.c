@@ -1,10 +1,33 @@
 #include <getopt.h>
 #include <rte_branch_prediction.h>
 #include <rte_eal.h>
-#include "../common.h"
+#include "common.h"
 
 extern int data_send_burst_size, data_receive_burst_size, data_tx_ring_size, data_rx_ring_size;
 extern int control_receive_burst_size; //, control_tx_ring_size, control_rx_ring_size;
+extern int nb_data_queues;
+extern forward_mode_t forward_mode;
+extern tx_flush_t tx_flush;
+extern int tx_latency_budget_us;
+extern fib_backend_t fib_backend;
+extern int fib_key_len;
+extern control_update_t control_update;
+extern sync_mode_t sync_mode;
+extern fib_reclaim_t fib_reclaim;
+extern quiescent_mode_t quiescent_mode;
+extern lookup_mode_t lookup_mode;
+extern bool write_time_after_lookup;
+extern int bench_forward_bursts;
+extern char *stats_filename;
+extern bool latency_hist;
+extern bool result_stream;
+extern bool fib_reload;
+extern bool flow_steering;
+extern int control_ring_size;
+extern control_admission_t control_admission;
+extern idle_policy_t idle_policy;
+extern int idle_sleep_us;
+extern lcore_list_t lcores_rx, lcores_fwd, lcores_tx, lcore_ctrl;
 extern struct rte_ether_addr receiver_data_mac;
 extern char *forward_list_filename;
 extern long long control_packet_count;
@@ -32,6 +55,16 @@ parse_args(int argc, char **argv);
 #define PARAM_CONTROL_RECEIVE_BURST_SIZE_SHORT "crb"
 #define DEFAULT_CONTROL_RECEIVE_BURST_SIZE 32
 
+#define PARAM_CONTROL_RING_SIZE "control_ring"
+#define PARAM_CONTROL_RING_SIZE_SHORT "cr"
+#define DEFAULT_CONTROL_RING_SIZE 4096
+
+#define PARAM_CONTROL_ADMISSION "control_admission"
+#define PARAM_CONTROL_ADMISSION_SHORT "ca"
+#define CONTROL_ADMISSION_NAME_DROP "drop"
+#define CONTROL_ADMISSION_NAME_PRIORITY "priority"
+#define CONTROL_ADMISSION_NAME_COALESCE "coalesce"
+
 //#define PARAM_CONTROL_TX_RING_SIZE "control_tx_ring"
 //#define PARAM_CONTROL_TX_RING_SIZE_SHORT "ctr"
 //#define DEFAULT_CONTROL_TX_RING_SIZE 256
@@ -49,6 +82,101 @@ parse_args(int argc, char **argv);
 #define PARAM_CONTROL_PACKET_COUNT "control_packet_count"
 #define PARAM_CONTROL_PACKET_COUNT_SHORT "cpc"
 
+#define PARAM_DATA_QUEUES "data_queues"
+#define PARAM_DATA_QUEUES_SHORT "dq"
+#define DEFAULT_DATA_QUEUES 1
+
+#define PARAM_FORWARD_MODE "forward_mode"
+#define PARAM_FORWARD_MODE_SHORT "fm"
+#define FORWARD_MODE_NAME_PIPELINE "pipeline"
+#define FORWARD_MODE_NAME_RUN_TO_COMPLETION "rtc"
+
+#define PARAM_TX_FLUSH "tx_flush"
+#define PARAM_TX_FLUSH_SHORT "tf"
+#define TX_FLUSH_NAME_FIXED "fixed"
+#define TX_FLUSH_NAME_ADAPTIVE "adaptive"
+
+#define PARAM_TX_LATENCY_BUDGET "tx_latency_budget"
+#define PARAM_TX_LATENCY_BUDGET_SHORT "tlb"
+#define DEFAULT_TX_LATENCY_BUDGET_US 10
+
+#define PARAM_FIB_BACKEND "fib_backend"
+#define PARAM_FIB_BACKEND_SHORT "fb"
+#define FIB_BACKEND_NAME_HASH "hash"
+#define FIB_BACKEND_NAME_ARRAY "array"
+
+#define PARAM_FIB_KEY_LEN "fib_key_len"
+#define PARAM_FIB_KEY_LEN_SHORT "fkl"
+
+#define PARAM_CONTROL_UPDATE "control_update"
+#define PARAM_CONTROL_UPDATE_SHORT "cu"
+#define CONTROL_UPDATE_NAME_SINGLE "single"
+#define CONTROL_UPDATE_NAME_BATCH "batch"
+
+#define PARAM_SYNC_MODE "sync_mode"
+#define PARAM_SYNC_MODE_SHORT "sm"
+#define SYNC_MODE_NAME_RWL "rwl"
+#define SYNC_MODE_NAME_RCU "rcu"
+#define SYNC_MODE_NAME_RCU_CONSTRAINED "rcu_constrained"
+#define SYNC_MODE_NAME_SEQLOCK "seqlock"
+
+#define PARAM_QUIESCENT "quiescent"
+#define PARAM_QUIESCENT_SHORT "qs"
+#define QUIESCENT_NAME_PER_BURST "burst"
+#define QUIESCENT_NAME_PER_PACKET "packet"
+
+#define PARAM_LOOKUP "lookup"
+#define PARAM_LOOKUP_SHORT "lk"
+#define LOOKUP_NAME_BULK "bulk"
+#define LOOKUP_NAME_SINGLE "single"
+
+#define PARAM_TIME_AFTER_LOOKUP "time_after_lookup"
+#define PARAM_TIME_AFTER_LOOKUP_SHORT "tal"
+
+#define PARAM_RECLAIM "reclaim"
+#define PARAM_RECLAIM_SHORT "rc"
+#define RECLAIM_NAME_INLINE "inline"
+#define RECLAIM_NAME_IDLE "idle"
+#define RECLAIM_NAME_THREAD "thread"
+
+#define PARAM_BENCH_FORWARD "bench_forward"
+#define PARAM_BENCH_FORWARD_SHORT "bf"
+
+#define PARAM_STATS_FILE "stats_file"
+#define PARAM_STATS_FILE_SHORT "sf"
+
+#define PARAM_LATENCY_HIST "latency_hist"
+#define PARAM_LATENCY_HIST_SHORT "lh"
+
+#define PARAM_RESULT_STREAM "result_stream"
+#define PARAM_RESULT_STREAM_SHORT "rs"
+
+#define PARAM_FIB_RELOAD "fib_reload"
+#define PARAM_FIB_RELOAD_SHORT "fr"
+
+#define PARAM_FLOW_STEERING "flow_steering"
+#define PARAM_FLOW_STEERING_SHORT "fs"
+
+#define PARAM_LCORES_RX "lcores_rx"
+#define PARAM_LCORES_RX_SHORT "lrx"
+#define PARAM_LCORES_FWD "lcores_fwd"
+#define PARAM_LCORES_FWD_SHORT "lfwd"
+#define PARAM_LCORES_TX "lcores_tx"
+#define PARAM_LCORES_TX_SHORT "ltx"
+#define PARAM_LCORE_CTRL "lcore_ctrl"
+#define PARAM_LCORE_CTRL_SHORT "lctrl"
+
+#define PARAM_IDLE_POLICY "idle_policy"
+#define PARAM_IDLE_POLICY_SHORT "ip"
+#define IDLE_POLICY_NAME_SPIN "spin"
+#define IDLE_POLICY_NAME_PAUSE "pause"
+#define IDLE_POLICY_NAME_MONITOR "monitor"
+#define IDLE_POLICY_NAME_INTERRUPT "interrupt"
+
+#define PARAM_IDLE_SLEEP_US "idle_sleep_us"
+#define PARAM_IDLE_SLEEP_US_SHORT "isu"
+#define DEFAULT_IDLE_SLEEP_US 100
+
 #define PARAM_HELP "help"
 
 static const char short_options[] =
@@ -65,11 +193,37 @@ enum {
     CMD_LINE_OPT_DATA_TX_RING_SIZE,
     CMD_LINE_OPT_DATA_RX_RING_SIZE,
     CMD_LINE_OPT_CONTROL_RECEIVE_BURST_SIZE,
+    CMD_LINE_OPT_CONTROL_RING_SIZE,
+    CMD_LINE_OPT_CONTROL_ADMISSION,
 //    CMD_LINE_OPT_CONTROL_TX_RING_SIZE,
 //    CMD_LINE_OPT_CONTROL_RX_RING_SIZE,
     CMD_LINE_OPT_FORWARD_LIST_FILENAME,
     CMD_LINE_OPT_RECEIVER_DATA_MAC,
     CMD_LINE_OPT_CONTROL_PACKET_COUNT,
+    CMD_LINE_OPT_DATA_QUEUES,
+    CMD_LINE_OPT_FORWARD_MODE,
+    CMD_LINE_OPT_TX_FLUSH,
+    CMD_LINE_OPT_TX_LATENCY_BUDGET,
+    CMD_LINE_OPT_FIB_BACKEND,
+    CMD_LINE_OPT_FIB_KEY_LEN,
+    CMD_LINE_OPT_CONTROL_UPDATE,
+    CMD_LINE_OPT_SYNC_MODE,
+    CMD_LINE_OPT_QUIESCENT,
+    CMD_LINE_OPT_LOOKUP,
+    CMD_LINE_OPT_TIME_AFTER_LOOKUP,
+    CMD_LINE_OPT_RECLAIM,
+    CMD_LINE_OPT_BENCH_FORWARD,
+    CMD_LINE_OPT_STATS_FILE,
+    CMD_LINE_OPT_LATENCY_HIST,
+    CMD_LINE_OPT_RESULT_STREAM,
+    CMD_LINE_OPT_FIB_RELOAD,
+    CMD_LINE_OPT_FLOW_STEERING,
+    CMD_LINE_OPT_LCORES_RX,
+    CMD_LINE_OPT_LCORES_FWD,
+    CMD_LINE_OPT_LCORES_TX,
+    CMD_LINE_OPT_LCORE_CTRL,
+    CMD_LINE_OPT_IDLE_POLICY,
+    CMD_LINE_OPT_IDLE_SLEEP_US,
     CMD_LINE_OPT_HELP
 };
 
@@ -84,6 +238,10 @@ static const struct option long_options[] = {
         {PARAM_DATA_RX_RING_SIZE_SHORT,             required_argument, NULL, CMD_LINE_OPT_DATA_RX_RING_SIZE},
         {PARAM_CONTROL_RECEIVE_BURST_SIZE,          required_argument, NULL, CMD_LINE_OPT_CONTROL_RECEIVE_BURST_SIZE},
         {PARAM_CONTROL_RECEIVE_BURST_SIZE_SHORT,    required_argument, NULL, CMD_LINE_OPT_CONTROL_RECEIVE_BURST_SIZE},
+        {PARAM_CONTROL_RING_SIZE,                   required_argument, NULL, CMD_LINE_OPT_CONTROL_RING_SIZE},
+        {PARAM_CONTROL_RING_SIZE_SHORT,             required_argument, NULL, CMD_LINE_OPT_CONTROL_RING_SIZE},
+        {PARAM_CONTROL_ADMISSION,                   required_argument, NULL, CMD_LINE_OPT_CONTROL_ADMISSION},
+        {PARAM_CONTROL_ADMISSION_SHORT,             required_argument, NULL, CMD_LINE_OPT_CONTROL_ADMISSION},
 //        {PARAM_CONTROL_TX_RING_SIZE,                required_argument, NULL, CMD_LINE_OPT_CONTROL_TX_RING_SIZE},
 //        {PARAM_CONTROL_TX_RING_SIZE_SHORT,          required_argument, NULL, CMD_LINE_OPT_CONTROL_TX_RING_SIZE},
 //        {PARAM_CONTROL_RX_RING_SIZE,                required_argument, NULL, CMD_LINE_OPT_CONTROL_RX_RING_SIZE},
@@ -94,6 +252,54 @@ static const struct option long_options[] = {
         {PARAM_RECEIVER_DATA_MAC_SHORT,             required_argument, NULL, CMD_LINE_OPT_RECEIVER_DATA_MAC},
         {PARAM_CONTROL_PACKET_COUNT,                required_argument, NULL, CMD_LINE_OPT_CONTROL_PACKET_COUNT},
         {PARAM_CONTROL_PACKET_COUNT_SHORT,          required_argument, NULL, CMD_LINE_OPT_CONTROL_PACKET_COUNT},
+        {PARAM_DATA_QUEUES,                         required_argument, NULL, CMD_LINE_OPT_DATA_QUEUES},
+        {PARAM_DATA_QUEUES_SHORT,                   required_argument, NULL, CMD_LINE_OPT_DATA_QUEUES},
+        {PARAM_FORWARD_MODE,                        required_argument, NULL, CMD_LINE_OPT_FORWARD_MODE},
+        {PARAM_FORWARD_MODE_SHORT,                  required_argument, NULL, CMD_LINE_OPT_FORWARD_MODE},
+        {PARAM_TX_FLUSH,                            required_argument, NULL, CMD_LINE_OPT_TX_FLUSH},
+        {PARAM_TX_FLUSH_SHORT,                      required_argument, NULL, CMD_LINE_OPT_TX_FLUSH},
+        {PARAM_TX_LATENCY_BUDGET,                   required_argument, NULL, CMD_LINE_OPT_TX_LATENCY_BUDGET},
+        {PARAM_TX_LATENCY_BUDGET_SHORT,             required_argument, NULL, CMD_LINE_OPT_TX_LATENCY_BUDGET},
+        {PARAM_FIB_BACKEND,                         required_argument, NULL, CMD_LINE_OPT_FIB_BACKEND},
+        {PARAM_FIB_BACKEND_SHORT,                   required_argument, NULL, CMD_LINE_OPT_FIB_BACKEND},
+        {PARAM_FIB_KEY_LEN,                         required_argument, NULL, CMD_LINE_OPT_FIB_KEY_LEN},
+        {PARAM_FIB_KEY_LEN_SHORT,                   required_argument, NULL, CMD_LINE_OPT_FIB_KEY_LEN},
+        {PARAM_CONTROL_UPDATE,                      required_argument, NULL, CMD_LINE_OPT_CONTROL_UPDATE},
+        {PARAM_CONTROL_UPDATE_SHORT,                required_argument, NULL, CMD_LINE_OPT_CONTROL_UPDATE},
+        {PARAM_SYNC_MODE,                           required_argument, NULL, CMD_LINE_OPT_SYNC_MODE},
+        {PARAM_SYNC_MODE_SHORT,                     required_argument, NULL, CMD_LINE_OPT_SYNC_MODE},
+        {PARAM_QUIESCENT,                           required_argument, NULL, CMD_LINE_OPT_QUIESCENT},
+        {PARAM_QUIESCENT_SHORT,                     required_argument, NULL, CMD_LINE_OPT_QUIESCENT},
+        {PARAM_LOOKUP,                              required_argument, NULL, CMD_LINE_OPT_LOOKUP},
+        {PARAM_LOOKUP_SHORT,                        required_argument, NULL, CMD_LINE_OPT_LOOKUP},
+        {PARAM_TIME_AFTER_LOOKUP,                   no_argument,       NULL, CMD_LINE_OPT_TIME_AFTER_LOOKUP},
+        {PARAM_TIME_AFTER_LOOKUP_SHORT,             no_argument,       NULL, CMD_LINE_OPT_TIME_AFTER_LOOKUP},
+        {PARAM_RECLAIM,                             required_argument, NULL, CMD_LINE_OPT_RECLAIM},
+        {PARAM_RECLAIM_SHORT,                       required_argument, NULL, CMD_LINE_OPT_RECLAIM},
+        {PARAM_BENCH_FORWARD,                       required_argument, NULL, CMD_LINE_OPT_BENCH_FORWARD},
+        {PARAM_BENCH_FORWARD_SHORT,                 required_argument, NULL, CMD_LINE_OPT_BENCH_FORWARD},
+        {PARAM_STATS_FILE,                          required_argument, NULL, CMD_LINE_OPT_STATS_FILE},
+        {PARAM_STATS_FILE_SHORT,                    required_argument, NULL, CMD_LINE_OPT_STATS_FILE},
+        {PARAM_LATENCY_HIST,                        no_argument,       NULL, CMD_LINE_OPT_LATENCY_HIST},
+        {PARAM_LATENCY_HIST_SHORT,                  no_argument,       NULL, CMD_LINE_OPT_LATENCY_HIST},
+        {PARAM_RESULT_STREAM,                       no_argument,       NULL, CMD_LINE_OPT_RESULT_STREAM},
+        {PARAM_RESULT_STREAM_SHORT,                 no_argument,       NULL, CMD_LINE_OPT_RESULT_STREAM},
+        {PARAM_FIB_RELOAD,                          no_argument,       NULL, CMD_LINE_OPT_FIB_RELOAD},
+        {PARAM_FIB_RELOAD_SHORT,                    no_argument,       NULL, CMD_LINE_OPT_FIB_RELOAD},
+        {PARAM_FLOW_STEERING,                       no_argument,       NULL, CMD_LINE_OPT_FLOW_STEERING},
+        {PARAM_FLOW_STEERING_SHORT,                 no_argument,       NULL, CMD_LINE_OPT_FLOW_STEERING},
+        {PARAM_LCORES_RX,                           required_argument, NULL, CMD_LINE_OPT_LCORES_RX},
+        {PARAM_LCORES_RX_SHORT,                     required_argument, NULL, CMD_LINE_OPT_LCORES_RX},
+        {PARAM_LCORES_FWD,                          required_argument, NULL, CMD_LINE_OPT_LCORES_FWD},
+        {PARAM_LCORES_FWD_SHORT,                    required_argument, NULL, CMD_LINE_OPT_LCORES_FWD},
+        {PARAM_LCORES_TX,                           required_argument, NULL, CMD_LINE_OPT_LCORES_TX},
+        {PARAM_LCORES_TX_SHORT,                     required_argument, NULL, CMD_LINE_OPT_LCORES_TX},
+        {PARAM_LCORE_CTRL,                          required_argument, NULL, CMD_LINE_OPT_LCORE_CTRL},
+        {PARAM_LCORE_CTRL_SHORT,                    required_argument, NULL, CMD_LINE_OPT_LCORE_CTRL},
+        {PARAM_IDLE_POLICY,                         required_argument, NULL, CMD_LINE_OPT_IDLE_POLICY},
+        {PARAM_IDLE_POLICY_SHORT,                   required_argument, NULL, CMD_LINE_OPT_IDLE_POLICY},
+        {PARAM_IDLE_SLEEP_US,                       required_argument, NULL, CMD_LINE_OPT_IDLE_SLEEP_US},
+        {PARAM_IDLE_SLEEP_US_SHORT,                 required_argument, NULL, CMD_LINE_OPT_IDLE_SLEEP_US},
         {PARAM_HELP,                                no_argument,       NULL, CMD_LINE_OPT_HELP},
         {NULL,                                      no_argument,       NULL, 0}
 };
@@ -112,7 +318,64 @@ usage(const char *prgname) {
 //           "    --" PARAM_CONTROL_RX_RING_SIZE "/--" PARAM_CONTROL_RX_RING_SIZE_SHORT " CONTROL_RX_RING_SIZE: rx ring size for control packets, must be > 0 and <= %d\n"
            "    --" PARAM_FORWARD_LIST_FILENAME "/--" PARAM_FORWARD_LIST_FILENAME_SHORT " FORWARD_LIST_FILENAME: filename that stores the list of node IDs to be populated into the FIB, one ID per line\n"
            "    --" PARAM_RECEIVER_DATA_MAC "/--" PARAM_RECEIVER_DATA_MAC_SHORT " FORWARDER_CONTROL_MAC: the ether address of the control port on the forwarder\n"
-           "    --" PARAM_CONTROL_PACKET_COUNT "/--" PARAM_CONTROL_PACKET_COUNT_SHORT " CONTROL_PACKET_COUNT: expected # of control packets, used to save results\n",
+           "    --" PARAM_CONTROL_PACKET_COUNT "/--" PARAM_CONTROL_PACKET_COUNT_SHORT " CONTROL_PACKET_COUNT: expected # of control packets, used to save results, "
+           "not needed with --" PARAM_RESULT_STREAM "\n"
+           "    --" PARAM_DATA_QUEUES "/--" PARAM_DATA_QUEUES_SHORT " DATA_QUEUES: # of RX/TX queue pairs, each with its own receive, forward and send cores, must be > 0 and <= %d\n"
+           "    --" PARAM_FORWARD_MODE "/--" PARAM_FORWARD_MODE_SHORT " FORWARD_MODE: " FORWARD_MODE_NAME_PIPELINE " (default, receive/forward/send on separate cores connected by rings) "
+           "or " FORWARD_MODE_NAME_RUN_TO_COMPLETION " (receive, forward and send on the same core, 1 data queue only)\n"
+           "    --" PARAM_TX_FLUSH "/--" PARAM_TX_FLUSH_SHORT " TX_FLUSH: " TX_FLUSH_NAME_FIXED " (default, send a partial burst after %d us) "
+           "or " TX_FLUSH_NAME_ADAPTIVE " (send a partial burst when it cannot fill within the latency budget at the recent arrival rate), "
+           FORWARD_MODE_NAME_PIPELINE " only\n"
+           "    --" PARAM_TX_LATENCY_BUDGET "/--" PARAM_TX_LATENCY_BUDGET_SHORT " TX_LATENCY_BUDGET: max us from rx to tx a packet may wait for a full burst "
+           "with " TX_FLUSH_NAME_ADAPTIVE ", must be > 0, default %d\n"
+           "    --" PARAM_FIB_BACKEND "/--" PARAM_FIB_BACKEND_SHORT " FIB_BACKEND: " FIB_BACKEND_NAME_HASH " (default, rte_hash keyed by node ID) "
+           "or " FIB_BACKEND_NAME_ARRAY " (array of %d entries directly indexed by node ID)\n"
+           "    --" PARAM_FIB_KEY_LEN "/--" PARAM_FIB_KEY_LEN_SHORT " FIB_KEY_LEN: bytes of the node IDs of the forward list, 2 (default), "
+           "4 or 8 (" FIB_BACKEND_NAME_HASH " only), packets still address IDs up to %d\n"
+           "    --" PARAM_CONTROL_UPDATE "/--" PARAM_CONTROL_UPDATE_SHORT " CONTROL_UPDATE: " CONTROL_UPDATE_NAME_SINGLE " (default, update the fib per control packet) "
+           "or " CONTROL_UPDATE_NAME_BATCH " (update the fib per dequeued burst, coalescing updates of the same node, 1 grace period per burst)\n"
+           "    --" PARAM_CONTROL_RING_SIZE "/--" PARAM_CONTROL_RING_SIZE_SHORT " CONTROL_RING_SIZE: size of the ring from the receive cores to the control core, "
+           "must be a power of 2, default %d\n"
+           "    --" PARAM_CONTROL_ADMISSION "/--" PARAM_CONTROL_ADMISSION_SHORT " CONTROL_ADMISSION: what the receive cores do with control packets "
+           "while that ring is full, " CONTROL_ADMISSION_NAME_DROP " (default), " CONTROL_ADMISSION_NAME_PRIORITY
+           " (hold up to %d of them and retry them first) or " CONTROL_ADMISSION_NAME_COALESCE
+           " (keep only the latest pending one per node, the ring never fills)\n"
+           "    --" PARAM_SYNC_MODE "/--" PARAM_SYNC_MODE_SHORT " SYNC_MODE: " SYNC_MODE_NAME_RCU " (default, RCU unconstrained), "
+           SYNC_MODE_NAME_RCU_CONSTRAINED " (RCU, the control thread waits for every grace period), "
+           SYNC_MODE_NAME_RWL " (reader-writer lock) or " SYNC_MODE_NAME_SEQLOCK " (entries updated in place under a sequence counter)\n"
+           "    --" PARAM_QUIESCENT "/--" PARAM_QUIESCENT_SHORT " QUIESCENT: " QUIESCENT_NAME_PER_BURST " (default) or " QUIESCENT_NAME_PER_PACKET
+           ", how often RCU readers report a quiescent state, " QUIESCENT_NAME_PER_PACKET " requires --" PARAM_LOOKUP " " LOOKUP_NAME_SINGLE "\n"
+           "    --" PARAM_LOOKUP "/--" PARAM_LOOKUP_SHORT " LOOKUP: " LOOKUP_NAME_BULK " (default, 1 fib lookup per burst) or " LOOKUP_NAME_SINGLE " (1 fib lookup per packet)\n"
+           "    --" PARAM_TIME_AFTER_LOOKUP "/--" PARAM_TIME_AFTER_LOOKUP_SHORT ": write the time after the fib lookup into data packets\n"
+           "    --" PARAM_RECLAIM "/--" PARAM_RECLAIM_SHORT " RECLAIM: who frees the replaced fib entries in " SYNC_MODE_NAME_RCU " mode, "
+           RECLAIM_NAME_INLINE " (default, the control thread while updating), " RECLAIM_NAME_IDLE " (the control thread when idle) "
+           "or " RECLAIM_NAME_THREAD " (a dedicated core)\n"
+           "    --" PARAM_BENCH_FORWARD "/--" PARAM_BENCH_FORWARD_SHORT " BENCH_FORWARD_BURSTS: forward BENCH_FORWARD_BURSTS bursts taken from %d synthetic data packets "
+           "on the main core, without and with prefetching, print the cycles per packet and exit, must be >= 0, default 0 (no benchmark)\n"
+           "    --" PARAM_STATS_FILE "/--" PARAM_STATS_FILE_SHORT " STATS_FILE: file memory-mapped by the status reporter, "
+           "rewritten with the counters and their rates every %d ms (stats_export_t), default none\n"
+           "    --" PARAM_LATENCY_HIST "/--" PARAM_LATENCY_HIST_SHORT ": record per-lcore latency histograms of the forwarding stages "
+           "and print their percentiles every %d ms\n"
+           "    --" PARAM_RESULT_STREAM "/--" PARAM_RESULT_STREAM_SHORT ": write the results to disk while running, through rings "
+           "of %d records drained by a dedicated core, instead of keeping them in memory until the end\n"
+           "    --" PARAM_FIB_RELOAD "/--" PARAM_FIB_RELOAD_SHORT ": reload FORWARD_LIST_FILENAME on SIGHUP into a new fib, "
+           "swapped with the current one without stopping the data plane, " SYNC_MODE_NAME_RCU " and " SYNC_MODE_NAME_RCU_CONSTRAINED " only\n"
+           "    --" PARAM_FLOW_STEERING "/--" PARAM_FLOW_STEERING_SHORT ": steer the control packets to their own RX queue, polled by the control core, "
+           "and the data packets to the data queue with rte_flow rules, without receive cores in " FORWARD_MODE_NAME_PIPELINE
+           ", 1 data queue only, falls back to classifying them in software if the port cannot\n"
+           "    --" PARAM_LCORES_RX "/--" PARAM_LCORES_RX_SHORT ", --" PARAM_LCORES_FWD "/--" PARAM_LCORES_FWD_SHORT
+           ", --" PARAM_LCORES_TX "/--" PARAM_LCORES_TX_SHORT " LCORES: receive, forward (run-to-completion in "
+           FORWARD_MODE_NAME_RUN_TO_COMPLETION ") and send lcores, 1 per data queue, e.g. 4-7 or 2,5, "
+           "default: free lcores of the socket of the data port, DATA_QUEUES defaults to the # of forward lcores\n"
+           "    --" PARAM_LCORE_CTRL "/--" PARAM_LCORE_CTRL_SHORT " LCORE: control plane lcore, default: a free lcore of the socket of the data port\n"
+           "    --" PARAM_IDLE_POLICY "/--" PARAM_IDLE_POLICY_SHORT " IDLE_POLICY: what the workers do after %d empty polls, "
+           IDLE_POLICY_NAME_SPIN " (default, keep polling), " IDLE_POLICY_NAME_PAUSE " (back off with up to %d pauses per poll), "
+           IDLE_POLICY_NAME_MONITOR " (back off, then after %d more empty polls sleep until the polled RX descriptor or ring is written) or "
+           IDLE_POLICY_NAME_INTERRUPT " (as " IDLE_POLICY_NAME_MONITOR ", the RX pollers wait for the interrupt of their queue instead)\n"
+           "    --" PARAM_IDLE_SLEEP_US "/--" PARAM_IDLE_SLEEP_US_SHORT " IDLE_SLEEP_US: longest sleep of an idle worker, "
+           "rounded up to 1 ms for the interrupts, default %d. A packet arriving just as a worker falls asleep "
+           "can wait up to IDLE_SLEEP_US in a ring. " IDLE_POLICY_NAME_MONITOR " needs DPDK 21.02 to 21.08 "
+           "and UMONITOR/UMWAIT, otherwise the workers only back off\n",
             prgname,
             UINT16_MAX,
             UINT16_MAX,
@@ -120,10 +383,71 @@ usage(const char *prgname) {
             UINT16_MAX,
 //            UINT16_MAX,
 //            UINT16_MAX,
-            UINT16_MAX
+            UINT16_MAX,
+            MAX_DATA_QUEUES,
+            TX_BURST_PERIOD_US,
+            DEFAULT_TX_LATENCY_BUDGET_US,
+            FIB_ARRAY_SIZE,
+            UINT16_MAX,
+            DEFAULT_CONTROL_RING_SIZE,
+            CONTROL_BACKLOG_SIZE,
+            BENCH_FORWARD_PKTS,
+            REPORT_WAIT_MS,
+            LATENCY_HIST_REPORT_MS,
+            RESULT_STREAM_RING_SIZE,
+            IDLE_SPIN_POLLS,
+            IDLE_PAUSE_MAX,
+            IDLE_PAUSE_POLLS,
+            DEFAULT_IDLE_SLEEP_US
             );
 }
 
+/*
+ * Parses a list of lcores such as 4-7 or 2,5 into list, in the given order (the lcore of data queue q is the qth).
+ * Returns 0, or -1 if it is malformed or longer than MAX_DATA_QUEUES.
+ */
+static int
+parse_lcore_list(const char *arg, lcore_list_t *list) {
+    char *end;
+    unsigned long first, last, id;
+
+    list->count = 0;
+    do {
+        first = last = strtoul(arg, &end, 10);
+        if (end == arg)
+            return -1;
+        if (*end == '-') {
+            arg = end + 1;
+            last = strtoul(arg, &end, 10);
+            if (end == arg || last < first)
+                return -1;
+        }
+        if (last >= RTE_MAX_LCORE)
+            return -1;
+        for (id = first; id <= last; id++) {
+            if (list->count == MAX_DATA_QUEUES)
+                return -1;
+            list->ids[list->count++] = id;
+        }
+        arg = end + 1;
+    } while (*end == ',');
+    return *end ? -1 : 0;
+}
+
+// prints list as parsed, "auto" if empty
+static const char *
+format_lcore_list(char *buf, size_t size, const lcore_list_t *list) {
+    size_t len = 0;
+    unsigned i;
+
+    if (!list->count)
+        return "auto";
+    buf[0] = '\0';
+    for (i = 0; i < list->count && len < size; i++)
+        len += snprintf(buf + len, size - len, i ? ",%u" : "%u", list->ids[i]);
+    return buf;
+}
+
 
 /* Parse the argument given in the command line of the application */
 int
@@ -134,15 +458,40 @@ parse_args(int argc, char **argv) {
     char *prgname = argv[0];
     bool has_receiver_data_mac = false;
     char addr_str_buf[RTE_ETHER_ADDR_FMT_SIZE];
+    bool has_data_queues = false;
+    char lcores_buf[4][MAX_DATA_QUEUES * 4]; // "ddd," per lcore
 
     data_send_burst_size = DEFAULT_DATA_SEND_BURST_SIZE;
     data_receive_burst_size = DEFAULT_DATA_RECEIVE_BURST_SIZE;
     data_tx_ring_size = DEFAULT_DATA_TX_RING_SIZE;
     data_rx_ring_size = DEFAULT_DATA_RX_RING_SIZE;
     control_receive_burst_size = DEFAULT_CONTROL_RECEIVE_BURST_SIZE;
+    control_ring_size = DEFAULT_CONTROL_RING_SIZE;
+    control_admission = CONTROL_ADMISSION_DROP;
+    idle_policy = IDLE_POLICY_SPIN;
+    idle_sleep_us = DEFAULT_IDLE_SLEEP_US;
 //    control_tx_ring_size = DEFAULT_CONTROL_TX_RING_SIZE;
 //    control_rx_ring_size = DEFAULT_CONTROL_RX_RING_SIZE;
     control_packet_count = 0;
+    nb_data_queues = DEFAULT_DATA_QUEUES;
+    forward_mode = FORWARD_MODE_PIPELINE;
+    tx_flush = TX_FLUSH_FIXED;
+    tx_latency_budget_us = DEFAULT_TX_LATENCY_BUDGET_US;
+    fib_backend = FIB_BACKEND_HASH;
+    fib_key_len = sizeof(uint16_t);
+    control_update = CONTROL_UPDATE_SINGLE;
+    sync_mode = SYNC_MODE_RCU;
+    quiescent_mode = QUIESCENT_PER_BURST;
+    lookup_mode = LOOKUP_BULK;
+    write_time_after_lookup = false;
+    fib_reclaim = FIB_RECLAIM_INLINE;
+    bench_forward_bursts = 0;
+    stats_filename = NULL;
+    latency_hist = false;
+    result_stream = false;
+    fib_reload = false;
+    flow_steering = false;
+    lcores_rx.count = lcores_fwd.count = lcores_tx.count = lcore_ctrl.count = 0;
     forward_list_filename = NULL;
 
     argvopt = argv;
@@ -165,6 +514,20 @@ parse_args(int argc, char **argv) {
             case CMD_LINE_OPT_CONTROL_RECEIVE_BURST_SIZE:
                 control_receive_burst_size = atoi(optarg);
                 break;
+            case CMD_LINE_OPT_CONTROL_RING_SIZE:
+                control_ring_size = atoi(optarg);
+                break;
+            case CMD_LINE_OPT_CONTROL_ADMISSION:
+                if (!strcmp(optarg, CONTROL_ADMISSION_NAME_DROP))
+                    control_admission = CONTROL_ADMISSION_DROP;
+                else if (!strcmp(optarg, CONTROL_ADMISSION_NAME_PRIORITY))
+                    control_admission = CONTROL_ADMISSION_PRIORITY;
+                else if (!strcmp(optarg, CONTROL_ADMISSION_NAME_COALESCE))
+                    control_admission = CONTROL_ADMISSION_COALESCE;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_CONTROL_ADMISSION " should be " CONTROL_ADMISSION_NAME_DROP ", "
+                             CONTROL_ADMISSION_NAME_PRIORITY " or " CONTROL_ADMISSION_NAME_COALESCE "\n");
+                break;
 //            case CMD_LINE_OPT_CONTROL_TX_RING_SIZE:
 //                control_tx_ring_size = atoi(optarg);
 //                break;
@@ -183,6 +546,147 @@ parse_args(int argc, char **argv) {
             case CMD_LINE_OPT_CONTROL_PACKET_COUNT:
                 control_packet_count = atoll(optarg);
                 break;
+            case CMD_LINE_OPT_DATA_QUEUES:
+                nb_data_queues = atoi(optarg);
+                has_data_queues = true;
+                break;
+            case CMD_LINE_OPT_FORWARD_MODE:
+                if (!strcmp(optarg, FORWARD_MODE_NAME_PIPELINE))
+                    forward_mode = FORWARD_MODE_PIPELINE;
+                else if (!strcmp(optarg, FORWARD_MODE_NAME_RUN_TO_COMPLETION))
+                    forward_mode = FORWARD_MODE_RUN_TO_COMPLETION;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_FORWARD_MODE " should be " FORWARD_MODE_NAME_PIPELINE
+                             " or " FORWARD_MODE_NAME_RUN_TO_COMPLETION "\n");
+                break;
+            case CMD_LINE_OPT_TX_FLUSH:
+                if (!strcmp(optarg, TX_FLUSH_NAME_FIXED))
+                    tx_flush = TX_FLUSH_FIXED;
+                else if (!strcmp(optarg, TX_FLUSH_NAME_ADAPTIVE))
+                    tx_flush = TX_FLUSH_ADAPTIVE;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_TX_FLUSH " should be " TX_FLUSH_NAME_FIXED
+                             " or " TX_FLUSH_NAME_ADAPTIVE "\n");
+                break;
+            case CMD_LINE_OPT_TX_LATENCY_BUDGET:
+                tx_latency_budget_us = atoi(optarg);
+                break;
+            case CMD_LINE_OPT_FIB_BACKEND:
+                if (!strcmp(optarg, FIB_BACKEND_NAME_HASH))
+                    fib_backend = FIB_BACKEND_HASH;
+                else if (!strcmp(optarg, FIB_BACKEND_NAME_ARRAY))
+                    fib_backend = FIB_BACKEND_ARRAY;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_FIB_BACKEND " should be " FIB_BACKEND_NAME_HASH
+                             " or " FIB_BACKEND_NAME_ARRAY "\n");
+                break;
+            case CMD_LINE_OPT_FIB_KEY_LEN:
+                fib_key_len = atoi(optarg);
+                break;
+            case CMD_LINE_OPT_CONTROL_UPDATE:
+                if (!strcmp(optarg, CONTROL_UPDATE_NAME_SINGLE))
+                    control_update = CONTROL_UPDATE_SINGLE;
+                else if (!strcmp(optarg, CONTROL_UPDATE_NAME_BATCH))
+                    control_update = CONTROL_UPDATE_BATCH;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_CONTROL_UPDATE " should be " CONTROL_UPDATE_NAME_SINGLE
+                             " or " CONTROL_UPDATE_NAME_BATCH "\n");
+                break;
+            case CMD_LINE_OPT_SYNC_MODE:
+                if (!strcmp(optarg, SYNC_MODE_NAME_RWL))
+                    sync_mode = SYNC_MODE_RWL;
+                else if (!strcmp(optarg, SYNC_MODE_NAME_RCU))
+                    sync_mode = SYNC_MODE_RCU;
+                else if (!strcmp(optarg, SYNC_MODE_NAME_RCU_CONSTRAINED))
+                    sync_mode = SYNC_MODE_RCU_CONSTRAINED;
+                else if (!strcmp(optarg, SYNC_MODE_NAME_SEQLOCK))
+                    sync_mode = SYNC_MODE_SEQLOCK;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_SYNC_MODE " should be " SYNC_MODE_NAME_RWL ", " SYNC_MODE_NAME_RCU ", "
+                             SYNC_MODE_NAME_RCU_CONSTRAINED " or " SYNC_MODE_NAME_SEQLOCK "\n");
+                break;
+            case CMD_LINE_OPT_QUIESCENT:
+                if (!strcmp(optarg, QUIESCENT_NAME_PER_BURST))
+                    quiescent_mode = QUIESCENT_PER_BURST;
+                else if (!strcmp(optarg, QUIESCENT_NAME_PER_PACKET))
+                    quiescent_mode = QUIESCENT_PER_PACKET;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_QUIESCENT " should be " QUIESCENT_NAME_PER_BURST
+                             " or " QUIESCENT_NAME_PER_PACKET "\n");
+                break;
+            case CMD_LINE_OPT_LOOKUP:
+                if (!strcmp(optarg, LOOKUP_NAME_BULK))
+                    lookup_mode = LOOKUP_BULK;
+                else if (!strcmp(optarg, LOOKUP_NAME_SINGLE))
+                    lookup_mode = LOOKUP_SINGLE;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_LOOKUP " should be " LOOKUP_NAME_BULK
+                             " or " LOOKUP_NAME_SINGLE "\n");
+                break;
+            case CMD_LINE_OPT_TIME_AFTER_LOOKUP:
+                write_time_after_lookup = true;
+                break;
+            case CMD_LINE_OPT_RECLAIM:
+                if (!strcmp(optarg, RECLAIM_NAME_INLINE))
+                    fib_reclaim = FIB_RECLAIM_INLINE;
+                else if (!strcmp(optarg, RECLAIM_NAME_IDLE))
+                    fib_reclaim = FIB_RECLAIM_IDLE;
+                else if (!strcmp(optarg, RECLAIM_NAME_THREAD))
+                    fib_reclaim = FIB_RECLAIM_THREAD;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_RECLAIM " should be " RECLAIM_NAME_INLINE ", " RECLAIM_NAME_IDLE
+                             " or " RECLAIM_NAME_THREAD "\n");
+                break;
+            case CMD_LINE_OPT_BENCH_FORWARD:
+                bench_forward_bursts = atoi(optarg);
+                break;
+            case CMD_LINE_OPT_STATS_FILE:
+                stats_filename = strdup(optarg);
+                break;
+            case CMD_LINE_OPT_LATENCY_HIST:
+                latency_hist = true;
+                break;
+            case CMD_LINE_OPT_RESULT_STREAM:
+                result_stream = true;
+                break;
+            case CMD_LINE_OPT_FIB_RELOAD:
+                fib_reload = true;
+                break;
+            case CMD_LINE_OPT_FLOW_STEERING:
+                flow_steering = true;
+                break;
+            case CMD_LINE_OPT_LCORES_RX:
+                if (unlikely(parse_lcore_list(optarg, &lcores_rx)))
+                    rte_exit(EXIT_FAILURE, PARAM_LCORES_RX " should be a list of at most %d lcores, e.g. 4-7 or 2,5\n", MAX_DATA_QUEUES);
+                break;
+            case CMD_LINE_OPT_LCORES_FWD:
+                if (unlikely(parse_lcore_list(optarg, &lcores_fwd)))
+                    rte_exit(EXIT_FAILURE, PARAM_LCORES_FWD " should be a list of at most %d lcores, e.g. 4-7 or 2,5\n", MAX_DATA_QUEUES);
+                break;
+            case CMD_LINE_OPT_LCORES_TX:
+                if (unlikely(parse_lcore_list(optarg, &lcores_tx)))
+                    rte_exit(EXIT_FAILURE, PARAM_LCORES_TX " should be a list of at most %d lcores, e.g. 4-7 or 2,5\n", MAX_DATA_QUEUES);
+                break;
+            case CMD_LINE_OPT_LCORE_CTRL:
+                if (unlikely(parse_lcore_list(optarg, &lcore_ctrl) || lcore_ctrl.count != 1))
+                    rte_exit(EXIT_FAILURE, PARAM_LCORE_CTRL " should be 1 lcore\n");
+                break;
+            case CMD_LINE_OPT_IDLE_POLICY:
+                if (!strcmp(optarg, IDLE_POLICY_NAME_SPIN))
+                    idle_policy = IDLE_POLICY_SPIN;
+                else if (!strcmp(optarg, IDLE_POLICY_NAME_PAUSE))
+                    idle_policy = IDLE_POLICY_PAUSE;
+                else if (!strcmp(optarg, IDLE_POLICY_NAME_MONITOR))
+                    idle_policy = IDLE_POLICY_MONITOR;
+                else if (!strcmp(optarg, IDLE_POLICY_NAME_INTERRUPT))
+                    idle_policy = IDLE_POLICY_INTERRUPT;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_IDLE_POLICY " should be " IDLE_POLICY_NAME_SPIN ", " IDLE_POLICY_NAME_PAUSE ", "
+                             IDLE_POLICY_NAME_MONITOR " or " IDLE_POLICY_NAME_INTERRUPT "\n");
+                break;
+            case CMD_LINE_OPT_IDLE_SLEEP_US:
+                idle_sleep_us = atoi(optarg);
+                break;
             case CMD_LINE_OPT_HELP:
                 usage(prgname);
                 rte_exit(EXIT_SUCCESS, "\n");
@@ -192,19 +696,71 @@ parse_args(int argc, char **argv) {
         }
     }
 
+    // 1 forward (or run-to-completion) lcore per data queue
+    if (!has_data_queues && lcores_fwd.count)
+        nb_data_queues = lcores_fwd.count;
+
     printf("data_send_burst_size=%d, "
            "data_receive_burst_size=%d, "
            "data_tx_ring_size=%d, "
            "data_rx_ring_size=%d, "
            "control_receive_burst_size=%d, "
+           "control_ring_size=%d, "
+           "control_admission=%s, "
 //           "control_tx_ring_size=%d, "
 //           "control_rx_ring_size=%d, "
            "control_packet_count=%lld, "
+           "data_queues=%d, "
+           "forward_mode=%s, "
+           "tx_flush=%s, "
+           "tx_latency_budget_us=%d, "
+           "fib_backend=%s, "
+           "fib_key_len=%d, "
+           "control_update=%s, "
+           "sync_mode=%s, "
+           "quiescent=%s, "
+           "lookup=%s, "
+           "time_after_lookup=%d, "
+           "reclaim=%s, "
+           "bench_forward_bursts=%d, "
+           "latency_hist=%d, "
+           "result_stream=%d, "
+           "fib_reload=%d, "
+           "flow_steering=%d, "
+           "lcores_rx=%s, "
+           "lcores_fwd=%s, "
+           "lcores_tx=%s, "
+           "lcore_ctrl=%s, "
+           "idle_policy=%s, "
+           "idle_sleep_us=%d, "
            "\n",
            data_send_burst_size, data_receive_burst_size, data_tx_ring_size, data_rx_ring_size,
-           control_receive_burst_size,
+           control_receive_burst_size, control_ring_size,
+           control_admission == CONTROL_ADMISSION_DROP ? CONTROL_ADMISSION_NAME_DROP :
+           control_admission == CONTROL_ADMISSION_PRIORITY ? CONTROL_ADMISSION_NAME_PRIORITY : CONTROL_ADMISSION_NAME_COALESCE,
 //           control_tx_ring_size, control_rx_ring_size,
-           control_packet_count);
+           control_packet_count, nb_data_queues,
+           forward_mode == FORWARD_MODE_PIPELINE ? FORWARD_MODE_NAME_PIPELINE : FORWARD_MODE_NAME_RUN_TO_COMPLETION,
+           tx_flush == TX_FLUSH_FIXED ? TX_FLUSH_NAME_FIXED : TX_FLUSH_NAME_ADAPTIVE, tx_latency_budget_us,
+           fib_backend == FIB_BACKEND_HASH ? FIB_BACKEND_NAME_HASH : FIB_BACKEND_NAME_ARRAY, fib_key_len,
+           control_update == CONTROL_UPDATE_SINGLE ? CONTROL_UPDATE_NAME_SINGLE : CONTROL_UPDATE_NAME_BATCH,
+           sync_mode == SYNC_MODE_RWL ? SYNC_MODE_NAME_RWL :
+           sync_mode == SYNC_MODE_RCU ? SYNC_MODE_NAME_RCU :
+           sync_mode == SYNC_MODE_RCU_CONSTRAINED ? SYNC_MODE_NAME_RCU_CONSTRAINED : SYNC_MODE_NAME_SEQLOCK,
+           quiescent_mode == QUIESCENT_PER_BURST ? QUIESCENT_NAME_PER_BURST : QUIESCENT_NAME_PER_PACKET,
+           lookup_mode == LOOKUP_BULK ? LOOKUP_NAME_BULK : LOOKUP_NAME_SINGLE,
+           write_time_after_lookup,
+           fib_reclaim == FIB_RECLAIM_INLINE ? RECLAIM_NAME_INLINE :
+           fib_reclaim == FIB_RECLAIM_IDLE ? RECLAIM_NAME_IDLE : RECLAIM_NAME_THREAD,
+           bench_forward_bursts, latency_hist, result_stream, fib_reload, flow_steering,
+           format_lcore_list(lcores_buf[0], sizeof(lcores_buf[0]), &lcores_rx),
+           format_lcore_list(lcores_buf[1], sizeof(lcores_buf[1]), &lcores_fwd),
+           format_lcore_list(lcores_buf[2], sizeof(lcores_buf[2]), &lcores_tx),
+           format_lcore_list(lcores_buf[3], sizeof(lcores_buf[3]), &lcore_ctrl),
+           idle_policy == IDLE_POLICY_SPIN ? IDLE_POLICY_NAME_SPIN :
+           idle_policy == IDLE_POLICY_PAUSE ? IDLE_POLICY_NAME_PAUSE :
+           idle_policy == IDLE_POLICY_MONITOR ? IDLE_POLICY_NAME_MONITOR : IDLE_POLICY_NAME_INTERRUPT,
+           idle_sleep_us);
 
     if (unlikely(data_send_burst_size <= 0 || data_send_burst_size > UINT16_MAX))
         rte_exit(EXIT_FAILURE, PARAM_DATA_SEND_BURST_SIZE " should be > 0 and <= %d\n", UINT16_MAX);
@@ -225,19 +781,79 @@ parse_args(int argc, char **argv) {
     if (unlikely(control_receive_burst_size % 8))
         rte_exit(EXIT_FAILURE, PARAM_CONTROL_RECEIVE_BURST_SIZE " must be divisible by 8\n");
 
+    if (unlikely(control_ring_size <= 0 || !rte_is_power_of_2(control_ring_size)))
+        rte_exit(EXIT_FAILURE, PARAM_CONTROL_RING_SIZE " should be a power of 2\n");
+
 //    if (unlikely(control_tx_ring_size <= 0 || control_tx_ring_size > UINT16_MAX))
 //        rte_exit(EXIT_FAILURE, PARAM_CONTROL_TX_RING_SIZE " should be > 0 and <= %d\n", UINT16_MAX);
 
 //    if (unlikely(control_rx_ring_size <= 0 || control_rx_ring_size > UINT16_MAX))
 //        rte_exit(EXIT_FAILURE, PARAM_CONTROL_RX_RING_SIZE " should be > 0 and <= %d\n", UINT16_MAX);
 
-    if (unlikely(control_packet_count <= 0))
+    if (unlikely(!result_stream && control_packet_count <= 0))
         rte_exit(EXIT_FAILURE, PARAM_CONTROL_PACKET_COUNT " should be > 0\n");
 
+    if (unlikely(nb_data_queues <= 0 || nb_data_queues > MAX_DATA_QUEUES))
+        rte_exit(EXIT_FAILURE, PARAM_DATA_QUEUES " should be > 0 and <= %d\n", MAX_DATA_QUEUES);
+
+    if (unlikely((lcores_rx.count && lcores_rx.count != nb_data_queues) ||
+                 (lcores_fwd.count && lcores_fwd.count != nb_data_queues) ||
+                 (lcores_tx.count && lcores_tx.count != nb_data_queues)))
+        rte_exit(EXIT_FAILURE, PARAM_LCORES_RX ", " PARAM_LCORES_FWD " and " PARAM_LCORES_TX " should have 1 lcore per data queue (%d)\n",
+                 nb_data_queues);
+    // receive, forward and send share the lcore in run-to-completion, given by PARAM_LCORES_FWD
+    if (unlikely(forward_mode == FORWARD_MODE_RUN_TO_COMPLETION && (lcores_rx.count || lcores_tx.count)))
+        rte_exit(EXIT_FAILURE, PARAM_LCORES_RX " and " PARAM_LCORES_TX " only apply to " FORWARD_MODE_NAME_PIPELINE
+                 ", use " PARAM_LCORES_FWD "\n");
+    // a run-to-completion core only forwards what its RX queue gets, and RSS cannot spread our packets over queues
+    if (unlikely(forward_mode == FORWARD_MODE_RUN_TO_COMPLETION && nb_data_queues > 1))
+        rte_exit(EXIT_FAILURE, FORWARD_MODE_NAME_RUN_TO_COMPLETION " needs 1 data queue, the NIC cannot spread "
+                 "the data packets over " PARAM_DATA_QUEUES " (%d), use " FORWARD_MODE_NAME_PIPELINE "\n", nb_data_queues);
+    // the receive cores are only started if the port cannot steer the packets, they are placed automatically then
+    if (unlikely(flow_steering && lcores_rx.count))
+        rte_exit(EXIT_FAILURE, PARAM_LCORES_RX " does not apply to " PARAM_FLOW_STEERING "\n");
+    // without receive cores nothing dispatches the data packets by dst_addr, and no rule can spread them over queues
+    if (unlikely(flow_steering && nb_data_queues > 1))
+        rte_exit(EXIT_FAILURE, PARAM_FLOW_STEERING " needs 1 data queue, the NIC cannot spread "
+                 "the data packets over " PARAM_DATA_QUEUES " (%d)\n", nb_data_queues);
+
+    if (unlikely(tx_latency_budget_us <= 0))
+        rte_exit(EXIT_FAILURE, PARAM_TX_LATENCY_BUDGET " should be > 0\n");
+
+    if (unlikely(idle_sleep_us <= 0))
+        rte_exit(EXIT_FAILURE, PARAM_IDLE_SLEEP_US " should be > 0\n");
+
+    // the bulk lookup holds 1 read-side critical section per burst, cannot report quiescent per packet
+    if (unlikely(quiescent_mode == QUIESCENT_PER_PACKET && lookup_mode == LOOKUP_BULK))
+        rte_exit(EXIT_FAILURE, PARAM_QUIESCENT " " QUIESCENT_NAME_PER_PACKET " requires " PARAM_LOOKUP " " LOOKUP_NAME_SINGLE "\n");
+    if (unlikely(quiescent_mode == QUIESCENT_PER_PACKET && sync_mode != SYNC_MODE_RCU && sync_mode != SYNC_MODE_RCU_CONSTRAINED))
+        rte_exit(EXIT_FAILURE, PARAM_QUIESCENT " only applies to " SYNC_MODE_NAME_RCU " and " SYNC_MODE_NAME_RCU_CONSTRAINED "\n");
+
+    if (unlikely(fib_key_len != sizeof(uint16_t) && fib_key_len != sizeof(uint32_t) && fib_key_len != sizeof(uint64_t)))
+        rte_exit(EXIT_FAILURE, PARAM_FIB_KEY_LEN " should be 2, 4 or 8\n");
+    // the array is indexed by the 16-bit IDs themselves
+    if (unlikely(fib_key_len != sizeof(uint16_t) && fib_backend != FIB_BACKEND_HASH))
+        rte_exit(EXIT_FAILURE, PARAM_FIB_KEY_LEN " 4 and 8 require " PARAM_FIB_BACKEND " " FIB_BACKEND_NAME_HASH "\n");
+
+    // constrained RCU frees right after the grace period, batches are reclaimed by the control thread when idle anyway
+    if (unlikely(fib_reclaim != FIB_RECLAIM_INLINE && (sync_mode != SYNC_MODE_RCU || control_update != CONTROL_UPDATE_SINGLE)))
+        rte_exit(EXIT_FAILURE, PARAM_RECLAIM " only applies to " SYNC_MODE_NAME_RCU " with " PARAM_CONTROL_UPDATE " " CONTROL_UPDATE_NAME_SINGLE "\n");
+
+    // the old fib is freed after a grace period, the other modes have no way to know when readers are done with it
+    if (unlikely(fib_reload && !(sync_mode == SYNC_MODE_RCU || sync_mode == SYNC_MODE_RCU_CONSTRAINED)))
+        rte_exit(EXIT_FAILURE, PARAM_FIB_RELOAD " only applies to " SYNC_MODE_NAME_RCU " and " SYNC_MODE_NAME_RCU_CONSTRAINED "\n");
+
+    if (unlikely(bench_forward_bursts < 0))
+        rte_exit(EXIT_FAILURE, PARAM_BENCH_FORWARD " should be >= 0\n");
+    if (unlikely(bench_forward_bursts && data_receive_burst_size > BENCH_FORWARD_PKTS))
+        rte_exit(EXIT_FAILURE, PARAM_DATA_RECEIVE_BURST_SIZE " should be <= %d with " PARAM_BENCH_FORWARD "\n", BENCH_FORWARD_PKTS);
+
 
     if (unlikely(!forward_list_filename))
         rte_exit(EXIT_FAILURE, "Must specify " PARAM_FORWARD_LIST_FILENAME "\n");
     printf("forward_list_filename=%s\n", forward_list_filename);
+    if (stats_filename)
+        printf("stats_filename=%s\n", stats_filename);
 
     if (unlikely(!has_receiver_data_mac))
         rte_exit(EXIT_FAILURE, "Must specify " PARAM_RECEIVER_DATA_MAC "\n");
@@ -1,4 +1,10 @@
 #include "common.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <rte_cycles.h>
+#include <rte_launch.h>
 
 extern char *forward_list_filename;
 
@@ -6,51 +12,400 @@ int
 parse_fib(void);
 
 int
-parse_fib(void) {
-    FILE *fib_file;
-    char line[MAX_LINE_WIDTH];
-    size_t fib_size = 0;
+reload_fib_table(fib_table_t *table, const fib_table_t *from, unsigned generation);
+
+// node IDs of the forward list, parsed by load_forward_list
+typedef struct {
+    uint64_t *ids;
+    size_t count;
+} forward_list_t;
+
+// part of the forward list parsed (or hashed) by 1 lcore
+typedef struct {
+    const char *begin, *end; // whole lines
+    uint64_t *ids;           // parse: room for (end - begin) / 2 + 1 IDs, hash: the IDs to hash
+    size_t count;
+    uint64_t max_id;
+    const char *error;       // first malformed line, NULL if none
+    const struct rte_hash *hash;
+    hash_sig_t *sigs;        // hash: signatures of ids
+} fib_load_job_t;
+
+static const uint32_t pow10_u32[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+// # of ASCII digits at the start of the 8 characters in chunk (first one in the low byte)
+static __rte_always_inline unsigned
+swar_leading_digits(uint64_t chunk) {
+    uint64_t t = chunk ^ 0x3030303030303030ULL; // only the digits become 0-9
+    uint64_t non_digit = (((t & 0x7f7f7f7f7f7f7f7fULL) + 0x7676767676767676ULL) | t) & 0x8080808080808080ULL;
+
+    return non_digit ? __builtin_ctzll(non_digit) / 8 : 8;
+}
+
+// value of the 8 ASCII digits in chunk, with 3 multiplications instead of 8
+static __rte_always_inline uint32_t
+swar_parse_8_digits(uint64_t chunk) {
+    const uint64_t mask = 0x000000ff000000ffULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8); // pairs of digits
+    return (uint32_t)((((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32);
+}
+
+/*
+ * Parses the digits at p (at least 1) into node_id, 8 at a time while 8 bytes are left before end.
+ * Returns the first character after them, or NULL if the value does not fit in 64 bits.
+ */
+static inline const char *
+parse_node_id(const char *p, const char *end, uint64_t *node_id) {
+    uint64_t value = 0, chunk;
+    unsigned n;
+
+    while (end - p >= (ptrdiff_t)sizeof(chunk)) {
+        memcpy(&chunk, p, sizeof(chunk));
+        chunk = rte_le_to_cpu_64(chunk);
+        n = swar_leading_digits(chunk);
+        if (!n)
+            break;
+        if (n < 8) // move the digits to the high bytes, behind '0's
+            chunk = (chunk << (8 * (8 - n))) | (0x3030303030303030ULL >> (8 * n));
+        if (__builtin_mul_overflow(value, pow10_u32[n], &value) ||
+            __builtin_add_overflow(value, swar_parse_8_digits(chunk), &value))
+            return NULL;
+        p += n;
+        if (n < 8)
+            goto end;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, *p - '0', &value))
+            return NULL;
+    }
+
+end:
+    *node_id = value;
+    return p;
+}
+
+/*
+ * Parses the lines of a job, 1 node ID per line, blank lines are skipped.
+ * Stops at the first line that is not a single ID <= max_id.
+ */
+static int
+parse_forward_list_job(void *arg) {
+    fib_load_job_t *job = arg;
+    const char *p = job->begin, *line;
+    uint64_t node_id;
+
+    job->count = 0;
+    job->error = NULL;
+    while (p < job->end) {
+        line = p;
+        while (p < job->end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p < job->end && *p >= '0' && *p <= '9') {
+            p = parse_node_id(p, job->end, &node_id);
+            if (unlikely(!p || node_id > job->max_id)) {
+                job->error = line;
+                return -1;
+            }
+            job->ids[job->count++] = node_id;
+            while (p < job->end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                p++;
+        } else if (p < job->end && *p == '\r')
+            p++;
+        if (unlikely(p < job->end && *p != '\n')) {
+            job->error = line;
+            return -1;
+        }
+        p++;
+    }
+    return 0;
+}
+
+static int
+hash_forward_list_job(void *arg) {
+    fib_load_job_t *job = arg;
+    fib_key_t key;
+    size_t i;
+
+    for (i = 0; i < job->count; i++)
+        job->sigs[i] = rte_hash_hash(job->hash, fib_key_from_id(&key, job->ids[i]));
+    return 0;
+}
+
+// runs f on the nb_jobs jobs, the first one on the calling lcore and the others on the next worker lcores
+static void
+run_fib_load_jobs(lcore_function_t *f, fib_load_job_t *jobs, unsigned nb_jobs) {
+    unsigned lcore_id = rte_get_next_lcore(-1, 1, 0), i;
+
+    for (i = 1; i < nb_jobs; i++) {
+        if (unlikely(rte_eal_remote_launch(f, &jobs[i], lcore_id)))
+            rte_exit(EXIT_FAILURE, "Failed to launch fib load job %u on lcore %u\n", i, lcore_id);
+        lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
+    }
+    f(&jobs[0]);
+    lcore_id = rte_get_next_lcore(-1, 1, 0);
+    for (i = 1; i < nb_jobs; i++) {
+        rte_eal_wait_lcore(lcore_id);
+        lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
+    }
+}
+
+/*
+ * Maps forward_list_filename and parses it into list, split at line boundaries over nb_jobs lcores
+ * (see run_fib_load_jobs). Returns 0, or -1 (the error is printed).
+ */
+static int
+load_forward_list(forward_list_t *list, unsigned nb_jobs) {
+    fib_load_job_t jobs[nb_jobs];
+    const char *data, *nl;
+    struct stat st;
+    size_t size, offset, count;
+    uint64_t max_id;
+    unsigned i;
+    int fd, ret = -1;
+
+    list->ids = NULL;
+    fd = open(forward_list_filename, O_RDONLY);
+    if (unlikely(fd < 0 || fstat(fd, &st))) {
+        printf("Cannot open forward list file: %s\n", forward_list_filename);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    size = st.st_size;
+    if (unlikely(!size)) {
+        close(fd);
+        printf("Empty forward list file: %s\n", forward_list_filename);
+        return -1;
+    }
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (unlikely(data == MAP_FAILED)) {
+        printf("Cannot mmap forward list file: %s\n", forward_list_filename);
+        return -1;
+    }
+
+    nb_jobs = RTE_MAX(1u, RTE_MIN(nb_jobs, (unsigned)(size / FIB_LOAD_CHUNK_MIN)));
+    list->ids = rte_malloc("FORWARD_LIST", sizeof(uint64_t) * (size / 2 + nb_jobs + 1), 0);
+    if (unlikely(!list->ids)) {
+        printf("Cannot malloc the node IDs of %s\n", forward_list_filename);
+        goto out;
+    }
+
+    // the array is indexed by the 16-bit IDs of the packets
+    max_id = fib_backend == FIB_BACKEND_ARRAY || fib_key_len == sizeof(uint16_t) ? UINT16_MAX :
+             fib_key_len == sizeof(uint32_t) ? UINT32_MAX : UINT64_MAX;
+    for (i = 0; i < nb_jobs; i++) {
+        offset = size / nb_jobs * i;
+        if (i) { // starts after the end of the line around offset
+            nl = memchr(data + offset - 1, '\n', size - offset + 1);
+            jobs[i].begin = RTE_MAX(nl ? nl + 1 : data + size, jobs[i - 1].begin);
+            jobs[i - 1].end = jobs[i].begin;
+        } else
+            jobs[i].begin = data;
+        // a line takes 2 bytes at least, except the last one if it has no '\n'
+        jobs[i].ids = list->ids + (jobs[i].begin - data) / 2 + i;
+        jobs[i].max_id = max_id;
+    }
+    jobs[nb_jobs - 1].end = data + size;
+    run_fib_load_jobs(parse_forward_list_job, jobs, nb_jobs);
+
+    count = 0;
+    for (i = 0; i < nb_jobs; i++) {
+        if (unlikely(jobs[i].error)) {
+            printf("Invalid node ID at byte %zd of %s, should be 1 ID <= %"PRIu64" per line\n",
+                   jobs[i].error - data, forward_list_filename, max_id);
+            goto out;
+        }
+        memmove(list->ids + count, jobs[i].ids, sizeof(uint64_t) * jobs[i].count);
+        count += jobs[i].count;
+    }
+    list->count = count;
+    ret = 0;
+
+out:
+    munmap((void *)data, size);
+    if (ret) {
+        rte_free(list->ids);
+        list->ids = NULL;
+    }
+    return ret;
+}
+
+// hashes the keys of list for table->hash over nb_jobs lcores, into sigs
+static void
+hash_forward_list(const fib_table_t *table, const forward_list_t *list, hash_sig_t *sigs, unsigned nb_jobs) {
+    fib_load_job_t jobs[nb_jobs];
+    size_t per_job;
+    unsigned i;
+
+    nb_jobs = RTE_MAX(1u, RTE_MIN(nb_jobs, (unsigned)(list->count * sizeof(uint64_t) / FIB_LOAD_CHUNK_MIN)));
+    per_job = (list->count + nb_jobs - 1) / nb_jobs;
+    for (i = 0; i < nb_jobs; i++) {
+        jobs[i].ids = list->ids + per_job * i;
+        jobs[i].sigs = sigs + per_job * i;
+        jobs[i].count = RTE_MIN(per_job, list->count - RTE_MIN(list->count, per_job * i));
+        jobs[i].hash = table->hash;
+    }
+    run_fib_load_jobs(hash_forward_list_job, jobs, nb_jobs);
+}
+
+// the fibs of reloads exist alongside the one they replace, their names must differ
+static void
+fib_table_name(char *name, size_t size, const char *prefix, unsigned generation) {
+    if (generation)
+        snprintf(name, size, "%s_%u", prefix, generation);
+    else
+        snprintf(name, size, "%s", prefix);
+}
+
+static void
+free_fib_table(fib_table_t *table) {
+    if (table->hash)
+        rte_hash_free(table->hash);
+    rte_free(table->array);
+    rte_mempool_free(table->entry_pool);
+}
+
+/*
+ * Creates the entry pool and the hash (or array) of table, then adds 1 entry per node ID of the forward list,
+ * loaded over nb_jobs lcores. The nodes already in from (on a reload) keep the content of their entry,
+ * the others start as in a new fib. Returns 0, or -1 with nothing left allocated.
+ */
+static int
+build_fib_table(fib_table_t *table, const fib_table_t *from, unsigned generation, unsigned nb_jobs) {
+    char name[RTE_MEMPOOL_NAMESIZE];
+    forward_list_t list;
+    hash_sig_t *sigs = NULL;
+    size_t pool_size, i;
     fib_entry_t *fib_entry;
-    uint16_t node_id, node_id_be;
+    const fib_entry_t *old_entry;
+    uint64_t start, parsed;
     int ret;
 
-    fib_file = fopen(forward_list_filename, "r");
-    if (unlikely(!fib_file))
-        rte_exit(EXIT_FAILURE, "Cannot open forward list file: %s\n", forward_list_filename);
-
-    printf("reading the file to get counts\n");
-    while (fgets(line, MAX_LINE_WIDTH, fib_file)) {
-        fib_size++;
+    table->hash = NULL;
+    table->array = NULL;
+    table->entry_pool = NULL;
+    start = rte_rdtsc();
+    if (unlikely(load_forward_list(&list, nb_jobs)))
+        return -1;
+    parsed = rte_rdtsc();
+    table->size = list.count;
+    if (unlikely(!table->size)) {
+        printf("No node ID in forward list file: %s\n", forward_list_filename);
+        goto fail;
     }
-    printf("fib_size=%zd\n", fib_size);
+    if (!from) // first fib, sizes fib_dq and the sync of the data plane
+        init_fib(table->size);
 
     printf("creating fib_entry_pool\n");
-    fib_entry_pool = rte_mempool_create("FIB_ENTRIES", fib_entry_pool_size(fib_size), sizeof(fib_entry_t),
-                                        0, 0,
-                                        NULL, NULL,
-                                        NULL, NULL,
-                                        rte_socket_id(),
-                                        MEMPOOL_F_SC_GET | MEMPOOL_F_SP_PUT); // only 1 thread (control) will update the pool
-    if (unlikely(!fib_entry_pool))
-        rte_exit(EXIT_FAILURE, "Cannot create fib_entry_pool");
-    init_hash(fib_size);
-
-    printf("reading the file again to populate the fib\n");
-    rewind(fib_file);
-    while (fgets(line, MAX_LINE_WIDTH, fib_file)) {
-        node_id = (uint16_t) atoi(line);
-        fib_entry = get_new_fib_entry();
-        fib_entry->control_time = fib_entry->control_arrive_time_f = 0;
-        rte_ether_addr_copy(&receiver_data_mac, &fib_entry->receiver_mac);
-        node_id_be = rte_cpu_to_be_16(node_id); // store be in the fib, no need to convert when lookup
-        ret = rte_hash_add_key_data(fib, &node_id_be, fib_entry);
-        if (unlikely(ret))
-            rte_exit(EXIT_FAILURE, "Failed in adding entry to FIB, node_id=%"PRIu16"\n", node_id);
-//        else
-//            printf("added fib_entry: %"PRIu16"\n", node_id);
-    }
-    printf("sizeof fib: %"PRIi32"\n", rte_hash_count(fib));
-    if (unlikely(rte_hash_count(fib) - fib_size)) {
-        rte_exit(EXIT_FAILURE, "size of fib not equal to fib_size, having redundant entries in fib?\n");
+    pool_size = fib_entry_pool_size(table->size);
+    if (fib_dq) // fib_dq was sized after the first fib, it may hold as many entries of this one
+        pool_size = RTE_MAX(pool_size, table->size + fib_dq_size);
+    fib_table_name(name, sizeof(name), "FIB_ENTRIES", generation);
+    table->entry_pool = rte_mempool_create(name, pool_size, sizeof(fib_entry_t),
+                                           0, 0,
+                                           NULL, NULL,
+                                           NULL, NULL,
+                                           data_socket_id,
+                                           MEMPOOL_F_SC_GET | MEMPOOL_F_SP_PUT); // only 1 thread (control) will update the pool
+    if (unlikely(!table->entry_pool)) {
+        printf("Cannot create fib_entry_pool %s\n", name);
+        goto fail;
+    }
+
+    if (fib_backend == FIB_BACKEND_ARRAY) {
+        fib_table_name(name, sizeof(name), "FIB_ARRAY", generation);
+        table->array = create_fib_array(name);
+    } else {
+        fib_table_name(name, sizeof(name), "FIB", generation);
+        table->hash = create_fib_hash(name, table->size);
     }
+    if (unlikely(!table->hash && !table->array))
+        goto fail;
+
+    // rte_hash has no bulk insert: the signatures are computed in parallel, the inserts reuse them
+    if (fib_backend == FIB_BACKEND_HASH) {
+        sigs = rte_malloc("FORWARD_LIST_SIGS", sizeof(hash_sig_t) * table->size, 0);
+        if (unlikely(!sigs)) {
+            printf("Cannot malloc the hashes of %s\n", forward_list_filename);
+            goto fail;
+        }
+        hash_forward_list(table, &list, sigs, nb_jobs);
+    }
+
+    printf("populating the fib\n");
+    for (i = 0; i < table->size; i++) {
+        if (unlikely(rte_mempool_get(table->entry_pool, (void **)&fib_entry))) {
+            printf("Cannot get fib entry from mempool!\n");
+            goto fail;
+        }
+        fib_entry->sc = 0;
+        old_entry = from ? lookup_fib_table(from, list.ids[i]) : NULL;
+        if (old_entry) { // the caller is the control thread, the only writer of the entries
+            rte_ether_addr_copy(&old_entry->receiver_mac, &fib_entry->receiver_mac);
+            fib_entry->seq = old_entry->seq;
+            fib_entry->control_time = old_entry->control_time;
+            fib_entry->control_arrive_time_f = old_entry->control_arrive_time_f;
+        } else {
+            fib_entry->seq = 0;
+            fib_entry->control_time = fib_entry->control_arrive_time_f = 0;
+            rte_ether_addr_copy(&receiver_data_mac, &fib_entry->receiver_mac);
+        }
+        ret = add_fib_entry(table, list.ids[i], sigs ? sigs[i] : 0, fib_entry);
+        if (unlikely(ret)) {
+            printf("Failed in adding entry to FIB, node_id=%"PRIu64"\n", list.ids[i]);
+            goto fail;
+        }
+    }
+    rte_free(sigs);
+    rte_free(list.ids);
+    printf("loaded %zd node IDs: parsed in %.1f ms on %u lcores, hashed and added in %.1f ms\n", table->size,
+           1e3 * (parsed - start) / rte_get_tsc_hz(), nb_jobs, 1e3 * (rte_rdtsc() - parsed) / rte_get_tsc_hz());
+
+    if (fib_backend == FIB_BACKEND_ARRAY) {
+        // redundant entries are already rejected by add_fib_entry
+        printf("sizeof fib: %zd (array of %d slots)\n", table->size, FIB_ARRAY_SIZE);
+        return 0;
+    }
+    printf("sizeof fib: %"PRIi32"\n", rte_hash_count(table->hash));
+    if (unlikely(rte_hash_count(table->hash) - table->size)) {
+        printf("size of fib not equal to fib_size, having redundant entries in fib?\n");
+        free_fib_table(table);
+        return -1;
+    }
+    return 0;
+
+fail:
+    rte_free(sigs);
+    rte_free(list.ids);
+    free_fib_table(table);
+    return -1;
+}
+
+int
+parse_fib(void) {
+    fib_table_t table;
+
+    // nothing runs on the worker lcores yet, they all take a part of the load
+    if (unlikely(build_fib_table(&table, NULL, 0, rte_lcore_count())))
+        rte_exit(EXIT_FAILURE, "Cannot build the fib from %s\n", forward_list_filename);
+
+    fib_entry_pool = table.entry_pool;
+    fib = table.hash;
+    fib_array = table.array;
+    return 0;
+}
+
+/*
+ * Builds a new fib from forward_list_filename, from is the fib it will replace (see reload_fib in main.c).
+ * The workers are busy forwarding, the load runs on the calling (control) lcore only.
+ * Returns 0, or -1 (the error is printed) and the current fib stays in use.
+ */
+int
+reload_fib_table(fib_table_t *table, const fib_table_t *from, unsigned generation) {
+    return build_fib_table(table, from, generation, 1);
 }
@@ -0,0 +1,249 @@
+#ifndef __RESULT_FILE_H
+#define __RESULT_FILE_H
+
+/*
+ * Binary result files of the sender and the forwarder: a result_file_header_t followed by record_count
+ * fixed-size records, all in the byte order of the machine that wrote them.
+ * Written and read through mmap, plain C so the calculator (C++) can include it too.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RESULT_FILE_MAGIC "FWDRSLT" // 8 bytes with the terminating '\0'
+#define RESULT_FILE_VERSION 1
+
+typedef enum {
+    RESULT_RECORD_SENDER_PACKET = 1, // result_sender_record_t
+    RESULT_RECORD_FORWARDER_CONTROL = 2, // result_forwarder_control_record_t
+    RESULT_RECORD_MEM_EVENT = 3, // result_mem_event_record_t
+} result_record_type_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_type;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t record_count;
+    uint64_t hz; // of the timestamps in the records, 0 if unknown
+    uint8_t padding[24]; // records start at a cache line
+} result_file_header_t;
+
+// 1 per packet sent, same fields as the text format: the data fields are 0 for control packets
+typedef struct {
+    uint8_t is_control;
+    uint8_t reserved;
+    uint16_t dst_id; // host order
+    uint32_t reserved2;
+    uint64_t time_send;
+    uint64_t time_receive; // 0 if the data packet was dropped
+    uint64_t time_control;
+    uint64_t time_control_arrive_f;
+    uint64_t time_arrive_f;
+    uint64_t time_after_lookup_f;
+    uint64_t time_exit_f;
+} result_sender_record_t;
+
+// 1 per control packet handled by the forwarder
+typedef struct {
+    uint32_t seq;
+    uint16_t node_id; // host order
+    uint16_t reserved;
+    uint64_t control_time;
+    uint64_t control_arrive_time_f;
+    uint64_t publish_time_f;
+} result_forwarder_control_record_t;
+
+// 1 per memory event of the forwarder (A: allocate, F: free, T: control timestamp)
+typedef struct {
+    char type;
+    uint8_t reserved[7];
+    uint64_t value;
+} result_mem_event_record_t;
+
+typedef struct {
+    void *base;
+    size_t size;
+} result_file_map_t;
+
+/*
+ * Creates filename sized for record_count records and maps it, returns the first record or NULL
+ * (errno set). The header is written, the caller fills in the records then calls result_file_close.
+ */
+static inline void *
+result_file_create(const char *filename, uint32_t record_type, uint32_t record_size, uint64_t record_count,
+                   uint64_t hz, result_file_map_t *map) {
+    result_file_header_t *header;
+    int fd, err;
+
+    map->size = sizeof(result_file_header_t) + (size_t)record_size * record_count;
+    fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, map->size)) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    map->base = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if (map->base == MAP_FAILED) {
+        errno = err;
+        return NULL;
+    }
+
+    header = (result_file_header_t *)map->base;
+    memcpy(header->magic, RESULT_FILE_MAGIC, sizeof(header->magic));
+    header->version = RESULT_FILE_VERSION;
+    header->record_type = record_type;
+    header->record_size = record_size;
+    header->record_count = record_count;
+    header->hz = hz;
+    return header + 1;
+}
+
+/*
+ * Maps filename read-only, returns its header or NULL: errno is set if the file cannot be mapped,
+ * errno is 0 if it is not a result file (e.g. an old text result).
+ * Records of another type, size or version are rejected with EINVAL, record_type 0 accepts any type
+ * (and any record_size).
+ */
+static inline const result_file_header_t *
+result_file_open(const char *filename, uint32_t record_type, uint32_t record_size, result_file_map_t *map) {
+    const result_file_header_t *header;
+    struct stat st;
+    int fd, err;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st)) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(result_file_header_t)) {
+        close(fd);
+        errno = 0;
+        return NULL;
+    }
+    map->size = st.st_size;
+    map->base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    err = errno;
+    close(fd);
+    if (map->base == MAP_FAILED) {
+        errno = err;
+        return NULL;
+    }
+
+    header = (const result_file_header_t *)map->base;
+    if (memcmp(header->magic, RESULT_FILE_MAGIC, sizeof(header->magic))) {
+        munmap(map->base, map->size);
+        errno = 0;
+        return NULL;
+    }
+    if (!record_type)
+        record_size = header->record_size;
+    if (header->version != RESULT_FILE_VERSION || (record_type && header->record_type != record_type) ||
+        !record_size || header->record_size != record_size ||
+        header->record_count > (map->size - sizeof(result_file_header_t)) / record_size) {
+        munmap(map->base, map->size);
+        errno = EINVAL;
+        return NULL;
+    }
+    return header;
+}
+
+static inline int
+result_file_close(result_file_map_t *map) {
+    return munmap(map->base, map->size);
+}
+
+// a result file written while the records are produced, for runs whose # of records is not known in advance
+typedef struct {
+    int fd;
+    uint32_t record_size;
+    uint64_t record_count; // appended so far
+} result_file_stream_t;
+
+/*
+ * Creates filename with a header and no record, returns 0 or -1 (errno set).
+ * The records are then added with result_file_stream_append.
+ */
+static inline int
+result_file_stream_open(result_file_stream_t *stream, const char *filename, uint32_t record_type,
+                        uint32_t record_size, uint64_t hz) {
+    result_file_header_t header;
+    ssize_t ret;
+    int err;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic));
+    header.version = RESULT_FILE_VERSION;
+    header.record_type = record_type;
+    header.record_size = record_size;
+    header.hz = hz;
+
+    stream->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (stream->fd < 0)
+        return -1;
+    ret = write(stream->fd, &header, sizeof(header));
+    if (ret != (ssize_t)sizeof(header)) {
+        err = ret < 0 ? errno : EIO;
+        close(stream->fd);
+        errno = err;
+        return -1;
+    }
+    stream->record_size = record_size;
+    stream->record_count = 0;
+    return 0;
+}
+
+/*
+ * Appends count records then updates record_count in the header, so the file stays readable
+ * (up to the last append) if the writer is killed. Returns 0 or -1 (errno set).
+ */
+static inline int
+result_file_stream_append(result_file_stream_t *stream, const void *records, uint64_t count) {
+    const char *p = (const char *)records;
+    size_t left = (size_t)stream->record_size * count;
+    ssize_t ret;
+
+    while (left) {
+        ret = write(stream->fd, p, left);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += ret;
+        left -= ret;
+    }
+    stream->record_count += count;
+    ret = pwrite(stream->fd, &stream->record_count, sizeof(stream->record_count),
+                 offsetof(result_file_header_t, record_count));
+    if (ret != (ssize_t)sizeof(stream->record_count)) {
+        if (ret >= 0)
+            errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+static inline int
+result_file_stream_close(result_file_stream_t *stream) {
+    return close(stream->fd);
+}
+
+#endif //__RESULT_FILE_H
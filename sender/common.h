@@ -2,16 +2,45 @@
 #define __SENDER_COMMON_H
 
 #define RATE_CONTROL
-#define RESULT_FILENAME "result_sender.txt" // comment if do not want to output result
+#define RESULT_FILENAME "result_sender.bin" // comment if do not want to output result, see ../result_file.h
+#define SEARCH_FILENAME "search_sender.csv" // comment if do not want to output the rate/latency of each search trial
 
 #define REPORT_WAIT_MS 500
 #define WAIT_AFTER_FINISH_MS 5000
+#define SEND_POOL_WAIT_MS 1000 // --send_pool: longest wait for the NIC to give back mbufs before giving up
 #define RX_POOL_SIZE 16383
+#define RX_QUEUE 0 // the returning packets cannot be told apart by RSS, they all come on 1 RX queue
+#define MAX_SEND_QUEUES 16
 
 #include "../common.h"
+#include "../result_file.h"
 #include <rte_eal.h>
 
 #define WARMUP_SIZE(data_send_burst_size) ((data_send_burst_size) * 4)
+// mbufs to fill the 2 RX rings port_init sets up, plus a burst being received and the pool cache
+#define RX_POOL_SIZE_MIN(data_rx_ring_size, data_receive_burst_size) \
+    ((data_rx_ring_size) * 2 + (data_receive_burst_size) + MBUF_CACHE_SIZE * 2)
+// --send_pool: mbufs the NIC may hold (TX ring, bursts being built) plus the pool cache, per send lcore
+#define SEND_POOL_SIZE_MIN(data_tx_ring_size, data_send_burst_size, send_queues) \
+    (((data_tx_ring_size) + (data_send_burst_size) * 2 + MBUF_CACHE_SIZE * 2) * (send_queues))
+
+#ifdef RATE_CONTROL
+#define PACE_ERROR_BUCKETS 40 // bucket k: inter-departure errors of < 2^k ns (bucket 0: < 1ns)
+#define SEARCH_RESOLUTION 0.001 // --search_trials: stop once the highest rate is known within 0.1%
+
+// --pacing: how the departure time of each packet is scheduled
+typedef enum {
+    PACING_CONSTANT, // 1 packet every cycles_per_packet
+    PACING_POISSON, // exponential inter-departure times of cycles_per_packet on average
+    PACING_TRACE, // the inter-departure times in the 3rd column of the trace
+} pacing_mode_t;
+#endif
+
+// --send_pool: 1 packet of the trace, built from it when it is sent
+typedef struct {
+    uint16_t dst_id; // be order
+    uint8_t is_control;
+} trace_entry_t;
 
 typedef struct {
     uint64_t time_receive;
@@ -36,4 +65,14 @@ typedef struct {
     };
 } packet_stat_t;
 
+// counters of 1 TX queue, written by its send lcore
+typedef struct {
+    volatile uint64_t sent_packets, batches, batches_at_tx_callback;
+} __rte_cache_aligned tx_queue_stats_t;
+
+// counters of the RX queue, written by the receive lcore
+typedef struct {
+    volatile uint64_t receive_error_type, receive_error_seq, receive_redundant, receive_data;
+} __rte_cache_aligned rx_queue_stats_t;
+
 #endif //__SENDER_COMMON_H
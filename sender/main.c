@@ -1,5 +1,9 @@
 #include "common.h"
 #include <stdio.h>
+#include <stdlib.h>
+#ifdef RATE_CONTROL
+#include <math.h>
+#endif
 
 int parse_args(int argc, char **argv);
 
@@ -14,8 +18,18 @@ struct rte_ether_addr my_data_mac, my_control_mac, forwarder_data_mac, forwarder
 struct rte_mempool *mbuf_pool_control_tx, *mbuf_pool_data_tx;
 struct rte_mbuf **trace_packets;
 packet_stat_t *results;
+int send_pool_size; // 0: every packet of the trace is built in its own mbuf before sending
+struct rte_mempool *mbuf_pool_tx;
+trace_entry_t *trace;
+size_t trace_length; // before the repeats
+int send_queues;
 #ifdef RATE_CONTROL
 uint64_t cycles_per_packet;
+pacing_mode_t pacing;
+// --pacing poisson/trace: departure of each packet of the trace in cycles after the 1st one, and of the next pass
+uint64_t *pace_offsets, pace_period;
+int search_trials; // 0: 1 run at --mpps
+double search_loss; // in %
 #endif
 
 
@@ -25,11 +39,105 @@ static uint64_t start_time_cycles;
 
 static volatile bool sending = true;
 static volatile int final_wait = WAIT_AFTER_FINISH_MS;
-static volatile uint64_t sent_packets = 0, remaining_send = 0;
-static volatile uint64_t receive_error_type = 0, receive_error_seq = 0, receive_redundant = 0, receive_data = 0;
-static volatile uint64_t batches_at_tx_callback = 0;
+static volatile uint64_t next_seq = 0; // first packet of the trace not claimed by a send lcore yet
+// seq in the packets of packet 0 of the trace, --search_trials: trial * total_packet_count so each trial has its own
+static uint32_t seq_base;
+static volatile uint64_t send_start_cycles = 0; // set once the warmup is done, the send lcores wait for it
+static volatile unsigned running_senders;
+static tx_queue_stats_t tx_queue_stats[MAX_SEND_QUEUES];
+static rx_queue_stats_t rx_stats;
+// --send_pool: packets as sent but seq and dst_addr, copied into the recycled mbufs
+static uint8_t data_template[DATA_PKT_SIZE], control_template[CONTROL_PKT_SIZE], warmup_template[DATA_PKT_SIZE];
+
 #ifdef RATE_CONTROL
-static volatile uint64_t time_last_sent = 0;
+// departure time of packet seq in cycles after send_start_cycles
+static inline uint64_t
+departure_offset(uint64_t seq) {
+    if (pacing == PACING_CONSTANT)
+        return seq * cycles_per_packet;
+    return seq / trace_length * pace_period + pace_offsets[seq % trace_length];
+}
+
+/*
+ * # of the nb packets from seq on whose departure time has come, now is in cycles after send_start_cycles.
+ * The departure times only grow with seq, so the packets due are the first ones.
+ */
+static __rte_always_inline uint64_t
+packets_due(uint64_t seq, uint64_t nb, uint64_t now) {
+    uint64_t base, due;
+    size_t pos;
+
+    if (pacing == PACING_CONSTANT) {
+        // packet seq leaves at seq * cycles_per_packet, so those up to now / cycles_per_packet are due
+        due = now / cycles_per_packet + 1;
+        return due > seq ? MIN(nb, due - seq) : 0;
+    }
+    base = seq / trace_length * pace_period;
+    pos = seq % trace_length;
+    for (due = 0; due < nb && base + pace_offsets[pos] <= now; due++) {
+        if (unlikely(++pos == trace_length)) {
+            pos = 0;
+            base += pace_period;
+        }
+    }
+    return due;
+}
+
+// # of packets of the trace due by now, in cycles after send_start_cycles, in any --pacing
+static uint64_t
+packets_due_by(uint64_t now) {
+    uint64_t low = 0, high = total_packet_count, mid;
+
+    // the first packet whose departure is after now, departure_offset only grows with seq
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (departure_offset(mid) <= now)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/*
+ * Histogram of the inter-departure errors: the time between the tx_burst of 2 consecutive packets
+ * minus the one scheduled, so how bursty the sending was compared to the schedule of --pacing.
+ */
+static void
+report_pacing_error(void) {
+    uint64_t buckets[PACE_ERROR_BUCKETS] = {0};
+    uint64_t i, count = 0, late_sum = 0, error_ns, cumulated = 0;
+    int64_t error, error_sum = 0, late;
+    double ns_per_cycle = 1000000000.0 / rte_get_timer_hz();
+    int bucket;
+
+    for (i = 1; i < total_packet_count; i++) {
+        if (unlikely(!results[i].time_send || !results[i - 1].time_send))
+            continue;
+        error = (int64_t) (results[i].time_send - results[i - 1].time_send) -
+                (int64_t) (departure_offset(i) - departure_offset(i - 1));
+        error_sum += error;
+        late = (int64_t) (results[i].time_send - send_start_cycles - departure_offset(i));
+        if (late > 0)
+            late_sum += late;
+        count++;
+        error_ns = (uint64_t) (llabs(error) * ns_per_cycle);
+        bucket = error_ns ? 64 - __builtin_clzll(error_ns) : 0;
+        buckets[RTE_MIN(bucket, PACE_ERROR_BUCKETS - 1)]++;
+    }
+    if (!count)
+        return;
+    printf("inter-departure error: count=%"PRIu64" mean=%.3fns mean_late=%.3fns\n",
+           count, error_sum * ns_per_cycle / count, late_sum * ns_per_cycle / count);
+    for (bucket = 0; bucket < PACE_ERROR_BUCKETS; bucket++) {
+        if (!buckets[bucket])
+            continue;
+        cumulated += buckets[bucket];
+        printf("  |error| < %"PRIu64"ns%s: %"PRIu64" (%.3f%%, cumulated %.3f%%)\n",
+               (uint64_t) 1 << bucket, bucket == PACE_ERROR_BUCKETS - 1 ? " or more" : "", buckets[bucket],
+               100.0 * buckets[bucket] / count, 100.0 * cumulated / count);
+    }
+}
 #endif
 
 static inline
@@ -38,19 +146,25 @@ void calculate_statistics() {
     uint64_t data_rtt_sum = 0, data_on_forwarder_sum = 0, data_rx_count = 0;
     uint64_t i;
 #ifdef RESULT_FILENAME
-    FILE *output;
+    result_sender_record_t *record;
+    result_file_map_t map;
 #endif
     packet_stat_t *stat = results;
 
 #ifdef RESULT_FILENAME
-    output = fopen(RESULT_FILENAME, "w");
+    record = result_file_create(RESULT_FILENAME, RESULT_RECORD_SENDER_PACKET, sizeof(*record),
+                                total_packet_count, rte_get_timer_hz(), &map);
+    if (unlikely(!record))
+        rte_exit(EXIT_FAILURE, "Cannot create result file: " RESULT_FILENAME ": %s\n", strerror(errno));
 #endif
     for (i = 0; i < total_packet_count; i++, stat++) {
         if (stat->is_control) {
 #ifdef RESULT_FILENAME
-            fprintf(output, "1 %"PRIu16" %zd\n",
-                    rte_be_to_cpu_16(stat->dst_id),
-                    stat->time_send);
+            record[i] = (result_sender_record_t) {
+                    .is_control = 1,
+                    .dst_id = rte_be_to_cpu_16(stat->dst_id),
+                    .time_send = stat->time_send,
+            };
 #endif
         } else {
             data_tx_count++;
@@ -60,18 +174,22 @@ void calculate_statistics() {
                 data_rx_count++;
             }
 #ifdef RESULT_FILENAME
-            fprintf(output, "0 %"PRIu16" %zd %zd %zd %zd %zd %zd %zd\n",
-                    rte_be_to_cpu_16(stat->dst_id),
-                    stat->time_send, stat->data.time_receive,
-                    stat->data.time_control, stat->data.time_control_arrive_f,
-                    stat->data.time_arrive_f, stat->data.time_after_lookup_f,
-                    stat->data.time_exit_f);
+            record[i] = (result_sender_record_t) {
+                    .is_control = 0,
+                    .dst_id = rte_be_to_cpu_16(stat->dst_id),
+                    .time_send = stat->time_send,
+                    .time_receive = stat->data.time_receive,
+                    .time_control = stat->data.time_control,
+                    .time_control_arrive_f = stat->data.time_control_arrive_f,
+                    .time_arrive_f = stat->data.time_arrive_f,
+                    .time_after_lookup_f = stat->data.time_after_lookup_f,
+                    .time_exit_f = stat->data.time_exit_f,
+            };
 #endif
         }
     }
 #ifdef RESULT_FILENAME
-    fflush(output);
-    fclose(output);
+    result_file_close(&map);
     printf("File %s finished!\n", RESULT_FILENAME);
 #endif
     printf("data_rtt_sum=%zd data_on_forwarder_sum=%zd data_rx_count=%zd data_tx_count=%zd\n",
@@ -79,104 +197,222 @@ void calculate_statistics() {
     printf("data_rtt=%.6f data_on_forwarder=%.6f\n",
            ((double) data_rtt_sum) / data_rx_count,
            ((double) data_on_forwarder_sum) / data_rx_count);
+#ifdef RATE_CONTROL
+    report_pacing_error();
+#endif
+}
+
+static void
+init_packet_template(uint8_t *template, const struct rte_ether_addr *s_addr, const struct rte_ether_addr *d_addr,
+                     uint16_t ether_type) {
+    common_t *header = (common_t *) template;
+
+    rte_ether_addr_copy(s_addr, &header->ether.s_addr);
+    rte_ether_addr_copy(d_addr, &header->ether.d_addr);
+    header->ether.ether_type = ether_type; // be order
+}
+
+static void
+init_packet_templates(void) {
+    init_packet_template(data_template, &my_data_mac, &forwarder_data_mac, ETHER_TYPE_DATA);
+    init_packet_template(control_template, &my_control_mac, &forwarder_control_mac, ETHER_TYPE_CONTROL);
+    init_packet_template(warmup_template, &my_data_mac, &forwarder_data_mac, ETHER_TYPE_WARMUP);
+}
+
+/*
+ * --send_pool: builds the nb packets of the trace from seq on into bufs, from the mbufs the NIC freed.
+ * Returns -ENOENT if the pool does not have nb mbufs left, none is taken then.
+ */
+static __rte_always_inline int
+build_packets(struct rte_mbuf **bufs, uint16_t nb, size_t seq) {
+    const trace_entry_t *entry;
+    common_t *header;
+    size_t pos = seq % trace_length;
+    uint16_t i;
+
+    if (unlikely(rte_pktmbuf_alloc_bulk(mbuf_pool_tx, bufs, nb)))
+        return -ENOENT;
+    for (i = 0; i < nb; i++, seq++) {
+        entry = &trace[pos];
+        header = rte_pktmbuf_mtod(bufs[i], common_t * );
+        if (entry->is_control) {
+            rte_memcpy(header, control_template, CONTROL_PKT_SIZE);
+            bufs[i]->data_len = bufs[i]->pkt_len = CONTROL_PKT_SIZE;
+        } else {
+            rte_memcpy(header, data_template, DATA_PKT_SIZE);
+            bufs[i]->data_len = bufs[i]->pkt_len = DATA_PKT_SIZE;
+        }
+        header->seq = seq_base + seq; // local order, only used by myself
+        header->dst_addr = entry->dst_id; // be order
+        if (unlikely(++pos == trace_length))
+            pos = 0;
+    }
+    return 0;
+}
+
+/*
+ * --send_pool: builds the claimed packets, waiting for the NIC to give back the mbufs of sent ones.
+ * rte_eth_tx_done_cleanup frees them from the TX ring of queue_id. A PMD without it (-ENOTSUP) only frees
+ * them in tx_burst, of the other queues meanwhile. A pool checked against the real rings cannot run dry,
+ * so after SEND_POOL_WAIT_MS without any mbuf back the sender exits rather than spinning forever.
+ */
+static __rte_always_inline void
+build_claimed_packets(struct rte_mbuf **bufs, uint16_t nb, size_t seq, uint16_t queue_id) {
+    uint64_t deadline = 0;
+    int ret;
+
+    while (unlikely(build_packets(bufs, nb, seq))) {
+        ret = rte_eth_tx_done_cleanup(port_id_data, queue_id, 0);
+        if (unlikely(ret < 0 && ret != -ENOTSUP))
+            rte_exit(EXIT_FAILURE, "Cannot clean up TX queue %"PRIu16": %s\n", queue_id, strerror(-ret));
+        if (ret > 0) { // some came back, maybe not enough yet
+            deadline = 0;
+            continue;
+        }
+        if (!deadline)
+            deadline = rte_rdtsc() + rte_get_timer_hz() * SEND_POOL_WAIT_MS / 1000;
+        else if (unlikely(rte_rdtsc() > deadline))
+            rte_exit(EXIT_FAILURE, "No mbuf came back to the send pool for %d ms on queue %"PRIu16"\n",
+                     SEND_POOL_WAIT_MS, queue_id);
+        rte_pause();
+    }
 }
 
 static inline void
 warmup_send_thread() {
     printf("\nWarming up the sender.\n");
-    uint16_t sent_in_burst;
+    uint16_t sent_in_burst, i;
     size_t batch_size;
     struct rte_mbuf **send_head = trace_packets + total_packet_count;
+    struct rte_mbuf *bufs[data_send_burst_size];
     uint64_t remaining_warmup = WARMUP_SIZE(data_send_burst_size);
 
     while (remaining_warmup > 0) {
         batch_size = MIN(remaining_warmup, (uint64_t) data_send_burst_size);
 
-        sent_in_burst = rte_eth_tx_burst(port_id_data, 0, send_head, batch_size);
+        if (send_pool_size) {
+            if (unlikely(rte_pktmbuf_alloc_bulk(mbuf_pool_tx, bufs, batch_size)))
+                continue;
+            for (i = 0; i < batch_size; i++) {
+                rte_memcpy(rte_pktmbuf_mtod(bufs[i], void *), warmup_template, DATA_PKT_SIZE);
+                rte_pktmbuf_mtod(bufs[i], common_t *)->seq = seq_base; // the results of packet 0, as prebuilt
+                bufs[i]->data_len = bufs[i]->pkt_len = DATA_PKT_SIZE;
+            }
+            sent_in_burst = rte_eth_tx_burst(port_id_data, 0, bufs, batch_size);
+            if (unlikely(sent_in_burst < batch_size))
+                rte_pktmbuf_free_bulk(bufs + sent_in_burst, batch_size - sent_in_burst);
+        } else {
+            sent_in_burst = rte_eth_tx_burst(port_id_data, 0, send_head, batch_size);
+            send_head += sent_in_burst;
+        }
 
-        send_head += sent_in_burst;
         remaining_warmup -= sent_in_burst;
     }
 }
 
-static int
-send_thread(void *param) {
-    RTE_SET_USED(param);
-
-    size_t batch_size;
-    uint16_t sent_in_burst;
-    uint64_t start, end, batches = 0;
+/*
+ * Claims the next packets of the trace for a send lcore: at most data_send_burst_size and, with RATE_CONTROL,
+ * only those whose departure time has come, so the send lcores together follow the schedule of --pacing.
+ * Returns their # (0 if none for now) and the seq of the first one in *seq.
+ */
+static __rte_always_inline uint64_t
+claim_packets(size_t *seq) {
+    uint64_t claimed = next_seq, nb;
+
+    do {
+        if (unlikely(claimed >= total_packet_count))
+            return 0;
+        nb = MIN(total_packet_count - claimed, (uint64_t) data_send_burst_size);
 #ifdef RATE_CONTROL
-    uint64_t token_batch_size;
-//    uint64_t times[200], zzz = 0;
+        nb = packets_due(claimed, nb, rte_rdtsc_precise() - send_start_cycles);
+        if (!nb) // the next packet is not due yet
+            return 0;
 #endif
-    struct rte_mbuf **send_head;
-
-    printf("\nCore %u sending packets.\n", rte_lcore_id());
-
-    send_head = trace_packets;
-    remaining_send = total_packet_count;
-    sent_packets = 0;
+    } while (unlikely(!__atomic_compare_exchange_n(&next_seq, &claimed, claimed + nb, false,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)));
+    *seq = claimed;
+    return nb;
+}
 
-    // prepare and send some junk packets
-    warmup_send_thread();
+/*
+ * Sends the packets of the trace on TX queue param. The send lcores claim the packets in bursts from
+ * a common seq counter, so the trace goes out in order across the queues.
+ */
+static int
+send_thread(void *param) {
+    uint16_t queue_id = (uint16_t)(uintptr_t) param;
+    tx_queue_stats_t *stats = &tx_queue_stats[queue_id];
+    size_t seq = 0;
+    uint64_t nb_claimed = 0; // claimed and not sent yet, from seq on
+    uint16_t sent_in_burst;
+    uint64_t start, end;
+    struct rte_mbuf **send_head = NULL, *built[data_send_burst_size]; // --send_pool: the claimed packets
 
-    printf("\nStart to send in 1s.\n");
-    rte_delay_us_sleep(1000000);
+    printf("\nCore %u sending packets to queue %"PRIu16".\n", rte_lcore_id(), queue_id);
 
-    start = rte_rdtsc_precise();
-#ifdef RATE_CONTROL
-    // we fill the bucket with data_send_burst_size packets
-//    time_last_sent = start - data_send_burst_size * cycles_per_packet;
-    time_last_sent = start - cycles_per_packet;
-//    times[zzz++] = time_last_sent;
-#endif
+    if (queue_id == 0) {
+        // prepare and send some junk packets
+        warmup_send_thread();
 
-    while (remaining_send > 0) {
-        batch_size = MIN(remaining_send, (uint64_t) data_send_burst_size);
-#ifdef RATE_CONTROL
-        token_batch_size = rte_rdtsc_precise();
-//        if (unlikely(zzz < 200)) times[zzz] = token_batch_size;
-        token_batch_size = (token_batch_size - time_last_sent) / cycles_per_packet;
-        batch_size = MIN(batch_size,  token_batch_size);
-        if (unlikely(!batch_size)) // not enough tokens to send a packet
-            continue;
-//        zzz++;
-#endif
+        printf("\nStart to send in 1s.\n");
+        rte_delay_us_sleep(1000000);
+        __atomic_store_n(&send_start_cycles, rte_rdtsc_precise(), __ATOMIC_RELEASE);
+    } else {
+        while (!__atomic_load_n(&send_start_cycles, __ATOMIC_ACQUIRE))
+            rte_pause();
+    }
+    start = send_start_cycles;
+
+    while (true) {
+        if (!nb_claimed) {
+            nb_claimed = claim_packets(&seq);
+            if (unlikely(!nb_claimed)) {
+                if (next_seq >= total_packet_count)
+                    break;
+                continue;
+            }
+            if (send_pool_size) {
+                // the mbufs come back once the NIC sent them, which the PMD notices in tx_burst or cleanup
+                build_claimed_packets(built, nb_claimed, seq, queue_id);
+                send_head = built;
+            } else
+                send_head = trace_packets + seq;
+        }
 
-        sent_in_burst = rte_eth_tx_burst(port_id_data, 0, send_head, batch_size);
+        sent_in_burst = rte_eth_tx_burst(port_id_data, queue_id, send_head, nb_claimed);
 
         send_head += sent_in_burst;
-        sent_packets += sent_in_burst;
-        remaining_send -= sent_in_burst;
-        batches++;
-#ifdef RATE_CONTROL
-        time_last_sent += sent_in_burst * cycles_per_packet;
-#endif
+        seq += sent_in_burst;
+        nb_claimed -= sent_in_burst;
+        stats->sent_packets += sent_in_burst;
+        stats->batches++;
     }
 
     end = rte_rdtsc_precise();
 
-    printf("sent packets: %zd duration: %"PRIu64" batches: %"PRIu64
+    printf("queue %"PRIu16" sent packets: %"PRIu64" duration: %"PRIu64" batches: %"PRIu64"\n",
+           queue_id, stats->sent_packets, end - start, stats->batches);
+    // the last send lcore to finish reports for all of them
+    if (__atomic_sub_fetch(&running_senders, 1, __ATOMIC_ACQ_REL) == 0) {
+        printf("sent packets: %zd duration: %"PRIu64
 #ifdef RATE_CONTROL
-                " cycles_per_pkt=%.6f/%"PRIu64
+                    " cycles_per_pkt=%.6f/%"PRIu64
 #endif
-                "\n",
-            total_packet_count, end - start, batches
+                    "\n",
+                total_packet_count, end - start
 #ifdef RATE_CONTROL
-            , (double)(end - start) / total_packet_count, cycles_per_packet
+                , (double)(end - start) / total_packet_count, cycles_per_packet
 #endif
-            );
-
-//#ifdef RATE_CONTROL
-//    for (token_batch_size = 0; token_batch_size < 200; token_batch_size++)
-//        printf("%"PRIu64"\n", times[token_batch_size]);
-//#endif
-
-    sending = false;
+                );
+        sending = false;
+    }
     return 0;
 }
 
+/*
+ * Receives the returning packets of all the send lcores. They all have the same ether type and addresses,
+ * so RSS would hash them to the same RX queue anyway: 1 RX queue and 1 receive lcore.
+ */
 static int
 receive_thread(void *param) {
     RTE_SET_USED(param);
@@ -184,31 +420,41 @@ receive_thread(void *param) {
     struct rte_mbuf *bufs[data_receive_burst_size];
     uint16_t nb_rx;
 
-    printf("\nCore %u receiving data packets.\n", rte_lcore_id());
+    printf("\nCore %u receiving data packets from queue %d.\n", rte_lcore_id(), RX_QUEUE);
 
     while (sending || final_wait > 0) {
-        nb_rx = rte_eth_rx_burst(port_id_data, 0, bufs, data_receive_burst_size);
+        nb_rx = rte_eth_rx_burst(port_id_data, RX_QUEUE, bufs, data_receive_burst_size);
         // no need to do anything here, everything done in the data_rx_callback
         if (likely(nb_rx))
             rte_pktmbuf_free_bulk(bufs, nb_rx);
     }
-    printf("receive thread ended!\n");
+    printf("receive thread of queue %d ended! receive_data=%"PRIu64"\n", RX_QUEUE, rx_stats.receive_data);
     return 0;
 }
 
 
 static inline void inner_report() {
     uint64_t time_cycles = rte_rdtsc_precise();
+    uint64_t sent_packets = 0, batches_at_tx_callback = 0;
+    uint64_t receive_error_type = rx_stats.receive_error_type, receive_error_seq = rx_stats.receive_error_seq;
+    uint64_t receive_redundant = rx_stats.receive_redundant, receive_data = rx_stats.receive_data;
+    uint16_t q;
+
+    for (q = 0; q < send_queues; q++) {
+        sent_packets += tx_queue_stats[q].sent_packets;
+        batches_at_tx_callback += tx_queue_stats[q].batches_at_tx_callback;
+    }
     printf("[%14"PRIu64"] sent=%zd remaining=%zd rx_err_type=%zd rx_err_seq=%zd rx_rdnt=%zd rx_data=%zd batch@rx=%"PRIu64" "
                        #ifdef RATE_CONTROL
-                       " token=%"PRIu64
+                       " token=%"PRId64
                        #endif
                        "\n",
             time_cycles - start_time_cycles,
-            sent_packets, remaining_send,
+            sent_packets, total_packet_count - sent_packets,
             receive_error_type, receive_error_seq, receive_redundant, receive_data, batches_at_tx_callback
 #ifdef RATE_CONTROL
-            , (time_cycles - time_last_sent) / cycles_per_packet
+            // the packets due but not claimed by a send lcore yet
+            , send_start_cycles ? (int64_t)(packets_due_by(time_cycles - send_start_cycles) - next_seq) : 0
 #endif
             );
 }
@@ -231,19 +477,19 @@ data_tx_callback(uint16_t port_id,
                  void *user_param) {
     RTE_SET_USED(port_id);
     RTE_SET_USED(queue);
-    RTE_SET_USED(user_param);
 
 
     uint16_t i;
     uint64_t now;
     common_t * header;
+    tx_queue_stats_t *stats = (tx_queue_stats_t *) user_param;
 
     now = rte_rdtsc_precise();
     for (i = 0; i < nb_pkts; i++) {
         header = rte_pktmbuf_mtod(pkts[i], common_t * );
-        header->time_send = results[header->seq].time_send = now;
+        header->time_send = results[header->seq - seq_base].time_send = now;
     }
-    batches_at_tx_callback++;
+    stats->batches_at_tx_callback++;
     return nb_pkts;
 }
 
@@ -257,23 +503,23 @@ data_rx_callback(uint16_t port_id,
     RTE_SET_USED(port_id);
     RTE_SET_USED(queue);
     RTE_SET_USED(max_pkts);
-    RTE_SET_USED(user_param);
 
     uint16_t i;
     uint64_t now;
     data_pkt_t * header;
     uint32_t seq;
     packet_stat_t *stat;
+    rx_queue_stats_t *stats = (rx_queue_stats_t *) user_param;
 
     now = rte_rdtsc_precise();
     for (i = 0; i < nb_pkts; i++) {
         header = rte_pktmbuf_mtod(pkts[i], data_pkt_t * );
         if (likely(pkts[i]->data_len >= DATA_PKT_SIZE && header->common_header.ether.ether_type == ETHER_TYPE_DATA)) {
-            seq = header->common_header.seq;
+            seq = header->common_header.seq - seq_base; // one of an earlier search trial is out of range
             if (likely(seq < (total_packet_count))) {
                 stat = results + seq;
                 if (unlikely(stat->is_control)) {
-                    receive_error_type++;
+                    stats->receive_error_type++;
                 } else if (likely(!stat->data.time_receive)) {
                     stat->data.time_receive = now;
                     stat->data.time_arrive_f = header->common_header.time_send; // reused
@@ -281,12 +527,12 @@ data_rx_callback(uint16_t port_id,
                     stat->data.time_control_arrive_f = header->time_control_arrive_f;
                     stat->data.time_after_lookup_f = header->time_after_lookup_f;
                     stat->data.time_exit_f = header->time_exit_f;
-                    receive_data++;
+                    stats->receive_data++;
                 } else {
-                    receive_redundant++;
+                    stats->receive_redundant++;
                 }
             } else {
-                receive_error_seq++;
+                stats->receive_error_seq++;
             }
         }
     }
@@ -294,11 +540,171 @@ data_rx_callback(uint16_t port_id,
 }
 
 
+/*
+ * Sends the whole trace once at the current rate, then waits WAIT_AFTER_FINISH_MS for the last packets.
+ * The counters and results are reset first, so each run of a search starts from scratch.
+ */
+static void
+run_trial(void) {
+    unsigned send_lcore_id, receive_lcore_id;
+    uint16_t q;
+    size_t i;
+
+    next_seq = 0;
+    send_start_cycles = 0;
+    running_senders = send_queues;
+    sending = true;
+    final_wait = WAIT_AFTER_FINISH_MS;
+    for (q = 0; q < send_queues; q++)
+        tx_queue_stats[q] = (tx_queue_stats_t) {0};
+    rx_stats = (rx_queue_stats_t) {0};
+    for (i = 0; i < total_packet_count; i++) {
+        results[i].time_send = 0;
+        if (!results[i].is_control)
+            results[i].data = (data_packet_stat_t) {0};
+    }
+
+    // start the receive lcore, then the send lcores, 1 per TX queue
+    receive_lcore_id = rte_get_next_lcore(-1, 1, 0);
+    if (unlikely(receive_lcore_id == RTE_MAX_LCORE))
+        rte_exit(EXIT_FAILURE, "Receive core required!\n");
+    rte_eal_remote_launch(receive_thread, NULL, receive_lcore_id);
+
+    send_lcore_id = receive_lcore_id;
+    for (q = 0; q < send_queues; q++) {
+        send_lcore_id = rte_get_next_lcore(send_lcore_id, 1, 0);
+        if (unlikely(send_lcore_id == RTE_MAX_LCORE))
+            rte_exit(EXIT_FAILURE, "Send core required!\n");
+        rte_eal_remote_launch(send_thread, (void *)(uintptr_t) q, send_lcore_id);
+    }
+
+    report_status();
+
+    rte_eal_mp_wait_lcore();
+}
+
+#ifdef RATE_CONTROL
+// --search_trials: sends at mpps from the next trial on
+static void
+set_rate(double mpps) {
+    uint64_t new_cycles_per_packet = RTE_MAX((uint64_t) round(rte_get_timer_hz() / (mpps * 1000000)), (uint64_t) 1);
+    double scale = (double) new_cycles_per_packet / cycles_per_packet;
+    size_t i;
+
+    if (pacing == PACING_POISSON) { // the same exponential draws, for the new mean
+        for (i = 0; i < trace_length; i++)
+            pace_offsets[i] = (uint64_t) round(pace_offsets[i] * scale);
+        pace_period = (uint64_t) round(pace_period * scale);
+    }
+    cycles_per_packet = new_cycles_per_packet;
+}
+
+/*
+ * --search_trials: RFC 2544 style throughput search. Runs the trace at --mpps, then halves the interval
+ * between the highest rate whose data packet loss is <= search_loss and the lowest one whose loss is not,
+ * until search_trials runs or SEARCH_RESOLUTION. Prints the loss and data_rtt of each run, the rate/latency
+ * curve, also in SEARCH_FILENAME.
+ */
+static void
+search_throughput(void) {
+    double max_mpps = rte_get_timer_hz() / 1000000.0 / cycles_per_packet;
+    double mpps = max_mpps, pass_mpps = 0, fail_mpps = max_mpps, loss, data_rtt;
+    uint64_t data_sent, data_received, data_rtt_sum;
+    uint64_t i;
+    int trial;
+#ifdef SEARCH_FILENAME
+    FILE *search_file;
+
+    search_file = fopen(SEARCH_FILENAME, "w");
+    if (unlikely(!search_file))
+        rte_exit(EXIT_FAILURE, "Cannot create search file: " SEARCH_FILENAME ": %s\n", strerror(errno));
+    fprintf(search_file, "trial,seq_base,mpps,data_sent,data_received,loss_percent,data_rtt_cycles,data_rtt_us\n");
+#endif
+
+    if (unlikely((uint64_t) search_trials * total_packet_count > (uint64_t) UINT32_MAX + 1))
+        rte_exit(EXIT_FAILURE, "The seqs of %d trials of %zd packets do not fit in 32 bits\n",
+                 search_trials, total_packet_count);
+    for (trial = 0; trial < search_trials; trial++) {
+        set_rate(mpps);
+        seq_base = (uint32_t) (trial * total_packet_count);
+        printf("\nSearch trial %d at %.6f MPPS, cycles_per_packet=%"PRIu64", seq_base=%"PRIu32".\n",
+               trial, mpps, cycles_per_packet, seq_base);
+        run_trial();
+
+        data_received = rx_stats.receive_data;
+        data_rtt_sum = 0;
+        for (i = 0; i < total_packet_count; i++)
+            if (!results[i].is_control && results[i].data.time_receive)
+                data_rtt_sum += results[i].data.time_receive - results[i].time_send;
+        data_sent = data_packet_count;
+        loss = data_sent ? 100.0 * (data_sent - RTE_MIN(data_received, data_sent)) / data_sent : 0;
+        data_rtt = data_received ? (double) data_rtt_sum / data_received : 0;
+        printf("search trial=%d mpps=%.6f data_sent=%"PRIu64" data_received=%"PRIu64" loss=%.6f%% data_rtt=%.3f (%.3fus)\n",
+               trial, mpps, data_sent, data_received, loss, data_rtt, data_rtt * 1000000 / rte_get_timer_hz());
+#ifdef SEARCH_FILENAME
+        fprintf(search_file, "%d,%"PRIu32",%.6f,%"PRIu64",%"PRIu64",%.6f,%.3f,%.3f\n", trial, seq_base, mpps,
+                data_sent, data_received, loss, data_rtt, data_rtt * 1000000 / rte_get_timer_hz());
+        fflush(search_file);
+#endif
+
+        if (loss <= search_loss) {
+            pass_mpps = mpps;
+            if (mpps == max_mpps) // nothing higher to search
+                break;
+        } else
+            fail_mpps = mpps;
+        if (fail_mpps - pass_mpps <= fail_mpps * SEARCH_RESOLUTION)
+            break;
+        mpps = (pass_mpps + fail_mpps) / 2;
+    }
+
+#ifdef SEARCH_FILENAME
+    fclose(search_file);
+    printf("File %s finished!\n", SEARCH_FILENAME);
+#endif
+    if (pass_mpps > 0)
+        printf("throughput: %.6f MPPS with loss <= %.6f%% (lowest rate with more loss: %.6f MPPS)\n",
+               pass_mpps, search_loss, fail_mpps);
+    else
+        printf("throughput: no rate tried had loss <= %.6f%%, lowest tried: %.6f MPPS\n", search_loss, fail_mpps);
+}
+#endif
+
+
+/*
+ * --send_pool: parse_args checked the pool against the TX ring size asked for, the PMD may have rounded
+ * the rings up (rte_eth_dev_adjust_nb_rx_tx_desc in port_init), they can then hold more mbufs.
+ */
+static void
+check_send_pool_size(void) {
+    struct rte_eth_txq_info txq_info;
+    uint16_t nb_rxd, nb_txd, q;
+    int tx_ring_size = data_tx_ring_size;
+
+    for (q = 0; q < send_queues; q++) {
+        if (!rte_eth_tx_queue_info_get(port_id_data, q, &txq_info))
+            nb_txd = txq_info.nb_desc;
+        else { // the PMD cannot tell, redo the adjustment of port_init
+            nb_rxd = data_rx_ring_size;
+            nb_txd = data_tx_ring_size;
+            if (rte_eth_dev_adjust_nb_rx_tx_desc(port_id_data, &nb_rxd, &nb_txd))
+                continue;
+        }
+        tx_ring_size = RTE_MAX(tx_ring_size, (int) nb_txd);
+    }
+    if (tx_ring_size != data_tx_ring_size)
+        printf("TX rings of %d descriptors instead of %d\n", tx_ring_size, data_tx_ring_size);
+    if (unlikely(send_pool_size < SEND_POOL_SIZE_MIN(tx_ring_size, data_send_burst_size, send_queues)))
+        rte_exit(EXIT_FAILURE, "The send pool should be >= %d with the TX rings of the port\n",
+                 SEND_POOL_SIZE_MIN(tx_ring_size, data_send_burst_size, send_queues));
+}
+
 int
 main(int argc, char *argv[]) {
     int ret;
     uint16_t nb_ports;
-    unsigned nb_lcores, send_lcore_id, receive_lcore_id;
+    unsigned nb_lcores;
+    uint16_t q;
 
 
     printf("sizeof(data_pkt_t)=%zd/%zd, sizeof(control_pkt_t)=%zd/%zd\n",
@@ -325,16 +731,19 @@ main(int argc, char *argv[]) {
     if (unlikely(nb_ports < 1))
         rte_exit(EXIT_FAILURE, "Must have at least 1 ports, for both data and control\n");
 
-    /* Make sure that there are at least 2 lcores available */
+    /* Make sure that there are at least 1 lcore per TX queue + 2 available */
     nb_lcores = rte_lcore_count();
     printf("Number of lcores available %u\n", nb_lcores);
-    if (unlikely(nb_lcores < 3))
-        rte_exit(EXIT_FAILURE, "Must have at least 3 cores, 1 for sending, 1 for receiving, and 1 for stat\n");
+    if (unlikely(nb_lcores < send_queues + 2u))
+        rte_exit(EXIT_FAILURE, "Must have at least %d cores, 1 per queue for sending, 1 for receiving and 1 for stat\n",
+                 send_queues + 2);
     printf("\n");
 
     /* Initialize data packet pool for rx */
     mbuf_pool_data_rx = rte_pktmbuf_pool_create("MBUF_POOL_DATA_RX",
-                                                RX_POOL_SIZE, MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
+                                                RTE_MAX(RX_POOL_SIZE,
+                                                        RX_POOL_SIZE_MIN(data_rx_ring_size, data_receive_burst_size)),
+                                                MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
                                                 rte_socket_id());
     if (unlikely(!mbuf_pool_data_rx))
         rte_exit(EXIT_FAILURE, "Failed in creating mbuf_pool_data_rx\n");
@@ -343,35 +752,33 @@ main(int argc, char *argv[]) {
     port_id_data = rte_eth_find_next_owned_by(0, RTE_ETH_DEV_NO_OWNER);
     if (unlikely(port_id_data >= RTE_MAX_ETHPORTS))
         rte_exit(EXIT_FAILURE, "Cannot get data port\n");
-    port_init(port_id_data, mbuf_pool_data_rx, data_tx_ring_size, data_rx_ring_size, &my_data_mac);
-    rte_eth_add_tx_callback(port_id_data, 0, data_tx_callback, NULL);
-    rte_eth_add_rx_callback(port_id_data, 0, data_rx_callback, NULL);
+    ret = port_init(port_id_data, mbuf_pool_data_rx, data_tx_ring_size, data_rx_ring_size, 1, send_queues, &my_data_mac, false);
+    if (unlikely(ret))
+        rte_exit(EXIT_FAILURE, "Cannot init data port %"PRIu16"\n", port_id_data);
+    for (q = 0; q < send_queues; q++)
+        rte_eth_add_tx_callback(port_id_data, q, data_tx_callback, &tx_queue_stats[q]);
+    rte_eth_add_rx_callback(port_id_data, RX_QUEUE, data_rx_callback, &rx_stats);
+    if (send_pool_size)
+        check_send_pool_size();
     printf("\n");
 
     rte_ether_addr_copy(&my_data_mac, &my_control_mac);
     ret = parse_trace();
     if (unlikely(ret < 0))
         rte_exit(EXIT_FAILURE, "Error with parse trace\n");
+    if (send_pool_size)
+        init_packet_templates();
     printf("\n");
 
-    // start receive lcore
-    receive_lcore_id = rte_get_next_lcore(-1, 1, 0);
-    if (unlikely(receive_lcore_id == RTE_MAX_LCORE))
-        rte_exit(EXIT_FAILURE, "Receive core required!\n");
-    rte_eal_remote_launch(receive_thread, NULL, receive_lcore_id);
-
-
-    send_lcore_id = rte_get_next_lcore(receive_lcore_id, 1, 0);
-    if (unlikely(send_lcore_id == RTE_MAX_LCORE))
-        rte_exit(EXIT_FAILURE, "Send core required!\n");
-    rte_eal_remote_launch(send_thread, NULL, send_lcore_id);
-
-    report_status();
-
-    rte_eal_mp_wait_lcore();
+#ifdef RATE_CONTROL
+    if (search_trials)
+        search_throughput();
+    else
+#endif
+        run_trial();
 
     calculate_statistics();
 
 
     return 0;
-}
\ No newline at end of file
+}
@@ -9,8 +9,13 @@ extern int control_tx_ring_size, control_rx_ring_size;
 extern struct rte_ether_addr forwarder_data_mac, forwarder_control_mac;
 extern char *trace_filename;
 extern int trace_repeat;
+extern int send_pool_size;
+extern int send_queues;
 #ifdef RATE_CONTROL
 extern uint64_t cycles_per_packet;
+extern pacing_mode_t pacing;
+extern int search_trials;
+extern double search_loss;
 #endif
 
 int parse_args(int argc, char **argv);
@@ -47,12 +52,32 @@ int parse_args(int argc, char **argv);
 #define PARAM_TRACE_REPEAT_SHORT "trt"
 #define DEFAULT_TRACE_REPEAT 1
 
+#define PARAM_SEND_POOL_SIZE "send_pool"
+#define PARAM_SEND_POOL_SIZE_SHORT "sp"
+#define DEFAULT_SEND_POOL_SIZE 0
+
+#define PARAM_SEND_QUEUES "send_queues"
+#define PARAM_SEND_QUEUES_SHORT "sq"
+#define DEFAULT_SEND_QUEUES 1
+
 #define PARAM_FORWARDER_CONTROL_MAC "forwarder_control_mac"
 #define PARAM_FORWARDER_CONTROL_MAC_SHORT "fcm"
 
 #ifdef RATE_CONTROL
 #define PARAM_RATE_CONTROL_MPPS "million_packets_per_second"
 #define PARAM_RATE_CONTROL_MPPS_SHORT "mpps"
+
+#define PARAM_PACING "pacing"
+#define PARAM_PACING_SHORT "pc"
+#define DEFAULT_PACING PACING_CONSTANT
+
+#define PARAM_SEARCH_TRIALS "search_trials"
+#define PARAM_SEARCH_TRIALS_SHORT "st"
+#define DEFAULT_SEARCH_TRIALS 0
+
+#define PARAM_SEARCH_LOSS "search_loss"
+#define PARAM_SEARCH_LOSS_SHORT "sl"
+#define DEFAULT_SEARCH_LOSS 0.0
 #endif
 
 #define PARAM_FORWARDER_DATA_MAC "forwarder_data_mac"
@@ -77,10 +102,15 @@ enum {
     CMD_LINE_OPT_CONTROL_RX_RING_SIZE,
     CMD_LINE_OPT_TRACE_FILENAME,
     CMD_LINE_OPT_TRACE_REPEAT,
+    CMD_LINE_OPT_SEND_POOL_SIZE,
+    CMD_LINE_OPT_SEND_QUEUES,
     CMD_LINE_OPT_FORWARDER_CONTROL_MAC,
     CMD_LINE_OPT_FORWARDER_DATA_MAC,
 #ifdef RATE_CONTROL
     CMD_LINE_OPT_RATE_CONTROL_MPPS,
+    CMD_LINE_OPT_PACING,
+    CMD_LINE_OPT_SEARCH_TRIALS,
+    CMD_LINE_OPT_SEARCH_LOSS,
 #endif
     CMD_LINE_OPT_HELP
 };
@@ -102,6 +132,10 @@ static const struct option long_options[] = {
         {PARAM_TRACE_FILENAME_SHORT,          required_argument, NULL, CMD_LINE_OPT_TRACE_FILENAME},
         {PARAM_TRACE_REPEAT,                  required_argument, NULL, CMD_LINE_OPT_TRACE_REPEAT},
         {PARAM_TRACE_REPEAT_SHORT,            required_argument, NULL, CMD_LINE_OPT_TRACE_REPEAT},
+        {PARAM_SEND_POOL_SIZE,                required_argument, NULL, CMD_LINE_OPT_SEND_POOL_SIZE},
+        {PARAM_SEND_POOL_SIZE_SHORT,          required_argument, NULL, CMD_LINE_OPT_SEND_POOL_SIZE},
+        {PARAM_SEND_QUEUES,                   required_argument, NULL, CMD_LINE_OPT_SEND_QUEUES},
+        {PARAM_SEND_QUEUES_SHORT,             required_argument, NULL, CMD_LINE_OPT_SEND_QUEUES},
         {PARAM_FORWARDER_CONTROL_MAC,         required_argument, NULL, CMD_LINE_OPT_FORWARDER_CONTROL_MAC},
         {PARAM_FORWARDER_CONTROL_MAC_SHORT,   required_argument, NULL, CMD_LINE_OPT_FORWARDER_CONTROL_MAC},
         {PARAM_FORWARDER_DATA_MAC,            required_argument, NULL, CMD_LINE_OPT_FORWARDER_DATA_MAC},
@@ -109,6 +143,12 @@ static const struct option long_options[] = {
 #ifdef RATE_CONTROL
         {PARAM_RATE_CONTROL_MPPS,             required_argument, NULL, CMD_LINE_OPT_RATE_CONTROL_MPPS},
         {PARAM_RATE_CONTROL_MPPS_SHORT,       required_argument, NULL, CMD_LINE_OPT_RATE_CONTROL_MPPS},
+        {PARAM_PACING,                        required_argument, NULL, CMD_LINE_OPT_PACING},
+        {PARAM_PACING_SHORT,                  required_argument, NULL, CMD_LINE_OPT_PACING},
+        {PARAM_SEARCH_TRIALS,                 required_argument, NULL, CMD_LINE_OPT_SEARCH_TRIALS},
+        {PARAM_SEARCH_TRIALS_SHORT,           required_argument, NULL, CMD_LINE_OPT_SEARCH_TRIALS},
+        {PARAM_SEARCH_LOSS,                   required_argument, NULL, CMD_LINE_OPT_SEARCH_LOSS},
+        {PARAM_SEARCH_LOSS_SHORT,             required_argument, NULL, CMD_LINE_OPT_SEARCH_LOSS},
 #endif
         {PARAM_HELP,                          no_argument,       NULL, CMD_LINE_OPT_HELP},
         {NULL,                                no_argument,       NULL, 0}
@@ -125,12 +165,30 @@ usage(const char *prgname) {
            "    --" PARAM_DATA_RX_RING_SIZE "/--" PARAM_DATA_RX_RING_SIZE_SHORT " DATA_RX_RING_SIZE: rx ring size for data packets, must be > 0 and <= %d\n"
            "    --" PARAM_CONTROL_TX_RING_SIZE "/--" PARAM_CONTROL_TX_RING_SIZE_SHORT " CONTROL_TX_RING_SIZE: tx ring size for control packets, must be > 0 and <= %d\n"
            "    --" PARAM_CONTROL_RX_RING_SIZE "/--" PARAM_CONTROL_RX_RING_SIZE_SHORT " CONTROL_RX_RING_SIZE: rx ring size for control packets, must be > 0 and <= %d\n"
-           "    --" PARAM_TRACE_FILENAME "/--" PARAM_TRACE_FILENAME_SHORT " TRACE_FILENAME: filename that stores the trace, in CSV format, first column: isControl(0/1), second column: nodeID\n"
+           "    --" PARAM_TRACE_FILENAME "/--" PARAM_TRACE_FILENAME_SHORT " TRACE_FILENAME: filename that stores the trace, in CSV format, first column: isControl(0/1), second column: nodeID, optional third column: time since the previous packet in ns, used by --" PARAM_PACING " trace\n"
            "    --" PARAM_TRACE_REPEAT "/--" PARAM_TRACE_REPEAT_SHORT " TRACE_REPEAT_TIMES: # of times to repeat the trace in 1 experiment. must be > 0 and the total # of packets should be enough to store in the memory\n"
+           "    --" PARAM_SEND_POOL_SIZE "/--" PARAM_SEND_POOL_SIZE_SHORT " SEND_POOL_SIZE: build the packets from the trace while sending, "
+           "into SEND_POOL_SIZE mbufs recycled after the NIC sent them, so the memory does not grow with the trace and its repeats, "
+           "must be 0 (default, 1 mbuf per packet built beforehand) or >= (DATA_TX_RING_SIZE + 2 * DATA_SEND_BURST_SIZE + %d) * SEND_QUEUES, "
+           "with DATA_TX_RING_SIZE as set up by the port, which may round it up\n"
+           "    --" PARAM_SEND_QUEUES "/--" PARAM_SEND_QUEUES_SHORT  " SEND_QUEUES: # of TX queues, each with a send core, "
+           "the send cores share the trace and the rate, the returning packets are all received by 1 core, "
+           "must be > 0 and <= %d, default %d\n"
            "    --" PARAM_FORWARDER_CONTROL_MAC "/--" PARAM_FORWARDER_CONTROL_MAC_SHORT " FORWARDER_CONTROL_MAC: the ether address of the control port on the forwarder\n"
            "    --" PARAM_FORWARDER_DATA_MAC "/--" PARAM_FORWARDER_DATA_MAC_SHORT " FORWARDER_DATA_MAC: the ether address of the data port on the forwarder\n"
 #ifdef RATE_CONTROL
            "    --" PARAM_RATE_CONTROL_MPPS "/--" PARAM_RATE_CONTROL_MPPS_SHORT " SENDING_RATE_IN_MPPS: the sending rate in million packets per second (MPPS). The real speed can be (closely) equal to the value or the link speed in DPDK, whichever is lower\n"
+           "    --" PARAM_PACING "/--" PARAM_PACING_SHORT " PACING: how the departure times are scheduled, "
+           "constant (default): 1 packet every 1/SENDING_RATE_IN_MPPS us, "
+           "poisson: exponential inter-departure times of 1/SENDING_RATE_IN_MPPS us on average, "
+           "trace: the inter-departure times of the trace file, no " PARAM_RATE_CONTROL_MPPS " then\n"
+           "    --" PARAM_SEARCH_TRIALS "/--" PARAM_SEARCH_TRIALS_SHORT " SEARCH_TRIALS: search the highest rate up to SENDING_RATE_IN_MPPS "
+           "with a data packet loss <= SEARCH_LOSS, by a binary search of at most SEARCH_TRIALS runs of the trace, "
+           "needs " PARAM_SEND_POOL_SIZE ", 0 (default): 1 run at SENDING_RATE_IN_MPPS. The packets of trial t have seqs from "
+           "t * the # of packets on, the forwarder gets the control packets of every trial, so it needs --result_stream "
+           "or a --control_packet_count of SEARCH_TRIALS times the one of the trace\n"
+           "    --" PARAM_SEARCH_LOSS "/--" PARAM_SEARCH_LOSS_SHORT " SEARCH_LOSS: the data packet loss in %% a rate of the search may have, "
+           "must be >= 0 and < 100, default %.1f\n"
 #endif
            ,
            prgname,
@@ -139,7 +197,14 @@ usage(const char *prgname) {
            UINT16_MAX,
            UINT16_MAX,
            UINT16_MAX,
-           UINT16_MAX);
+           UINT16_MAX,
+           MBUF_CACHE_SIZE * 2,
+           MAX_SEND_QUEUES,
+           DEFAULT_SEND_QUEUES
+#ifdef RATE_CONTROL
+           , DEFAULT_SEARCH_LOSS
+#endif
+           );
 }
 
 /* Parse the argument given in the command line of the application */
@@ -163,6 +228,13 @@ parse_args(int argc, char **argv) {
     control_tx_ring_size = DEFAULT_CONTROL_TX_RING_SIZE;
     control_rx_ring_size = DEFAULT_CONTROL_RX_RING_SIZE;
     trace_repeat = DEFAULT_TRACE_REPEAT;
+    send_pool_size = DEFAULT_SEND_POOL_SIZE;
+    send_queues = DEFAULT_SEND_QUEUES;
+#ifdef RATE_CONTROL
+    pacing = DEFAULT_PACING;
+    search_trials = DEFAULT_SEARCH_TRIALS;
+    search_loss = DEFAULT_SEARCH_LOSS;
+#endif
     trace_filename = NULL;
 
     argvopt = argv;
@@ -194,6 +266,12 @@ parse_args(int argc, char **argv) {
             case CMD_LINE_OPT_TRACE_REPEAT:
                 trace_repeat = atoi(optarg);
                 break;
+            case CMD_LINE_OPT_SEND_POOL_SIZE:
+                send_pool_size = atoi(optarg);
+                break;
+            case CMD_LINE_OPT_SEND_QUEUES:
+                send_queues = atoi(optarg);
+                break;
             case CMD_LINE_OPT_FORWARDER_CONTROL_MAC:
                 has_forwarder_control_mac = true;
                 ret = rte_ether_unformat_addr(optarg, &forwarder_control_mac);
@@ -211,6 +289,22 @@ parse_args(int argc, char **argv) {
                 has_rate_mpps = true;
                 mpps = atof(optarg);
                 break;
+            case CMD_LINE_OPT_PACING:
+                if (!strcmp(optarg, "constant"))
+                    pacing = PACING_CONSTANT;
+                else if (!strcmp(optarg, "poisson"))
+                    pacing = PACING_POISSON;
+                else if (!strcmp(optarg, "trace"))
+                    pacing = PACING_TRACE;
+                else
+                    rte_exit(EXIT_FAILURE, PARAM_PACING " should be constant, poisson or trace\n");
+                break;
+            case CMD_LINE_OPT_SEARCH_TRIALS:
+                search_trials = atoi(optarg);
+                break;
+            case CMD_LINE_OPT_SEARCH_LOSS:
+                search_loss = atof(optarg);
+                break;
 #endif
             case CMD_LINE_OPT_HELP:
                 usage(prgname);
@@ -227,9 +321,11 @@ parse_args(int argc, char **argv) {
            "data_rx_ring_size=%d, "
            "control_tx_ring_size=%d, "
            "control_rx_ring_size=%d, "
+           "send_pool_size=%d, "
+           "send_queues=%d, "
            "\n",
            data_send_burst_size, data_receive_burst_size, data_tx_ring_size, data_rx_ring_size,
-           control_tx_ring_size, control_rx_ring_size);
+           control_tx_ring_size, control_rx_ring_size, send_pool_size, send_queues);
 
 
     if (unlikely(data_receive_burst_size <= 0 || data_receive_burst_size > UINT16_MAX))
@@ -249,6 +345,15 @@ parse_args(int argc, char **argv) {
     if (unlikely(control_rx_ring_size <= 0 || control_rx_ring_size > UINT16_MAX))
         rte_exit(EXIT_FAILURE, PARAM_CONTROL_RX_RING_SIZE " should be > 0 and <= %d\n", UINT16_MAX);
 
+    if (unlikely(send_queues <= 0 || send_queues > MAX_SEND_QUEUES))
+        rte_exit(EXIT_FAILURE, PARAM_SEND_QUEUES " should be > 0 and <= %d\n", MAX_SEND_QUEUES);
+
+    if (unlikely(send_pool_size &&
+                 (send_pool_size < 0 ||
+                  send_pool_size < SEND_POOL_SIZE_MIN(data_tx_ring_size, data_send_burst_size, send_queues))))
+        rte_exit(EXIT_FAILURE, PARAM_SEND_POOL_SIZE " should be 0 or >= %d\n",
+                 SEND_POOL_SIZE_MIN(data_tx_ring_size, data_send_burst_size, send_queues));
+
     printf("trace repeat=%d\n", trace_repeat);
     if (unlikely(trace_repeat <= 0))
         rte_exit(EXIT_FAILURE, "Trace repeat should be > 0");
@@ -267,14 +372,32 @@ parse_args(int argc, char **argv) {
     printf(", data_mac=%s\n", addr_str_buf);
 
 #ifdef RATE_CONTROL
-    if (unlikely(!has_rate_mpps))
-        rte_exit(EXIT_FAILURE, "Must specify " PARAM_RATE_CONTROL_MPPS ", or comment out RATE_CONTROL to send as fast as we can\n");
-    printf("input MPPS=%.9f, ", mpps);
-    cycles_per_packet = (uint64_t)round(rte_get_timer_hz() / (mpps * 1000000));
-    mpps = rte_get_timer_hz() / 1000000.0 / cycles_per_packet;
-    printf("cycles_per_packet=%"PRIu64", real PPS=%.9f\n", cycles_per_packet, mpps * 1000000);
-    if (unlikely(mpps < (1 / 1000000.0) || cycles_per_packet <= 0)) // better not use the system if the user doesn't want to send even 1 pkt/sec
-        rte_exit(EXIT_FAILURE, PARAM_RATE_CONTROL_MPPS " too small (< 1pps) or it yields a cycles_per_packet < 0\n");
+    printf("pacing=%s\n", pacing == PACING_CONSTANT ? "constant" : pacing == PACING_POISSON ? "poisson" : "trace");
+    if (pacing == PACING_TRACE) {
+        // the rate is the one of the trace, parse_trace sets cycles_per_packet to its average
+        if (unlikely(has_rate_mpps))
+            rte_exit(EXIT_FAILURE, "Cannot specify " PARAM_RATE_CONTROL_MPPS " with " PARAM_PACING " trace\n");
+    } else {
+        if (unlikely(!has_rate_mpps))
+            rte_exit(EXIT_FAILURE, "Must specify " PARAM_RATE_CONTROL_MPPS ", or comment out RATE_CONTROL to send as fast as we can\n");
+        printf("input MPPS=%.9f, ", mpps);
+        cycles_per_packet = (uint64_t)round(rte_get_timer_hz() / (mpps * 1000000));
+        mpps = rte_get_timer_hz() / 1000000.0 / cycles_per_packet;
+        printf("cycles_per_packet=%"PRIu64", real PPS=%.9f\n", cycles_per_packet, mpps * 1000000);
+        if (unlikely(mpps < (1 / 1000000.0) || cycles_per_packet <= 0)) // better not use the system if the user doesn't want to send even 1 pkt/sec
+            rte_exit(EXIT_FAILURE, PARAM_RATE_CONTROL_MPPS " too small (< 1pps) or it yields a cycles_per_packet < 0\n");
+    }
+
+    printf("search_trials=%d, search_loss=%.6f%%\n", search_trials, search_loss);
+    if (unlikely(search_trials < 0))
+        rte_exit(EXIT_FAILURE, PARAM_SEARCH_TRIALS " should be >= 0\n");
+    if (unlikely(search_loss < 0 || search_loss >= 100))
+        rte_exit(EXIT_FAILURE, PARAM_SEARCH_LOSS " should be >= 0 and < 100\n");
+    // the prebuilt packets are freed once sent, so only --send_pool can send the trace more than once
+    if (unlikely(search_trials && !send_pool_size))
+        rte_exit(EXIT_FAILURE, PARAM_SEARCH_TRIALS " needs " PARAM_SEND_POOL_SIZE "\n");
+    if (unlikely(search_trials && pacing == PACING_TRACE))
+        rte_exit(EXIT_FAILURE, PARAM_SEARCH_TRIALS " cannot change the rate of " PARAM_PACING " trace\n");
 #endif
 
     if (optind >= 0)
@@ -4,6 +4,10 @@
 #include <string.h>
 #include "../common.h"
 #include "common.h"
+#ifdef RATE_CONTROL
+#include <math.h>
+#include <rte_random.h>
+#endif
 
 extern int data_send_burst_size;
 extern size_t data_packet_count, control_packet_count, total_packet_count;
@@ -14,10 +18,73 @@ extern struct rte_ether_addr my_data_mac, my_control_mac, forwarder_data_mac, fo
 extern struct rte_mempool *mbuf_pool_control_tx, *mbuf_pool_data_tx;
 extern struct rte_mbuf **trace_packets;
 extern packet_stat_t *results;
+extern int send_pool_size;
+extern struct rte_mempool *mbuf_pool_tx;
+extern trace_entry_t *trace;
+extern size_t trace_length;
+#ifdef RATE_CONTROL
+extern uint64_t cycles_per_packet;
+extern pacing_mode_t pacing;
+extern uint64_t *pace_offsets, pace_period;
+#endif
 
 int
 parse_trace(void);
 
+#ifdef RATE_CONTROL
+static void
+init_pacing(void) {
+    if (pacing == PACING_CONSTANT) // no schedule needed, packet i leaves at i * cycles_per_packet
+        return;
+    if (unlikely(!trace_length))
+        rte_exit(EXIT_FAILURE, "The trace is empty\n");
+    printf("creating pace_offsets\n");
+    pace_offsets = (uint64_t *) rte_malloc("PACE_OFFSETS", sizeof(uint64_t) * trace_length, 0);
+    if (unlikely(!pace_offsets))
+        rte_exit(EXIT_FAILURE, "Failed in creating pace_offsets\n");
+}
+
+/*
+ * --pacing poisson/trace: schedules packet i of the trace gap_tok ns (its 3rd column, NULL if none) after
+ * the one before it. The gap of packet 0 is the one after the last packet, when the trace is repeated.
+ */
+static void
+pace_packet(size_t i, const char *gap_tok, uint64_t *first_gap) {
+    uint64_t gap;
+
+    if (pacing == PACING_CONSTANT)
+        return;
+    if (pacing == PACING_POISSON) {
+        // -ln(U), U uniform in (0, 1], is exponential of mean 1
+        gap = (uint64_t) round(-log(((rte_rand() >> 11) + 1) * 0x1.0p-53) * cycles_per_packet);
+    } else {
+        if (unlikely(!gap_tok))
+            rte_exit(EXIT_FAILURE, "Line %zd of the trace has no inter-departure time, needed by pacing trace\n",
+                     i + 1);
+        gap = (uint64_t) round(strtod(gap_tok, NULL) * rte_get_timer_hz() / 1000000000.0);
+    }
+    if (i == 0) {
+        *first_gap = gap;
+        pace_offsets[0] = 0;
+    } else
+        pace_offsets[i] = pace_offsets[i - 1] + gap;
+}
+
+static void
+finish_pacing(uint64_t first_gap) {
+    if (pacing == PACING_CONSTANT)
+        return;
+    pace_period = pace_offsets[trace_length - 1] + first_gap;
+    if (pacing == PACING_TRACE) {
+        if (unlikely(!pace_period))
+            rte_exit(EXIT_FAILURE, "The inter-departure times of the trace add up to 0\n");
+        cycles_per_packet = RTE_MAX(pace_period / trace_length, (uint64_t) 1);
+    }
+    printf("pace_period=%"PRIu64" average cycles_per_packet=%.3f, PPS=%.9f\n", pace_period,
+           (double) pace_period / trace_length, (double) rte_get_timer_hz() * trace_length / pace_period);
+}
+#endif
+
 int
 parse_trace(void) {
     FILE *trace_file;
@@ -29,6 +96,9 @@ parse_trace(void) {
     struct rte_mbuf *pkt;
     common_t * common_header;
     size_t warmup_size = WARMUP_SIZE(data_send_burst_size);
+#ifdef RATE_CONTROL
+    uint64_t first_gap = 0;
+#endif
 
     trace_file = fopen(trace_filename, "r");
     if (unlikely(!trace_file))
@@ -46,6 +116,13 @@ parse_trace(void) {
     total_packet_count = data_packet_count + control_packet_count;
     printf("data_packet_count=%zd, control_packet_count=%zd, total_packet_count=%zd\n",
            data_packet_count, control_packet_count, total_packet_count);
+    trace_length = total_packet_count;
+#ifdef RATE_CONTROL
+    init_pacing();
+#endif
+
+    if (send_pool_size)
+        goto compact;
 
     printf("creating mbuf_pool_data_tx\n");
     /* Initialize data packet pool for tx */
@@ -83,6 +160,9 @@ parse_trace(void) {
         is_control = atoi(tok);
         tok = strtok(NULL, ",\n");
         node_id = (uint16_t) atoi(tok);
+#ifdef RATE_CONTROL
+        pace_packet(i, strtok(NULL, ",\n"), &first_gap);
+#endif
         for (j = 0; j < trace_repeat; j++) {
             results[j * total_packet_count + i].is_control = is_control;
             results[j * total_packet_count + i].dst_id = rte_cpu_to_be_16(node_id);
@@ -90,6 +170,9 @@ parse_trace(void) {
         i++;
     }
     fclose(trace_file);
+#ifdef RATE_CONTROL
+    finish_pacing(first_gap);
+#endif
 
     total_packet_count *= trace_repeat;
     data_packet_count = 0, control_packet_count = 0;
@@ -141,5 +224,58 @@ parse_trace(void) {
            data_packet_count, control_packet_count, total_packet_count);
 
 
+    return 0;
+
+compact:
+    // the packets are built by the send thread into mbufs recycled once the NIC sent them
+    printf("creating mbuf_pool_tx\n");
+    mbuf_pool_tx = rte_pktmbuf_pool_create("MBUF_POOL_TX", send_pool_size, MBUF_CACHE_SIZE, 0,
+                                           RTE_PKTMBUF_HEADROOM + RTE_MAX(DATA_PKT_SIZE, CONTROL_PKT_SIZE),
+                                           rte_socket_id());
+    if (unlikely(!mbuf_pool_tx))
+        rte_exit(EXIT_FAILURE, "Failed in creating mbuf_pool_tx\n");
+
+    printf("creating trace\n");
+    trace = (trace_entry_t *) rte_malloc("TRACE", sizeof(trace_entry_t) * trace_length, 0);
+    if (unlikely(!trace))
+        rte_exit(EXIT_FAILURE, "Failed in creating trace\n");
+
+    printf("creating results\n");
+    results = (packet_stat_t *) rte_zmalloc("PACKET_RESULTS", sizeof(packet_stat_t) * total_packet_count * trace_repeat,
+                                           sizeof(void *));
+    if (unlikely(!results))
+        rte_exit(EXIT_FAILURE, "Failed in creating results\n");
+
+    i = 0;
+    printf("reading the file again to fill the trace\n");
+    rewind(trace_file);
+    while (fgets(line, MAX_LINE_WIDTH, trace_file)) {
+        tok = strtok(line, ",\n");
+        is_control = atoi(tok);
+        tok = strtok(NULL, ",\n");
+        node_id = (uint16_t) atoi(tok);
+        trace[i].is_control = is_control;
+        trace[i].dst_id = rte_cpu_to_be_16(node_id);
+#ifdef RATE_CONTROL
+        pace_packet(i, strtok(NULL, ",\n"), &first_gap);
+#endif
+        for (j = 0; j < trace_repeat; j++) {
+            results[j * total_packet_count + i].is_control = is_control;
+            results[j * total_packet_count + i].dst_id = trace[i].dst_id;
+        }
+        i++;
+    }
+    fclose(trace_file);
+#ifdef RATE_CONTROL
+    finish_pacing(first_gap);
+#endif
+
+    total_packet_count *= trace_repeat;
+    data_packet_count *= trace_repeat;
+    control_packet_count *= trace_repeat;
+    rte_mempool_dump(stdout, mbuf_pool_tx);
+    printf("trace_length=%zd, data_packet_count=%zd, control_packet_count=%zd, total packet count=%zd\n",
+           trace_length, data_packet_count, control_packet_count, total_packet_count);
+
     return 0;
 }